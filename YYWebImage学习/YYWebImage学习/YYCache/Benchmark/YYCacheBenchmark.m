@@ -0,0 +1,654 @@
+//
+//  YYCacheBenchmark.m
+//  YYCache <https://github.com/ibireme/YYCache>
+//
+//  This source code is licensed under the MIT-style license found in the
+//  LICENSE file in the root directory of this source tree.
+//
+//  A Foundation-only benchmark runner, it prints the results of the cases named
+//  in the arguments (or all cases). Build it with optimization and run it in the
+//  iOS simulator (or on device for the real numbers) from this directory:
+//
+//  xcrun -sdk iphonesimulator clang -O2 -fobjc-arc -arch $(uname -m) -mios-simulator-version-min=10.0 \
+//      -framework Foundation -framework UIKit -framework QuartzCore -lsqlite3 -lcompression -I../YYCache \
+//      ../YYCache/*.m YYCacheBenchmark.m -o /tmp/YYCacheBenchmark
+//  xcrun simctl spawn booted /tmp/YYCacheBenchmark [case ...]
+//
+
+#import <Foundation/Foundation.h>
+#import <QuartzCore/QuartzCore.h>
+#import <libkern/OSAtomic.h>
+#import <CommonCrypto/CommonCrypto.h>
+#import "YYCache.h"
+
+/// Print a line of result.
+static void _YYReport(NSString *format, ...) NS_FORMAT_FUNCTION(1, 2);
+static void _YYReport(NSString *format, ...) {
+    va_list args;
+    va_start(args, format);
+    NSString *line = [[NSString alloc] initWithFormat:format arguments:args];
+    va_end(args);
+    printf("%s\n", line.UTF8String);
+}
+
+/// The seconds the block takes.
+static NSTimeInterval _YYMeasure(void (^block)(void)) {
+    NSTimeInterval begin = CACurrentMediaTime();
+    block();
+    return CACurrentMediaTime() - begin;
+}
+
+/// The seconds the threads take to run the block together, the block is passed the thread index.
+static NSTimeInterval _YYMeasureThreads(int threadCount, void (^block)(int index)) {
+    dispatch_semaphore_t start = dispatch_semaphore_create(0);
+    dispatch_group_t group = dispatch_group_create();
+    for (int i = 0; i < threadCount; i++) {
+        dispatch_group_enter(group);
+        NSThread *thread = [[NSThread alloc] initWithBlock:^{
+            dispatch_semaphore_wait(start, DISPATCH_TIME_FOREVER);
+            block(i);
+            dispatch_group_leave(group);
+        }];
+        [thread start];
+    }
+    usleep(10 * 1000); // let the threads wait for the start
+    NSTimeInterval begin = CACurrentMediaTime();
+    for (int i = 0; i < threadCount; i++) {
+        dispatch_semaphore_signal(start);
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    return CACurrentMediaTime() - begin;
+}
+
+/// A deterministic pseudo-random number (xorshift64*).
+static uint64_t _YYRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/// The keys @"0" ..< count.
+static NSArray<NSString *> *_YYKeys(NSUInteger count) {
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [keys addObject:@(i).description];
+    }
+    return keys;
+}
+
+/// An empty directory for a cache.
+static NSString *_YYCachePath(NSString *name) {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"YYCacheBenchmark-%@", name]];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    return path;
+}
+
+static NSData *_YYRandomData(NSUInteger length, uint64_t *seed) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)_YYRandom(seed);
+    }
+    return data;
+}
+
+
+#pragma mark - YYMemoryCache
+
+/// Throughput of memory cache hits (with 10% writes) from 1 to 16 threads, single lock vs shards.
+static void benchmarkSharding(void) {
+    const int opsPerThread = 200000;
+    NSArray *keys = _YYKeys(10000);
+    _YYReport(@"threads  shards:1 (Mops/s)  shards:16 (Mops/s)");
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        double mops[2];
+        for (int s = 0; s < 2; s++) {
+            YYMemoryCache *cache = [[YYMemoryCache alloc] initWithShardCount:s == 0 ? 1 : 16];
+            for (NSString *key in keys) {
+                [cache setObject:key forKey:key];
+            }
+            NSTimeInterval time = _YYMeasureThreads(threads, ^(int index) {
+                uint32_t seed = index * 7919 + 1;
+                for (int i = 0; i < opsPerThread; i++) {
+                    seed = seed * 1103515245 + 12345;
+                    NSString *key = keys[(seed >> 8) % keys.count];
+                    if (i % 10 == 0) {
+                        [cache setObject:key forKey:key];
+                    } else {
+                        [cache objectForKey:key];
+                    }
+                }
+            });
+            mops[s] = threads * opsPerThread / time / 1e6;
+        }
+        _YYReport(@"%7d  %17.2f  %18.2f", threads, mops[0], mops[1]);
+    }
+}
+
+/// Insert and evict churn of a memory cache holding 100k objects (the nodes are kept in a slab).
+static void benchmarkChurn(void) {
+    const NSUInteger capacity = 100000, count = 1000000;
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [keys addObject:@(i)];
+    }
+    YYMemoryCache *cache = [YYMemoryCache new];
+    cache.countLimit = capacity;
+    cache.releaseAsynchronously = NO; // count the release of evicted objects
+    NSTimeInterval fill = _YYMeasure(^{
+        for (NSUInteger i = 0; i < capacity; i++) {
+            [cache setObject:keys[i] forKey:keys[i]];
+        }
+    });
+    NSTimeInterval churn = _YYMeasure(^{
+        for (NSUInteger i = capacity; i < count; i++) {
+            [cache setObject:keys[i] forKey:keys[i]]; // evicts one
+        }
+    });
+    NSTimeInterval remove = _YYMeasure(^{
+        for (NSUInteger i = count - capacity; i < count; i++) {
+            [cache removeObjectForKey:keys[i]];
+        }
+    });
+    _YYReport(@"insert: %.0f ns/op", fill / capacity * 1e9);
+    _YYReport(@"insert and evict: %.0f ns/op", churn / (count - capacity) * 1e9);
+    _YYReport(@"remove: %.0f ns/op", remove / capacity * 1e9);
+}
+
+/// A key stream of `length` keys in 0 ..< `count`, key i is accessed with probability ~ 1 / (i+1)^skew.
+static NSMutableArray<NSNumber *> *_YYZipfTrace(NSUInteger count, double skew, NSUInteger length, uint64_t seed) {
+    double *cdf = malloc(count * sizeof(double));
+    double sum = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1, skew);
+        cdf[i] = sum;
+    }
+    NSMutableArray *trace = [NSMutableArray arrayWithCapacity:length];
+    for (NSUInteger n = 0; n < length; n++) {
+        double r = (_YYRandom(&seed) >> 11) * (1.0 / 9007199254740992.0) * sum;
+        NSUInteger lo = 0, hi = count - 1;
+        while (lo < hi) {
+            NSUInteger mid = (lo + hi) / 2;
+            if (cdf[mid] < r) lo = mid + 1;
+            else hi = mid;
+        }
+        [trace addObject:@(lo)];
+    }
+    free(cdf);
+    return trace;
+}
+
+/// The hit ratio of replaying the trace on a memory cache which holds `capacity` objects.
+static double _YYReplay(NSArray *trace, NSUInteger capacity, YYMemoryCacheEvictionPolicy policy) {
+    YYMemoryCache *cache = [YYMemoryCache new];
+    cache.countLimit = capacity;
+    cache.evictionPolicy = policy;
+    NSUInteger hits = 0;
+    for (id key in trace) {
+        if ([cache objectForKey:key]) {
+            hits++;
+        } else {
+            [cache setObject:key forKey:key];
+        }
+    }
+    return (double)hits / trace.count;
+}
+
+/**
+ Hit ratio of LRU and TinyLFU. The traces are a zipf stream, the same stream with
+ one-time scans (a long feed) in the middle, and the keys of the text file (one
+ key per line) at the path in the environment variable `YY_TRACE` if it's set.
+ */
+static void benchmarkEvictionPolicy(void) {
+    NSMutableArray *names = [NSMutableArray new];
+    NSMutableArray *traces = [NSMutableArray new];
+    [names addObject:@"zipf 0.9"];
+    [traces addObject:_YYZipfTrace(100000, 0.9, 1000000, 1)];
+    
+    NSArray *zipf = _YYZipfTrace(100000, 0.9, 1000000, 2);
+    NSMutableArray *scan = [NSMutableArray arrayWithCapacity:zipf.count + 200000];
+    NSUInteger unique = 100000;
+    for (NSUInteger i = 0; i < zipf.count; i++) {
+        [scan addObject:zipf[i]];
+        if (i >= 300000 && i < 500000) [scan addObject:@(unique++)]; // interleaved keys never accessed again
+    }
+    [names addObject:@"zipf 0.9 + scan"];
+    [traces addObject:scan];
+    
+    NSString *path = NSProcessInfo.processInfo.environment[@"YY_TRACE"];
+    NSString *text = path ? [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL] : nil;
+    NSArray *lines = [text componentsSeparatedByCharactersInSet:NSCharacterSet.newlineCharacterSet];
+    lines = [lines filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"length > 0"]];
+    if (lines.count) {
+        [names addObject:path.lastPathComponent];
+        [traces addObject:lines];
+    }
+    
+    _YYReport(@"%-20s  %8s  %8s  %8s", "trace", "capacity", "LRU", "TinyLFU");
+    for (NSUInteger t = 0; t < traces.count; t++) {
+        for (NSUInteger capacity = 1000; capacity <= 10000; capacity *= 10) {
+            double lru = _YYReplay(traces[t], capacity, YYMemoryCacheEvictionPolicyLRU);
+            double lfu = _YYReplay(traces[t], capacity, YYMemoryCacheEvictionPolicyTinyLFU);
+            _YYReport(@"%-20s  %8lu  %7.2f%%  %7.2f%%", [names[t] UTF8String], (unsigned long)capacity, lru * 100, lfu * 100);
+        }
+    }
+}
+
+
+#pragma mark - YYKVStorage
+
+/// Batch lookups of 10k inline items, the multi-key queries use the cached statements of 1, 8, 32 and 128 keys.
+static void benchmarkBatchLookup(void) {
+    const NSUInteger count = 10000, lookups = 20000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_YYCachePath(@"batch-lookup") type:YYKVStorageTypeSQLite];
+    [kv beginTransaction];
+    for (NSString *key in keys) {
+        [kv saveItemWithKey:key value:_YYRandomData(100, &seed)];
+    }
+    [kv commitTransaction];
+    
+    const NSUInteger batchSizes[] = {1, 5, 8, 20, 32, 100, 128};
+    _YYReport(@"batch  us/batch  us/key");
+    for (int b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); b++) {
+        NSUInteger batch = batchSizes[b];
+        NSUInteger rounds = lookups / batch;
+        NSMutableArray *batches = [NSMutableArray arrayWithCapacity:rounds];
+        for (NSUInteger r = 0; r < rounds; r++) {
+            [batches addObject:[keys subarrayWithRange:NSMakeRange(_YYRandom(&seed) % (count - batch), batch)]];
+        }
+        NSTimeInterval time = _YYMeasure(^{
+            for (NSArray *batchKeys in batches) {
+                [kv getItemForKeys:batchKeys];
+            }
+        });
+        _YYReport(@"%5lu  %8.1f  %6.2f", (unsigned long)batch, time / rounds * 1e6, time / (rounds * batch) * 1e6);
+    }
+}
+
+/// Items per second of 1k small inline writes, one transaction each vs batched in transactions.
+static void benchmarkWriteBatching(void) {
+    const NSUInteger count = 1000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [values addObject:_YYRandomData(100, &seed)];
+    }
+    
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_YYCachePath(@"write-storage") type:YYKVStorageTypeSQLite];
+    NSTimeInterval autocommit = _YYMeasure(^{
+        for (NSUInteger i = 0; i < count; i++) {
+            [kv saveItemWithKey:keys[i] value:values[i]];
+        }
+    });
+    NSTimeInterval transaction = _YYMeasure(^{
+        [kv beginTransaction];
+        for (NSUInteger i = 0; i < count; i++) {
+            [kv saveItemWithKey:keys[i] value:values[i]];
+        }
+        [kv commitTransaction];
+    });
+    
+    YYDiskCache *cache = [[YYDiskCache alloc] initWithPath:_YYCachePath(@"write-cache") inlineThreshold:NSUIntegerMax];
+    NSTimeInterval sync = _YYMeasure(^{
+        for (NSUInteger i = 0; i < count; i++) {
+            [cache setObject:values[i] forKey:keys[i]];
+        }
+    });
+    NSTimeInterval async = _YYMeasure(^{
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < count; i++) {
+            dispatch_group_enter(group);
+            [cache setObject:values[i] forKey:keys[i] withBlock:^{
+                dispatch_group_leave(group);
+            }];
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    });
+    
+    _YYReport(@"YYKVStorage autocommit: %.0f items/s", count / autocommit);
+    _YYReport(@"YYKVStorage one transaction: %.0f items/s", count / transaction);
+    _YYReport(@"YYDiskCache setObject:forKey: %.0f items/s", count / sync);
+    _YYReport(@"YYDiskCache setObject:forKey:withBlock: (batched) %.0f items/s", count / async);
+}
+
+/// Write, read and evict throughput of 20KB values, a file per item vs segment files.
+static void benchmarkSegmentFiles(void) {
+    const NSUInteger count = 5000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    NSData *value = _YYRandomData(20 * 1024, &seed);
+    _YYReport(@"layout     write (items/s)  read (items/s)  evict half (items/s)  compact (s)");
+    for (int s = 0; s < 2; s++) {
+        YYKVStorageType type = s == 0 ? YYKVStorageTypeMixed : YYKVStorageTypeSegment;
+        YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_YYCachePath(@"segment-files") type:type];
+        NSTimeInterval write = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [kv saveItemWithKey:key value:value filename:key extendedData:nil];
+            }
+        });
+        NSTimeInterval read = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [kv getItemValueForKey:key];
+            }
+        });
+        NSTimeInterval evict = _YYMeasure(^{
+            [kv removeItemsToFitCount:(int)count / 2];
+        });
+        NSTimeInterval compact = s == 0 ? 0 : _YYMeasure(^{
+            while ([kv compactSegments]);
+        });
+        _YYReport(@"%-9s  %15.0f  %14.0f  %20.0f  %11.3f", s == 0 ? "file" : "segment",
+                  count / write, count / read, count / 2 / evict, compact);
+    }
+}
+
+/// Trim 50% of a 100k-entry storage by count, then 50% of the rest by size, with the in-memory access order index.
+static void benchmarkTrim(void) {
+    const NSUInteger count = 100000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_YYCachePath(@"trim") type:YYKVStorageTypeSQLite];
+    [kv beginTransaction];
+    for (NSString *key in keys) {
+        [kv saveItemWithKey:key value:_YYRandomData(100 + _YYRandom(&seed) % 100, &seed)];
+    }
+    [kv commitTransaction];
+    
+    NSTimeInterval byCount = _YYMeasure(^{
+        [kv removeItemsToFitCount:(int)count / 2]; // loads the index first
+    });
+    int size = [kv getItemsSize];
+    NSTimeInterval bySize = _YYMeasure(^{
+        [kv removeItemsToFitSize:size / 2];
+    });
+    _YYReport(@"trim 100k to 50k by count (with index loading): %.3f s", byCount);
+    _YYReport(@"trim 50k to half size: %.3f s", bySize);
+}
+
+
+#pragma mark - YYDiskCache
+
+/// Reads per second of 4KB inline objects from 1 to 8 threads, while another thread writes 2MB files.
+static void benchmarkConcurrentReads(void) {
+    const int readsPerThread = 5000;
+    NSArray *keys = _YYKeys(1000);
+    uint64_t seed = 1;
+    NSData *small = _YYRandomData(4 * 1024, &seed);
+    NSData *large = _YYRandomData(2 * 1024 * 1024, &seed);
+    _YYReport(@"readers  reads/s (no writer)  reads/s (with writer)  writes/s");
+    for (int readers = 1; readers <= 8; readers *= 2) {
+        double readRates[2], writeRate = 0;
+        for (int w = 0; w < 2; w++) {
+            YYDiskCache *cache = [[YYDiskCache alloc] initWithPath:_YYCachePath([NSString stringWithFormat:@"concurrent-reads-%d-%d", readers, w])];
+            for (NSString *key in keys) {
+                [cache setObject:small forKey:key];
+            }
+            __block volatile int32_t running = readers;
+            __block int writes = 0;
+            NSTimeInterval time = _YYMeasureThreads(readers + w, ^(int index) {
+                if (index == readers) { // the writer
+                    while (running > 0) {
+                        [cache setObject:large forKey:[NSString stringWithFormat:@"large-%d", writes++ % 8]];
+                    }
+                    return;
+                }
+                uint32_t random = index * 7919 + 1;
+                for (int i = 0; i < readsPerThread; i++) {
+                    random = random * 1103515245 + 12345;
+                    [cache objectForKey:keys[(random >> 8) % keys.count]];
+                }
+                OSAtomicDecrement32Barrier(&running);
+            });
+            readRates[w] = readers * readsPerThread / time;
+            if (w) writeRate = writes / time;
+        }
+        _YYReport(@"%7d  %19.0f  %21.0f  %8.1f", readers, readRates[0], readRates[1], writeRate);
+    }
+}
+
+/// JSON-like objects: arrays of 10 to 200 feed items.
+static NSArray *_YYFeedCorpus(NSUInteger count, uint64_t *seed) {
+    NSArray *words = [@"the image cache feed user avatar photo like comment share follow video story post time city night day light blue" componentsSeparatedByString:@" "];
+    NSMutableArray *corpus = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSUInteger itemCount = 10 + _YYRandom(seed) % 190;
+        NSMutableArray *items = [NSMutableArray arrayWithCapacity:itemCount];
+        for (NSUInteger j = 0; j < itemCount; j++) {
+            NSMutableString *text = [NSMutableString new];
+            for (NSUInteger w = _YYRandom(seed) % 30; w > 0; w--) {
+                [text appendFormat:@"%@ ", words[_YYRandom(seed) % words.count]];
+            }
+            uint64_t userID = _YYRandom(seed) % 100000;
+            [items addObject:@{@"id" : @(_YYRandom(seed) % 1000000000),
+                               @"user" : @{@"id" : @(userID),
+                                           @"name" : [NSString stringWithFormat:@"user_%llu", userID],
+                                           @"avatar_url" : [NSString stringWithFormat:@"https://example.com/avatar/%llu.jpg", userID]},
+                               @"text" : text,
+                               @"like_count" : @(_YYRandom(seed) % 10000),
+                               @"created_at" : [NSDate dateWithTimeIntervalSince1970:1400000000 + _YYRandom(seed) % 100000000],
+                               @"tags" : @[words[_YYRandom(seed) % words.count], words[_YYRandom(seed) % words.count]]}];
+        }
+        [corpus addObject:items];
+    }
+    return corpus;
+}
+
+/// Disk bytes and time of writing and reading a JSON-like corpus with each codec.
+static void benchmarkCodecs(void) {
+    uint64_t seed = 1;
+    NSArray *corpus = _YYFeedCorpus(200, &seed);
+    NSArray *keys = _YYKeys(corpus.count);
+    const char *names[] = {"none", "lz4", "lzfse", "lzma"};
+    YYDiskCacheCodec codecs[] = {YYDiskCacheCodecNone, YYDiskCacheCodecLZ4, YYDiskCacheCodecLZFSE, YYDiskCacheCodecLZMA};
+    NSInteger rawSize = 0;
+    _YYReport(@"codec  disk bytes  saved   write (ms)  read (ms)");
+    for (int c = 0; c < 4; c++) {
+        YYDiskCache *cache = [[YYDiskCache alloc] initWithPath:_YYCachePath([NSString stringWithFormat:@"codec-%s", names[c]]) inlineThreshold:NSUIntegerMax];
+        cache.codec = codecs[c];
+        NSTimeInterval write = _YYMeasure(^{
+            for (NSUInteger i = 0; i < corpus.count; i++) {
+                [cache setObject:corpus[i] forKey:keys[i]];
+            }
+        });
+        NSTimeInterval read = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [cache objectForKey:key];
+            }
+        });
+        NSInteger size = cache.totalCost;
+        if (c == 0) rawSize = size;
+        _YYReport(@"%-5s  %10ld  %5.1f%%  %10.1f  %9.1f", names[c], (long)size,
+                  rawSize ? (1 - (double)size / rawSize) * 100 : 0, write * 1e3, read * 1e3);
+    }
+}
+
+/// String's md5 hash, the file name of the old versions.
+static NSString *_YYMD5(NSString *string) {
+    NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char result[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(data.bytes, (CC_LONG)data.length, result);
+    NSMutableString *hash = [NSMutableString stringWithCapacity:CC_MD5_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_MD5_DIGEST_LENGTH; i++) {
+        [hash appendFormat:@"%02x", result[i]];
+    }
+    return hash;
+}
+
+/// Throughput of 100k file-backed objects, the file names hashed by MurmurHash3 (default) vs md5.
+static void benchmarkFileNames(void) {
+    const NSUInteger count = 100000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    NSData *value = _YYRandomData(1024, &seed);
+    _YYReport(@"file name    write (items/s)  read (items/s)  remove (items/s)");
+    for (int h = 0; h < 2; h++) {
+        YYDiskCache *cache = [[YYDiskCache alloc] initWithPath:_YYCachePath([NSString stringWithFormat:@"file-names-%d", h]) inlineThreshold:0];
+        if (h == 1) {
+            cache.customFileNameBlock = ^NSString *(NSString *key) {
+                return _YYMD5(key);
+            };
+        }
+        NSTimeInterval write = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [cache setObject:value forKey:key];
+            }
+        });
+        NSTimeInterval read = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [cache objectForKey:key];
+            }
+        });
+        NSTimeInterval remove = _YYMeasure(^{
+            [cache removeObjectsForKeys:keys];
+        });
+        _YYReport(@"%-11s  %15.0f  %14.0f  %16.0f", h == 0 ? "murmurhash3" : "md5", count / write, count / read, count / remove);
+    }
+}
+
+/// A small model object archived by NSKeyedArchiver.
+@interface YYBenchmarkUser : NSObject <NSCoding>
+@property (nonatomic) int64_t userID;
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSString *avatarURL;
+@property (nonatomic) int64_t followerCount;
+@property (nonatomic) BOOL verified;
+@property (nonatomic) double createdAt;
+@property (nonatomic, copy) NSArray<NSString *> *tags;
+@end
+
+@implementation YYBenchmarkUser
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeInt64:_userID forKey:@"userID"];
+    [coder encodeObject:_name forKey:@"name"];
+    [coder encodeObject:_avatarURL forKey:@"avatarURL"];
+    [coder encodeInt64:_followerCount forKey:@"followerCount"];
+    [coder encodeBool:_verified forKey:@"verified"];
+    [coder encodeDouble:_createdAt forKey:@"createdAt"];
+    [coder encodeObject:_tags forKey:@"tags"];
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder {
+    self = [super init];
+    _userID = [coder decodeInt64ForKey:@"userID"];
+    _name = [coder decodeObjectForKey:@"name"];
+    _avatarURL = [coder decodeObjectForKey:@"avatarURL"];
+    _followerCount = [coder decodeInt64ForKey:@"followerCount"];
+    _verified = [coder decodeBoolForKey:@"verified"];
+    _createdAt = [coder decodeDoubleForKey:@"createdAt"];
+    _tags = [coder decodeObjectForKey:@"tags"];
+    return self;
+}
+
+@end
+
+/// The same model archived in the binary format of YYDiskCache.
+@interface YYBenchmarkBinaryUser : YYBenchmarkUser <YYDiskCacheBinaryCoding>
+@end
+
+@implementation YYBenchmarkBinaryUser
+
+- (void)encodeWithBinaryWriter:(YYDiskCacheBinaryWriter *)writer {
+    [writer writeInteger:self.userID];
+    [writer writeString:self.name];
+    [writer writeString:self.avatarURL];
+    [writer writeInteger:self.followerCount];
+    [writer writeBool:self.verified];
+    [writer writeDouble:self.createdAt];
+    [writer writeObject:self.tags];
+}
+
+- (instancetype)initWithBinaryReader:(YYDiskCacheBinaryReader *)reader version:(uint32_t)version {
+    self = [super init];
+    self.userID = [reader readInteger];
+    self.name = [reader readString];
+    self.avatarURL = [reader readString];
+    self.followerCount = [reader readInteger];
+    self.verified = [reader readBool];
+    self.createdAt = [reader readDouble];
+    self.tags = [reader readObject];
+    return self;
+}
+
+@end
+
+/// Bytes and time of 5k small model objects, keyed archiving vs the binary format.
+static void benchmarkBinaryCoding(void) {
+    const NSUInteger count = 5000;
+    NSArray *keys = _YYKeys(count);
+    uint64_t seed = 1;
+    _YYReport(@"archive  disk bytes  write (ms)  read (ms)");
+    for (int b = 0; b < 2; b++) {
+        NSMutableArray *users = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            YYBenchmarkUser *user = b == 0 ? [YYBenchmarkUser new] : [YYBenchmarkBinaryUser new];
+            user.userID = _YYRandom(&seed) % 100000000;
+            user.name = [NSString stringWithFormat:@"user_%lld", user.userID];
+            user.avatarURL = [NSString stringWithFormat:@"https://example.com/avatar/%lld.jpg", user.userID];
+            user.followerCount = _YYRandom(&seed) % 100000;
+            user.verified = _YYRandom(&seed) % 2;
+            user.createdAt = 1400000000 + _YYRandom(&seed) % 100000000;
+            user.tags = @[@"photo", @"travel"];
+            [users addObject:user];
+        }
+        YYDiskCache *cache = [[YYDiskCache alloc] initWithPath:_YYCachePath([NSString stringWithFormat:@"binary-coding-%d", b]) inlineThreshold:NSUIntegerMax];
+        NSTimeInterval write = _YYMeasure(^{
+            for (NSUInteger i = 0; i < count; i++) {
+                [cache setObject:users[i] forKey:keys[i]];
+            }
+        });
+        NSTimeInterval read = _YYMeasure(^{
+            for (NSString *key in keys) {
+                [cache objectForKey:key];
+            }
+        });
+        _YYReport(@"%-7s  %10ld  %10.1f  %9.1f", b == 0 ? "keyed" : "binary", (long)cache.totalCost, write * 1e3, read * 1e3);
+    }
+}
+
+
+#pragma mark - main
+
+typedef struct {
+    const char *name;
+    void (*function)(void);
+} _YYBenchmarkCase;
+
+static const _YYBenchmarkCase _YYBenchmarkCases[] = {
+    {"sharding", benchmarkSharding},
+    {"churn", benchmarkChurn},
+    {"eviction-policy", benchmarkEvictionPolicy},
+    {"batch-lookup", benchmarkBatchLookup},
+    {"write-batching", benchmarkWriteBatching},
+    {"segment-files", benchmarkSegmentFiles},
+    {"trim", benchmarkTrim},
+    {"concurrent-reads", benchmarkConcurrentReads},
+    {"codecs", benchmarkCodecs},
+    {"file-names", benchmarkFileNames},
+    {"binary-coding", benchmarkBinaryCoding},
+};
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        NSMutableSet *names = [NSMutableSet new];
+        for (int i = 1; i < argc; i++) {
+            [names addObject:@(argv[i])];
+        }
+        for (size_t i = 0; i < sizeof(_YYBenchmarkCases) / sizeof(_YYBenchmarkCases[0]); i++) {
+            NSString *name = @(_YYBenchmarkCases[i].name);
+            if (names.count && ![names containsObject:name]) continue;
+            _YYReport(@"== %@", name);
+            @autoreleasepool {
+                _YYBenchmarkCases[i].function();
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+//
+//  YYKVStorageTests.m
+//  YYCache <https://github.com/ibireme/YYCache>
+//
+//  This source code is licensed under the MIT-style license found in the
+//  LICENSE file in the root directory of this source tree.
+//
+//  A Foundation-only test runner, it exits with non-zero status if any test fails.
+//  Build and run it in the iOS simulator from this directory:
+//
+//  xcrun -sdk iphonesimulator clang -fobjc-arc -arch $(uname -m) -mios-simulator-version-min=9.0 \
+//      -framework Foundation -framework UIKit -framework QuartzCore -lsqlite3 -I../YYCache \
+//      ../YYCache/YYKVStorage.m YYKVStorageTests.m -o /tmp/YYKVStorageTests
+//  xcrun simctl spawn booted /tmp/YYKVStorageTests
+//
+
+#import <Foundation/Foundation.h>
+#import <sqlite3.h>
+#import <unistd.h>
+#import "YYKVStorage.h"
+
+static int _failureCount = 0;
+
+#define YYAssert(condition, ...) do { \
+    if (!(condition)) { \
+        _failureCount++; \
+        NSLog(@"FAIL %s line:%d %@", __FUNCTION__, __LINE__, [NSString stringWithFormat:__VA_ARGS__]); \
+    } \
+} while (0)
+
+
+/// An empty directory for a storage.
+static NSString *_YYStoragePath(NSString *name) {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"YYKVStorageTests-%@", name]];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    return path;
+}
+
+static NSData *_YYValue(char c, NSUInteger length) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    memset(data.mutableBytes, c, length);
+    return data;
+}
+
+/// Run the statements on the manifest of a closed storage.
+static BOOL _YYExecuteSql(NSString *path, NSString *sql) {
+    sqlite3 *db = NULL;
+    if (sqlite3_open([path stringByAppendingPathComponent:@"manifest.sqlite"].UTF8String, &db) != SQLITE_OK) return NO;
+    BOOL suc = sqlite3_exec(db, sql.UTF8String, NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_close(db);
+    return suc;
+}
+
+/**
+ The compaction drops a broken value (and its key from the key filter), then fails
+ to append the next value, the rolled back keys should be found again.
+ */
+static void testCompactionFailure(void) {
+    NSString *path = _YYStoragePath(@"compaction");
+    NSData *value1 = _YYValue('1', 100), *value2 = _YYValue('2', 100);
+    @autoreleasepool {
+        YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:path type:YYKVStorageTypeSegment];
+        YYAssert(kv, @"open");
+        YYAssert([kv saveItemWithKey:@"broken" value:_YYValue('0', 100) filename:@"broken" extendedData:nil], @"save broken");
+        YYAssert([kv saveItemWithKey:@"intact1" value:value1 filename:@"intact1" extendedData:nil], @"save intact1");
+        YYAssert([kv saveItemWithKey:@"intact2" value:value2 filename:@"intact2" extendedData:nil], @"save intact2");
+    }
+    
+    // segment 1 is all dead and "broken" points out of the file, segment 2 is full after
+    // one more append, and segment 3 can't be created.
+    NSString *dataPath = [path stringByAppendingPathComponent:@"data"];
+    off_t fullSize = 16 * 1024 * 1024;
+    NSString *segment2 = [dataPath stringByAppendingPathComponent:@"segment-2"];
+    YYAssert([[NSFileManager defaultManager] createFileAtPath:segment2 contents:nil attributes:nil], @"create segment 2");
+    YYAssert(truncate(segment2.fileSystemRepresentation, fullSize - 1) == 0, @"truncate segment 2");
+    YYAssert([[NSFileManager defaultManager] createDirectoryAtPath:[dataPath stringByAppendingPathComponent:@"segment-3"] withIntermediateDirectories:NO attributes:nil error:NULL], @"block segment 3");
+    NSString *sql = [NSString stringWithFormat:@"update segment set dead_size = size where id = 1;"
+                     @"insert into segment (id, size, dead_size) values (2, %lld, 0);"
+                     @"update manifest set filename = '1:%lld:100' where key = 'broken';", (long long)fullSize - 1, (long long)fullSize];
+    YYAssert(_YYExecuteSql(path, sql), @"prepare manifest");
+    
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:path type:YYKVStorageTypeSegment];
+    kv.errorLogsEnabled = NO;
+    YYAssert(![kv compactSegments], @"compaction should fail");
+    for (NSString *key in @[@"broken", @"intact1", @"intact2"]) {
+        YYAssert([kv itemMayExistForKey:key], @"%@ is not in the filter", key);
+        YYAssert([kv itemExistsForKey:key], @"%@ doesn't exist", key);
+    }
+    YYAssert([[kv readItemForKey:@"intact1"].value isEqualToData:value1], @"read intact1");
+    YYAssert([[kv getItemValueForKey:@"intact2"] isEqualToData:value2], @"read intact2");
+    YYAssert([kv getItemsCount] == 3, @"count %d", [kv getItemsCount]);
+}
+
+/// The key filter counts a key once however it's saved and removed.
+static void testFilterUpdates(void) {
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_YYStoragePath(@"filter") type:YYKVStorageTypeSQLite];
+    YYAssert([kv saveItemWithKey:@"a" value:_YYValue('a', 10)], @"save a");
+    YYAssert([kv saveItemWithKey:@"a" value:_YYValue('A', 10)], @"overwrite a");
+    YYAssert([kv saveItemWithKey:@"b" value:_YYValue('b', 10)], @"save b");
+    YYAssert([kv saveItemWithKey:@"c" value:_YYValue('c', 10)], @"save c");
+    YYAssert([kv removeItemForKeys:@[@"a", @"a", @"b", @"missing"]], @"remove");
+    YYAssert(![kv itemMayExistForKey:@"a"], @"a is still in the filter");
+    YYAssert(![kv itemMayExistForKey:@"b"], @"b is still in the filter");
+    YYAssert([kv itemExistsForKey:@"c"], @"c is lost");
+    
+    YYAssert([kv saveItemWithKey:@"a" value:_YYValue('a', 10)], @"save a again");
+    YYAssert([kv itemExistsForKey:@"a"], @"a is lost");
+    YYAssert([kv removeItemForKey:@"a"], @"remove a");
+    YYAssert(![kv itemMayExistForKey:@"a"], @"a is still in the filter");
+    YYAssert([kv itemExistsForKey:@"c"], @"c is lost");
+}
+
+/// The content dedup mode is kept after reopening, the shared file isn't deleted with one of its items.
+static void testContentDedupKept(void) {
+    NSString *path = _YYStoragePath(@"dedup");
+    NSData *value = _YYValue('v', 100);
+    @autoreleasepool {
+        YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:path type:YYKVStorageTypeFile];
+        kv.contentDedupEnabled = YES;
+        YYAssert(kv.contentDedupEnabled, @"enable");
+        YYAssert([kv saveItemWithKey:@"a" value:value filename:@"shared" extendedData:nil], @"save a");
+        YYAssert([kv saveItemWithKey:@"b" value:value filename:@"shared" extendedData:nil], @"save b");
+    }
+    
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:path type:YYKVStorageTypeFile];
+    YYAssert(kv.contentDedupEnabled, @"the mode is not kept");
+    kv.contentDedupEnabled = NO;
+    YYAssert(kv.contentDedupEnabled, @"the mode is disabled");
+    YYAssert([kv getItemsCount] == 2, @"count %d", [kv getItemsCount]);
+    YYAssert([kv removeItemForKey:@"a"], @"remove a");
+    YYAssert([[kv getItemValueForKey:@"b"] isEqualToData:value], @"the shared file is deleted");
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        testCompactionFailure();
+        testFilterUpdates();
+        testContentDedupKept();
+        NSLog(@"YYKVStorageTests: %d failure(s)", _failureCount);
+    }
+    return _failureCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+//
+//  YYMemoryCacheTests.m
+//  YYCache <https://github.com/ibireme/YYCache>
+//
+//  This source code is licensed under the MIT-style license found in the
+//  LICENSE file in the root directory of this source tree.
+//
+//  A Foundation-only test runner, it exits with non-zero status if any test fails.
+//  Build and run it in the iOS simulator from this directory:
+//
+//  xcrun -sdk iphonesimulator clang -fobjc-arc -arch $(uname -m) -mios-simulator-version-min=9.0 \
+//      -framework Foundation -framework UIKit -framework QuartzCore -I../YYCache \
+//      ../YYCache/YYMemoryCache.m YYMemoryCacheTests.m -o /tmp/YYMemoryCacheTests
+//  xcrun simctl spawn booted /tmp/YYMemoryCacheTests
+//
+
+#import <Foundation/Foundation.h>
+#import "YYMemoryCache.h"
+
+static int _failureCount = 0;
+
+#define YYAssert(condition, ...) do { \
+    if (!(condition)) { \
+        _failureCount++; \
+        NSLog(@"FAIL %s line:%d %@", __FUNCTION__, __LINE__, [NSString stringWithFormat:__VA_ARGS__]); \
+    } \
+} while (0)
+
+
+/**
+ Delivers the memory pressure levels only when `simulate:` is called, instead of
+ the system dispatch source and memory warnings.
+ */
+@interface YYFakeMemoryPressureSource : NSObject <YYMemoryPressureSource>
+@property (nonatomic, copy) void (^handler)(YYMemoryPressureLevel level);
+- (void)simulate:(YYMemoryPressureLevel)level;
+@end
+
+@implementation YYFakeMemoryPressureSource
+
+- (void)startWithHandler:(void (^)(YYMemoryPressureLevel))handler {
+    self.handler = handler;
+}
+
+- (void)stop {
+    self.handler = nil;
+}
+
+- (void)simulate:(YYMemoryPressureLevel)level {
+    if (_handler) _handler(level);
+}
+
+@end
+
+
+/// A cache with `count` objects of cost 1, keyed by @(0) ..< @(count), the first `pinnedCount` are pinned.
+static YYMemoryCache *_YYCacheWithObjects(YYMemoryCacheEvictionPolicy policy, NSUInteger count, NSUInteger pinnedCount, YYFakeMemoryPressureSource *source) {
+    YYMemoryCache *cache = [YYMemoryCache new];
+    cache.evictionPolicy = policy;
+    cache.memoryPressureSource = source;
+    for (NSUInteger i = 0; i < count; i++) {
+        [cache setObject:@(i) forKey:@(i) withCost:1];
+    }
+    for (NSUInteger i = 0; i < pinnedCount; i++) {
+        YYAssert([cache pinObjectForKey:@(i)], @"pin %lu", (unsigned long)i);
+    }
+    return cache;
+}
+
+static BOOL _YYCacheContainsKeys(YYMemoryCache *cache, NSUInteger count) {
+    for (NSUInteger i = 0; i < count; i++) {
+        if (![cache containsObjectForKey:@(i)]) return NO;
+    }
+    return YES;
+}
+
+static void testPressureLevels(YYMemoryCacheEvictionPolicy policy) {
+    YYFakeMemoryPressureSource *source = [YYFakeMemoryPressureSource new];
+    YYMemoryCache *cache = _YYCacheWithObjects(policy, 100, 5, source);
+    YYAssert(source.handler, @"the cache doesn't start the source");
+    
+    [source simulate:YYMemoryPressureLevelNormal];
+    YYAssert(cache.totalCost == 100, @"normal: cost %lu", (unsigned long)cache.totalCost);
+    
+    [source simulate:YYMemoryPressureLevelWarning]; // 50%
+    YYAssert(cache.totalCost <= 50 && cache.totalCount <= 50, @"warning: cost %lu count %lu", (unsigned long)cache.totalCost, (unsigned long)cache.totalCount);
+    YYAssert(cache.totalCost >= 45, @"warning trims too much: cost %lu", (unsigned long)cache.totalCost);
+    YYAssert(_YYCacheContainsKeys(cache, 5), @"warning evicts pinned objects");
+    
+    NSUInteger cost = cache.totalCost;
+    [source simulate:YYMemoryPressureLevelUrgent]; // 25%
+    YYAssert(cache.totalCost <= cost / 4, @"urgent: cost %lu of %lu", (unsigned long)cache.totalCost, (unsigned long)cost);
+    YYAssert(_YYCacheContainsKeys(cache, 5), @"urgent evicts pinned objects");
+    
+    [source simulate:YYMemoryPressureLevelCritical]; // 0%
+    YYAssert(cache.totalCount == 5 && cache.totalCost == 5, @"critical: cost %lu count %lu", (unsigned long)cache.totalCost, (unsigned long)cache.totalCount);
+    YYAssert(_YYCacheContainsKeys(cache, 5), @"critical evicts pinned objects");
+    
+    [cache unpinObjectForKey:@(0)];
+    [source simulate:YYMemoryPressureLevelCritical];
+    YYAssert(![cache containsObjectForKey:@(0)], @"the unpinned object is kept");
+    YYAssert(cache.totalCount == 4, @"critical after unpin: count %lu", (unsigned long)cache.totalCount);
+}
+
+static void testPinnedOverTarget(void) {
+    YYFakeMemoryPressureSource *source = [YYFakeMemoryPressureSource new];
+    YYMemoryCache *cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyLRU, 100, 80, source);
+    [source simulate:YYMemoryPressureLevelWarning];
+    YYAssert(cache.totalCount == 80, @"warning: count %lu", (unsigned long)cache.totalCount);
+    YYAssert(_YYCacheContainsKeys(cache, 80), @"warning evicts pinned objects");
+    [source simulate:YYMemoryPressureLevelUrgent];
+    [source simulate:YYMemoryPressureLevelCritical];
+    YYAssert(cache.totalCount == 80, @"critical: count %lu", (unsigned long)cache.totalCount);
+}
+
+static void testPressureIgnored(void) {
+    YYFakeMemoryPressureSource *source = [YYFakeMemoryPressureSource new];
+    YYMemoryCache *cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyLRU, 100, 0, source);
+    cache.shouldTrimOnMemoryPressure = NO;
+    [source simulate:YYMemoryPressureLevelCritical];
+    YYAssert(cache.totalCount == 100, @"count %lu", (unsigned long)cache.totalCount);
+    
+    cache.memoryPressureSource = nil;
+    YYAssert(!source.handler, @"the cache doesn't stop the source");
+}
+
+static void testTrimToZeroKeepsPinned(void) {
+    YYMemoryCache *cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyLRU, 10, 2, nil);
+    [cache trimToCount:0];
+    YYAssert(cache.totalCount == 2 && _YYCacheContainsKeys(cache, 2), @"trimToCount: count %lu", (unsigned long)cache.totalCount);
+    
+    cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyLRU, 10, 2, nil);
+    [cache trimToCost:0];
+    YYAssert(cache.totalCount == 2 && _YYCacheContainsKeys(cache, 2), @"trimToCost: count %lu", (unsigned long)cache.totalCount);
+    
+    cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyLRU, 10, 2, nil);
+    [cache trimToAge:0];
+    YYAssert(cache.totalCount == 2 && _YYCacheContainsKeys(cache, 2), @"trimToAge: count %lu", (unsigned long)cache.totalCount);
+    
+    [cache removeAllObjects];
+    YYAssert(cache.totalCount == 0, @"removeAllObjects: count %lu", (unsigned long)cache.totalCount);
+}
+
+/**
+ With TinyLFU policy, the entries demoted from protected are older than the ones
+ in probation, they should be removed by age even if the probation tail is new.
+ */
+static void testTrimToAgeTinyLFU(void) {
+    NSUInteger count = 1000;
+    YYMemoryCache *cache = _YYCacheWithObjects(YYMemoryCacheEvictionPolicyTinyLFU, count, 0, nil);
+    for (NSUInteger i = 0; i < count; i++) {
+        [cache objectForKey:@(i)]; // promoted to protected
+    }
+    [NSThread sleepForTimeInterval:0.3];
+    
+    for (NSUInteger i = count; i < count * 2; i++) {
+        [cache setObject:@(i) forKey:@(i) withCost:1];
+    }
+    for (NSUInteger i = count; i < count + count * 9 / 10; i++) {
+        [cache objectForKey:@(i)]; // promoted, the old entries are demoted to probation head
+    }
+    [cache trimToAge:0.15];
+    for (NSUInteger i = 0; i < count; i++) {
+        YYAssert(![cache containsObjectForKey:@(i)], @"the old object %lu is kept", (unsigned long)i);
+    }
+    for (NSUInteger i = count; i < count * 2; i++) {
+        YYAssert([cache containsObjectForKey:@(i)], @"the new object %lu is removed", (unsigned long)i);
+    }
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        testPressureLevels(YYMemoryCacheEvictionPolicyLRU);
+        testPressureLevels(YYMemoryCacheEvictionPolicyTinyLFU);
+        testPinnedOverTarget();
+        testPressureIgnored();
+        testTrimToZeroKeepsPinned();
+        testTrimToAgeTinyLFU();
+        NSLog(@"YYMemoryCacheTests: %d failure(s)", _failureCount);
+    }
+    return _failureCount == 0 ? 0 : 1;
+}
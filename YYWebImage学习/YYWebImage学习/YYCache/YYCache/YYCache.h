@@ -48,6 +48,34 @@ NS_ASSUME_NONNULL_BEGIN
 /** The underlying disk cache. see `YYDiskCache` for more information.*/
 @property (strong, readonly) YYDiskCache *diskCache;
 
+/**
+ If `YES`, the writes (and removes) return after the memory cache is updated, and
+ the disk cache is updated later in batches. Default is NO.
+ 
+ @discussion The objects not written to disk yet (dirty objects) are kept until they're
+ written, so the reads of this cache still see them, and a later write to the same
+ key replaces the earlier one. They're written after `writeBackDelay`, when the app
+ enters background or will be terminated, or when `flush` is called. The changes
+ not written are lost if the app crashes. The blocks of the async writes are invoked
+ after the memory cache is updated. Disabling it writes the dirty objects.
+ */
+@property BOOL writeBackEnabled;
+
+/** The delay in seconds to write the dirty objects to disk. Default is 1.0. */
+@property NSTimeInterval writeBackDelay;
+
+/**
+ The maximum number of dirty objects. When it's exceeded, the write flushes all dirty 
+ objects on the calling thread, so the memory held by them is bounded. Default is 256.
+ */
+@property NSUInteger writeBackCountLimit;
+
+/**
+ Write the dirty objects to disk in one batch, it does nothing if there's none.
+ This method may blocks the calling thread until file write finished.
+ */
+- (void)flush;
+
 /**
  Create a new instance with the specified name.
  Multiple instances with the same name will make the cache unstable.
@@ -175,6 +203,72 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)removeObjectForKey:(NSString *)key withBlock:(nullable void(^)(NSString *key))block;
 
+/**
+ Returns the keys which are in cache. The keys missed in memory cache are checked
+ in disk cache with a single query.
+ This method may blocks the calling thread until file read finished.
+ 
+ @param keys An array of keys.
+ @return A set of the keys which are in cache.
+ */
+- (NSSet<NSString *> *)containsObjectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Returns the values associated with the given keys. The keys missed in memory
+ cache are read from disk cache with a single query, and then added to memory cache.
+ This method may blocks the calling thread until file read finished.
+ 
+ @param keys An array of keys.
+ @return A dictionary of the keys and values which are in cache.
+ */
+- (NSDictionary<NSString *, id<NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Returns the values associated with the given keys.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys  An array of keys.
+ @param block A block which will be invoked in background queue when finished.
+ */
+- (void)objectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSDictionary<NSString *, id<NSCoding>> *objects))block;
+
+/**
+ Sets the keys and values of the dictionary in the cache.
+ This method may blocks the calling thread until file write finished.
+ 
+ @param dictionary A dictionary of the keys and values to be stored in the cache.
+ */
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary;
+
+/**
+ Sets the keys and values of the dictionary in the cache.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param dictionary A dictionary of the keys and values to be stored in the cache.
+ @param block      A block which will be invoked in background queue when finished.
+ */
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary withBlock:(nullable void(^)(void))block;
+
+/**
+ Removes the values of the specified keys in the cache.
+ This method may blocks the calling thread until file delete finished.
+ 
+ @param keys An array of keys identifying the values to be removed.
+ */
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Removes the values of the specified keys in the cache.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys  An array of keys identifying the values to be removed.
+ @param block A block which will be invoked in background queue when finished.
+ */
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(nullable void(^)(NSArray<NSString *> *keys))block;
+
 /**
  Empties the cache.
  This method may blocks the calling thread until file delete finished.
@@ -12,8 +12,174 @@
 #import "YYCache.h"
 #import "YYMemoryCache.h"
 #import "YYDiskCache.h"
+#import <UIKit/UIKit.h>
+#import <pthread.h>
 
-@implementation YYCache
+static UIApplication *_YYSharedApplication() {
+    static BOOL isAppExtension = NO;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        Class cls = NSClassFromString(@"UIApplication");
+        if(!cls || ![cls respondsToSelector:@selector(sharedApplication)]) isAppExtension = YES;
+        if ([[[NSBundle mainBundle] bundlePath] hasSuffix:@".appex"]) isAppExtension = YES;
+    });
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wundeclared-selector"
+    return isAppExtension ? nil : [UIApplication performSelector:@selector(sharedApplication)];
+#pragma clang diagnostic pop
+}
+
+@implementation YYCache {
+    pthread_mutex_t _dirtyLock;         // guards the write-back states below
+    BOOL _writeBackEnabled;
+    NSTimeInterval _writeBackDelay;
+    NSUInteger _writeBackCountLimit;
+    NSMutableDictionary *_dirtyObjects; // key: NSString, value: object, or NSNull if removed
+    NSDictionary *_flushingObjects;     // the dirty objects being written to disk
+    BOOL _flushScheduled;
+    pthread_mutex_t _flushLock;         // only one flush at the same time
+}
+
+#pragma mark - write-back
+
+/**
+ Find the object which is not written to disk yet.
+ 
+ @return YES if the key is dirty, the object is nil if it's removed.
+ */
+- (BOOL)_getDirtyObject:(id *)object forKey:(NSString *)key {
+    if (!key) return NO;
+    pthread_mutex_lock(&_dirtyLock);
+    id value = _dirtyObjects[key] ?: _flushingObjects[key];
+    pthread_mutex_unlock(&_dirtyLock);
+    if (!value) return NO;
+    *object = value == (id)kCFNull ? nil : value;
+    return YES;
+}
+
+/**
+ Find the objects which are not written to disk yet, the found keys are removed
+ from `keys`.
+ 
+ @return A dictionary of the dirty keys and objects (NSNull if it's removed).
+ */
+- (NSDictionary *)_dirtyObjectsForKeys:(NSMutableArray *)keys {
+    NSMutableDictionary *found = nil;
+    pthread_mutex_lock(&_dirtyLock);
+    if (_dirtyObjects.count || _flushingObjects.count) {
+        found = [NSMutableDictionary new];
+        for (NSString *key in keys) {
+            id value = _dirtyObjects[key] ?: _flushingObjects[key];
+            if (value) found[key] = value;
+        }
+    }
+    pthread_mutex_unlock(&_dirtyLock);
+    if (found.count) [keys removeObjectsInArray:found.allKeys];
+    return found;
+}
+
+/**
+ Add the objects (NSNull for removed) to the dirty objects, and schedule a flush.
+ 
+ @return NO if write-back is disabled, the caller should write to disk.
+ */
+- (BOOL)_setDirtyObjects:(NSDictionary *)objects {
+    pthread_mutex_lock(&_dirtyLock);
+    if (!_writeBackEnabled) {
+        pthread_mutex_unlock(&_dirtyLock);
+        return NO;
+    }
+    [_dirtyObjects addEntriesFromDictionary:objects];
+    BOOL overLimit = _dirtyObjects.count > _writeBackCountLimit;
+    BOOL schedule = !_flushScheduled;
+    _flushScheduled = YES;
+    NSTimeInterval delay = _writeBackDelay;
+    pthread_mutex_unlock(&_dirtyLock);
+    
+    if (overLimit) {
+        [self flush];
+    } else if (schedule) {
+        __weak typeof(self) _self = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+            [_self flush];
+        });
+    }
+    return YES;
+}
+
+/// Drop the dirty objects, wait for the flush in progress.
+- (void)_discardDirtyObjects {
+    pthread_mutex_lock(&_flushLock);
+    pthread_mutex_lock(&_dirtyLock);
+    [_dirtyObjects removeAllObjects];
+    pthread_mutex_unlock(&_dirtyLock);
+    pthread_mutex_unlock(&_flushLock);
+}
+
+- (void)_appDidEnterBackground {
+    UIApplication *app = _YYSharedApplication();
+    __block UIBackgroundTaskIdentifier taskID = UIBackgroundTaskInvalid;
+    void (^endTask)(void) = ^{ // on main thread
+        if (taskID == UIBackgroundTaskInvalid) return;
+        [app endBackgroundTask:taskID];
+        taskID = UIBackgroundTaskInvalid;
+    };
+    taskID = [app beginBackgroundTaskWithExpirationHandler:endTask];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+        [self flush];
+        dispatch_async(dispatch_get_main_queue(), endTask);
+    });
+}
+
+- (void)_appWillBeTerminated {
+    [self flush];
+}
+
+- (void)flush {
+    pthread_mutex_lock(&_flushLock);
+    [self _flushDirtyObjects];
+    pthread_mutex_unlock(&_flushLock);
+}
+
+/// Write the dirty objects to disk, the caller should hold `_flushLock`.
+- (void)_flushDirtyObjects {
+    pthread_mutex_lock(&_dirtyLock);
+    NSDictionary *batch = nil;
+    if (_dirtyObjects.count) {
+        batch = _dirtyObjects;
+        _dirtyObjects = [NSMutableDictionary new];
+        _flushingObjects = batch;
+    }
+    _flushScheduled = NO;
+    pthread_mutex_unlock(&_dirtyLock);
+    
+    if (batch) {
+        NSMutableDictionary *objects = [NSMutableDictionary new];
+        NSMutableArray *removedKeys = [NSMutableArray new];
+        [batch enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+            if (object == (id)kCFNull) {
+                [removedKeys addObject:key];
+            } else {
+                objects[key] = object;
+            }
+        }];
+        if (removedKeys.count) [_diskCache removeObjectsForKeys:removedKeys];
+        if (objects.count) [_diskCache setObjectsWithDictionary:objects];
+    
+        pthread_mutex_lock(&_dirtyLock);
+        _flushingObjects = nil;
+        pthread_mutex_unlock(&_dirtyLock);
+    }
+}
+
+#pragma mark - public
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self flush];
+    pthread_mutex_destroy(&_dirtyLock);
+    pthread_mutex_destroy(&_flushLock);
+}
 
 - (instancetype) init {
     NSLog(@"Use \"initWithName\" or \"initWithPath\" to create YYCache instance.");
@@ -39,6 +205,14 @@
     _name = name;
     _diskCache = diskCache;
     _memoryCache = memoryCache;
+    pthread_mutex_init(&_dirtyLock, NULL);
+    pthread_mutex_init(&_flushLock, NULL);
+    _dirtyObjects = [NSMutableDictionary new];
+    _writeBackDelay = 1.0;
+    _writeBackCountLimit = 256;
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appDidEnterBackground) name:UIApplicationDidEnterBackgroundNotification object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appWillBeTerminated) name:UIApplicationWillTerminateNotification object:nil];
     return self;
 }
 
@@ -51,16 +225,25 @@
 }
 
 - (BOOL)containsObjectForKey:(NSString *)key {
-    return [_memoryCache containsObjectForKey:key] || [_diskCache containsObjectForKey:key];
+    if ([_memoryCache containsObjectForKey:key]) return YES;
+    id object = nil;
+    if ([self _getDirtyObject:&object forKey:key]) return object != nil;
+    return [_diskCache containsObjectForKey:key];
 }
 
 - (void)containsObjectForKey:(NSString *)key withBlock:(void (^)(NSString *key, BOOL contains))block {
     if (!block) return;
     
+    id object = nil;
     if ([_memoryCache containsObjectForKey:key]) {
         dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
             block(key, YES);
         });
+    } else if ([self _getDirtyObject:&object forKey:key]) {
+        BOOL contains = object != nil;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            block(key, contains);
+        });
     } else  {
         [_diskCache containsObjectForKey:key withBlock:block];
     }
@@ -69,6 +252,11 @@
 - (id<NSCoding>)objectForKey:(NSString *)key {
     id<NSCoding> object = [_memoryCache objectForKey:key];
     if (!object) {
+        id dirtyObject = nil;
+        if ([self _getDirtyObject:&dirtyObject forKey:key]) {
+            if (dirtyObject) [_memoryCache setObject:dirtyObject forKey:key];
+            return dirtyObject;
+        }
         object = [_diskCache objectForKey:key];
         if (object) {
             [_memoryCache setObject:object forKey:key];
@@ -80,7 +268,9 @@
 - (void)objectForKey:(NSString *)key withBlock:(void (^)(NSString *key, id<NSCoding> object))block {
     if (!block) return;
     id<NSCoding> object = [_memoryCache objectForKey:key];
-    if (object) {
+    id dirtyObject = nil;
+    if (object || [self _getDirtyObject:&dirtyObject forKey:key]) {
+        if (!object) object = dirtyObject;
         dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
             block(key, object);
         });
@@ -91,39 +281,210 @@
 
 - (void)setObject:(id<NSCoding>)object forKey:(NSString *)key {
     [_memoryCache setObject:object forKey:key];
+    if (key && [self _setDirtyObjects:@{key : object ?: (id)kCFNull}]) return;
     [_diskCache setObject:object forKey:key];
 }
 
 - (void)setObject:(id<NSCoding>)object forKey:(NSString *)key withBlock:(void (^)(void))block {
     [_memoryCache setObject:object forKey:key];
+    if (key && [self _setDirtyObjects:@{key : object ?: (id)kCFNull}]) {
+        if (block) dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+        return;
+    }
     [_diskCache setObject:object forKey:key withBlock:block];
 }
 
 - (void)removeObjectForKey:(NSString *)key {
     [_memoryCache removeObjectForKey:key];
+    if (key && [self _setDirtyObjects:@{key : (id)kCFNull}]) return;
     [_diskCache removeObjectForKey:key];
 }
 
 - (void)removeObjectForKey:(NSString *)key withBlock:(void (^)(NSString *key))block {
     [_memoryCache removeObjectForKey:key];
+    if (key && [self _setDirtyObjects:@{key : (id)kCFNull}]) {
+        if (block) dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ block(key); });
+        return;
+    }
     [_diskCache removeObjectForKey:key withBlock:block];
 }
 
+- (NSSet<NSString *> *)containsObjectsForKeys:(NSArray<NSString *> *)keys {
+    NSMutableSet *contained = [[_memoryCache containsObjectsForKeys:keys] mutableCopy];
+    if (contained.count == keys.count) return contained;
+    NSMutableArray *missed = [NSMutableArray new];
+    for (NSString *key in keys) {
+        if (![contained containsObject:key]) [missed addObject:key];
+    }
+    [[self _dirtyObjectsForKeys:missed] enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+        if (object != (id)kCFNull) [contained addObject:key];
+    }];
+    if (missed.count) [contained unionSet:[_diskCache containsObjectsForKeys:missed]];
+    return contained;
+}
+
+- (NSDictionary<NSString *, id<NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys {
+    NSMutableDictionary *objects = [[_memoryCache objectsForKeys:keys] mutableCopy];
+    if (objects.count == keys.count) return objects;
+    NSMutableArray *missed = [NSMutableArray new];
+    for (NSString *key in keys) {
+        if (!objects[key]) [missed addObject:key];
+    }
+    [[self _dirtyObjectsForKeys:missed] enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+        if (object != (id)kCFNull) objects[key] = object;
+    }];
+    NSDictionary *diskObjects = missed.count ? [_diskCache objectsForKeys:missed] : nil;
+    if (diskObjects.count) {
+        [_memoryCache setObjectsWithDictionary:diskObjects];
+        [objects addEntriesFromDictionary:diskObjects];
+    }
+    return objects;
+}
+
+- (void)objectsForKeys:(NSArray<NSString *> *)keys withBlock:(void (^)(NSDictionary<NSString *, id<NSCoding>> *objects))block {
+    if (!block) return;
+    NSMutableDictionary *memoryObjects = [[_memoryCache objectsForKeys:keys] mutableCopy];
+    NSMutableArray *missed = [NSMutableArray new];
+    for (NSString *key in keys) {
+        if (!memoryObjects[key]) [missed addObject:key];
+    }
+    [[self _dirtyObjectsForKeys:missed] enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+        if (object != (id)kCFNull) memoryObjects[key] = object;
+    }];
+    if (missed.count == 0) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            block(memoryObjects);
+        });
+        return;
+    }
+    YYMemoryCache *memoryCache = _memoryCache;
+    [_diskCache objectsForKeys:missed withBlock:^(NSDictionary<NSString *, id<NSCoding>> *diskObjects) {
+        if (diskObjects.count == 0) {
+            block(memoryObjects);
+            return;
+        }
+        [memoryCache setObjectsWithDictionary:diskObjects];
+        NSMutableDictionary *objects = [memoryObjects mutableCopy];
+        [objects addEntriesFromDictionary:diskObjects];
+        block(objects);
+    }];
+}
+
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary {
+    [_memoryCache setObjectsWithDictionary:dictionary];
+    if (dictionary.count && [self _setDirtyObjects:dictionary]) return;
+    [_diskCache setObjectsWithDictionary:dictionary];
+}
+
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary withBlock:(void (^)(void))block {
+    [_memoryCache setObjectsWithDictionary:dictionary];
+    if (dictionary.count && [self _setDirtyObjects:dictionary]) {
+        if (block) dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+        return;
+    }
+    [_diskCache setObjectsWithDictionary:dictionary withBlock:block];
+}
+
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys {
+    [_memoryCache removeObjectsForKeys:keys];
+    if (keys.count && [self _setDirtyObjects:[NSDictionary dictionaryWithObjects:[self _nullsWithCount:keys.count] forKeys:keys]]) return;
+    [_diskCache removeObjectsForKeys:keys];
+}
+
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(void (^)(NSArray<NSString *> *keys))block {
+    [_memoryCache removeObjectsForKeys:keys];
+    if (keys.count && [self _setDirtyObjects:[NSDictionary dictionaryWithObjects:[self _nullsWithCount:keys.count] forKeys:keys]]) {
+        if (block) dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ block(keys); });
+        return;
+    }
+    [_diskCache removeObjectsForKeys:keys withBlock:block];
+}
+
+- (NSArray *)_nullsWithCount:(NSUInteger)count {
+    NSMutableArray *nulls = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [nulls addObject:(id)kCFNull];
+    }
+    return nulls;
+}
+
 - (void)removeAllObjects {
     [_memoryCache removeAllObjects];
+    pthread_mutex_lock(&_flushLock);
+    pthread_mutex_lock(&_dirtyLock);
+    [_dirtyObjects removeAllObjects];
+    pthread_mutex_unlock(&_dirtyLock);
     [_diskCache removeAllObjects];
+    pthread_mutex_unlock(&_flushLock);
 }
 
 - (void)removeAllObjectsWithBlock:(void(^)(void))block {
     [_memoryCache removeAllObjects];
+    [self _discardDirtyObjects];
     [_diskCache removeAllObjectsWithBlock:block];
 }
 
 - (void)removeAllObjectsWithProgressBlock:(void(^)(int removedCount, int totalCount))progress
                                  endBlock:(void(^)(BOOL error))end {
     [_memoryCache removeAllObjects];
+    [self _discardDirtyObjects];
     [_diskCache removeAllObjectsWithProgressBlock:progress endBlock:end];
+
+}
+
+- (BOOL)writeBackEnabled {
+    pthread_mutex_lock(&_dirtyLock);
+    BOOL enabled = _writeBackEnabled;
+    pthread_mutex_unlock(&_dirtyLock);
+    return enabled;
+}
+
+- (void)setWriteBackEnabled:(BOOL)writeBackEnabled {
+    if (writeBackEnabled) {
+        pthread_mutex_lock(&_dirtyLock);
+        _writeBackEnabled = YES;
+        pthread_mutex_unlock(&_dirtyLock);
+        return;
+    }
     
+    // Keep write-back until all the dirty objects are on disk, otherwise a write-through
+    // may reach disk first and then be overwritten by an older dirty object.
+    pthread_mutex_lock(&_flushLock);
+    for (;;) {
+        pthread_mutex_lock(&_dirtyLock);
+        BOOL clean = _dirtyObjects.count == 0;
+        if (clean) _writeBackEnabled = NO;
+        pthread_mutex_unlock(&_dirtyLock);
+        if (clean) break;
+        [self _flushDirtyObjects];
+    }
+    pthread_mutex_unlock(&_flushLock);
+}
+
+- (NSTimeInterval)writeBackDelay {
+    pthread_mutex_lock(&_dirtyLock);
+    NSTimeInterval delay = _writeBackDelay;
+    pthread_mutex_unlock(&_dirtyLock);
+    return delay;
+}
+
+- (void)setWriteBackDelay:(NSTimeInterval)writeBackDelay {
+    pthread_mutex_lock(&_dirtyLock);
+    _writeBackDelay = MAX(writeBackDelay, 0);
+    pthread_mutex_unlock(&_dirtyLock);
+}
+
+- (NSUInteger)writeBackCountLimit {
+    pthread_mutex_lock(&_dirtyLock);
+    NSUInteger limit = _writeBackCountLimit;
+    pthread_mutex_unlock(&_dirtyLock);
+    return limit;
+}
+
+- (void)setWriteBackCountLimit:(NSUInteger)writeBackCountLimit {
+    pthread_mutex_lock(&_dirtyLock);
+    _writeBackCountLimit = writeBackCountLimit;
+    pthread_mutex_unlock(&_dirtyLock);
 }
 
 - (NSString *)description {
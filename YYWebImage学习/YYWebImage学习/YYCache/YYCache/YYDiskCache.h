@@ -13,6 +13,119 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ The codec to compress the data of objects on disk.
+ */
+typedef NS_ENUM(NSUInteger, YYDiskCacheCodec) {
+    YYDiskCacheCodecNone  = 0, ///< Not compressed.
+    YYDiskCacheCodecLZ4   = 1, ///< LZ4, the fastest, lower compression ratio.
+    YYDiskCacheCodecLZFSE = 2, ///< LZFSE, fast, compression ratio similar to zlib.
+    YYDiskCacheCodecLZMA  = 3, ///< LZMA, slow, the highest compression ratio.
+};
+
+/**
+ The priority of an asynchronous operation of YYDiskCache. The pending operations
+ with higher priority run first, and each one runs in the global queue of the same
+ priority (DISPATCH_QUEUE_PRIORITY_LOW, DEFAULT or HIGH).
+ */
+typedef NS_ENUM(NSInteger, YYDiskCachePriority) {
+    YYDiskCachePriorityLow    = 0, ///< For prefetching and maintenance, such as trimming.
+    YYDiskCachePriorityNormal = 1, ///< The default priority.
+    YYDiskCachePriorityHigh   = 2, ///< For the objects needed on screen now.
+};
+
+/**
+ The cancellation token of an asynchronous operation of YYDiskCache.
+ */
+@interface YYDiskCacheTask : NSObject
+@property (readonly) YYDiskCachePriority priority;          ///< The priority of the operation.
+@property (readonly, getter=isCancelled) BOOL cancelled;  ///< Whether `cancel` is called.
+
+/**
+ Cancel the operation. If it has not started, it will not run and its block will
+ not be invoked. If it's running, it runs to the end.
+ */
+- (void)cancel;
+@end
+
+/**
+ The measured latency of a size class, used by the adaptive inline threshold of YYDiskCache.
+ The latencies are moving averages in seconds, 0 if there's no sample yet.
+ */
+@interface YYDiskCacheLatencyStats : NSObject
+@property (nonatomic, readonly) NSUInteger minSize;            ///< Min data size (in bytes) of this class.
+@property (nonatomic, readonly) NSUInteger maxSize;            ///< Max data size (in bytes) of this class, NSUIntegerMax for the last class.
+@property (nonatomic, readonly) NSTimeInterval inlineReadLatency;  ///< Read latency of the objects stored in sqlite.
+@property (nonatomic, readonly) NSTimeInterval fileReadLatency;    ///< Read latency of the objects stored in file.
+@property (nonatomic, readonly) NSUInteger inlineReadCount;    ///< Number of reads from sqlite measured.
+@property (nonatomic, readonly) NSUInteger fileReadCount;      ///< Number of reads from file measured.
+@property (nonatomic, readonly) NSTimeInterval inlineWriteLatency; ///< Write latency of the objects stored in sqlite.
+@property (nonatomic, readonly) NSTimeInterval fileWriteLatency;   ///< Write latency of the objects stored in file.
+@property (nonatomic, readonly) NSUInteger inlineWriteCount;   ///< Number of writes to sqlite measured.
+@property (nonatomic, readonly) NSUInteger fileWriteCount;     ///< Number of writes to file measured.
+@end
+
+@class YYDiskCacheBinaryWriter, YYDiskCacheBinaryReader;
+
+/**
+ The objects conform to this protocol are archived by YYDiskCache in a compact binary
+ format instead of NSKeyedArchiver, which is much faster and smaller for small model
+ objects.
+ 
+ @discussion The properties are written and read in a fixed order without keys. When
+ the properties are changed, increase `binaryCodingVersion`, and read the old data
+ by the version passed to `initWithBinaryReader:version:`. The properties appended at
+ the end are skipped by an old version of the class.
+ */
+@protocol YYDiskCacheBinaryCoding <NSObject>
+@required
+/// Write the properties in a fixed order.
+- (void)encodeWithBinaryWriter:(YYDiskCacheBinaryWriter *)writer;
+
+/// Read the properties in the order they're written by the `version` of this class.
+- (nullable instancetype)initWithBinaryReader:(YYDiskCacheBinaryReader *)reader version:(uint32_t)version;
+
+@optional
+/// The version of the encoded properties, default is 0.
++ (uint32_t)binaryCodingVersion;
+@end
+
+/**
+ Writes the properties of a `YYDiskCacheBinaryCoding` object.
+ */
+@interface YYDiskCacheBinaryWriter : NSObject
+- (void)writeBool:(BOOL)value;
+- (void)writeInteger:(int64_t)value; ///< Variable length, small values take fewer bytes.
+- (void)writeDouble:(double)value;
+- (void)writeString:(nullable NSString *)value;
+- (void)writeData:(nullable NSData *)value;
+
+/**
+ Write an object of any supported type: NSString, NSNumber, NSData, NSDate, NSNull,
+ NSArray, NSDictionary, the objects conform to `YYDiskCacheBinaryCoding`, and the
+ other objects conform to `NSCoding` (archived by NSKeyedArchiver).
+ */
+- (void)writeObject:(nullable id)value;
+@end
+
+/**
+ Reads the properties of a `YYDiskCacheBinaryCoding` object, in the order they're written.
+ */
+@interface YYDiskCacheBinaryReader : NSObject
+
+/// `YES` if the data is truncated or broken. The values read after that are 0 or nil,
+/// and the object is discarded.
+@property (nonatomic, readonly) BOOL failed;
+
+- (BOOL)readBool;
+- (int64_t)readInteger;
+- (double)readDouble;
+- (nullable NSString *)readString;
+- (nullable NSData *)readData;
+- (nullable id)readObject;
+@end
+
+
 /**
  YYDiskCache is a thread-safe cache that stores key-value pairs backed by SQLite
  and file system (similar to NSURLCache's disk cache).
@@ -52,11 +165,33 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (readonly) NSUInteger inlineThreshold;
 
+/**
+ If `YES`, the cache measures the read latency of the objects stored in sqlite and
+ in file for each size class, and moves the `inlineThreshold` (between 2KB and 1MB)
+ to where the reads are fastest on this device. Default is NO.
+ 
+ @discussion A few writes are stored on the other side of the threshold so both
+ sides are measured. When an object that is far from the threshold is read from the 
+ wrong side, it's moved to the right side. The threshold is updated during the 
+ automatic trim and is not saved, so it restarts from the initial value on next launch.
+ 
+ It has no effect if the cache is created with inlineThreshold 0 or NSUIntegerMax.
+ */
+@property BOOL adaptiveInlineThresholdEnabled;
+
+/**
+ The latency measured for the adaptive inline threshold, ordered by size class.
+ */
+@property (readonly) NSArray<YYDiskCacheLatencyStats *> *latencyStats;
+
 /**
  If this block is not nil, then the block will be used to archive object instead
  of NSKeyedArchiver. You can use this block to support the objects which do not
  conform to the `NSCoding` protocol.
  
+ If it's nil, the objects conform to `YYDiskCacheBinaryCoding` are archived in the
+ binary format, and the others are archived by NSKeyedArchiver.
+ 
  The default value is nil.
  */
 @property (nullable, copy) NSData *(^customArchiveBlock)(id object);
@@ -72,13 +207,39 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  When an object needs to be saved as a file, this block will be invoked to generate
- a file name for a specified key. If the block is nil, the cache use md5(key) as 
- default file name.
+ a file name for a specified key. If the block is nil, the cache use a 128-bit hash
+ (MurmurHash3) of the key as default file name.
  
  The default value is nil.
  */
 @property (nullable, copy) NSString *(^customFileNameBlock)(NSString *key);
 
+/**
+ The codec to compress the data of objects before they're written to disk.
+ The codec is recorded with each object, so the data is decompressed transparently
+ when read, even if this value is changed later. The data is stored uncompressed 
+ if it can't be compressed to 7/8 of its size.
+ 
+ The default value is YYDiskCacheCodecNone.
+ */
+@property YYDiskCacheCodec codec;
+
+/**
+ The objects whose data size (in bytes) is smaller than this value are not compressed.
+ 
+ The default value is 1024 (1KB).
+ */
+@property NSUInteger compressionThreshold;
+
+/**
+ If this block is not nil, it will be invoked to choose the codec of each object 
+ (whose data size is not smaller than `compressionThreshold`) instead of `codec`,
+ for example, by the class of the object or the size of data.
+ 
+ The default value is nil.
+ */
+@property (nullable, copy) YYDiskCacheCodec (^codecBlock)(id object, NSData *data);
+
 
 
 #pragma mark - Limit
@@ -136,6 +297,94 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property BOOL errorLogsEnabled;
 
+/**
+ If `YES`, reading objects doesn't write their access time to sqlite immediately,
+ the access times are written in one transaction a few seconds later. Default is NO.
+ 
+ @discussion You may enable it for read-heavy caches to avoid the sqlite write on
+ each read. The access times which are not written are lost if the app crashes, so
+ the LRU order may be slightly out of date.
+ */
+@property BOOL deferredAccessTimeEnabled;
+
+/**
+ If `YES`, the objects stored as files are read with memory mapping instead of being
+ copied into memory. Default is NO.
+ 
+ @discussion It is useful when the unarchived object keeps the data, for example,
+ a cache of raw image data, the mapped data is loaded on demand and shares memory 
+ with the system page cache. The data is always copied for small objects and the 
+ objects stored in sqlite.
+ */
+@property BOOL mappedReadEnabled;
+
+/**
+ If `YES`, the objects stored as files are named by the SHA-256 of their data, so 
+ the objects with the same data share one file, which is deleted when the last of
+ them is removed. Default is NO.
+ 
+ @discussion It is useful when the same data is cached for many keys, for example,
+ an image served under many URLs. The `customFileNameBlock` is ignored in this mode.
+ It has no effect if the cache uses segment files or stores all objects in sqlite.
+ Once it's enabled, it's kept for the path and can't be disabled.
+ */
+@property BOOL contentDedupEnabled;
+
+/**
+ The maximum number of asynchronous operations (the methods with block) running at
+ the same time. The others wait in the cache by priority, instead of taking threads
+ which are blocked by the cache lock. Default is 4.
+ */
+@property NSUInteger maxConcurrentOperationCount;
+
+/**
+ If `YES`, the pending asynchronous operations of the same priority run in last-in, 
+ first-out order, so the objects requested most recently (for example, the cells
+ just scrolled into a feed) are read first. Default is NO.
+ 
+ @discussion The order of the asynchronous operations is not guaranteed in either
+ mode, so you should not rely on it for the writes of the same key.
+ */
+@property BOOL lastInFirstOutEnabled;
+
+/**
+ The files of removed objects are deleted by a background queue at a limited rate,
+ so trimming the cache doesn't cause I/O latency spikes for the reads.
+ 
+ The maximum number of files deleted per second, 0 means no limit. Default is 256.
+ */
+@property int deletionFilesPerSecond;
+
+/// The maximum bytes of files deleted per second, 0 means no limit. Default is 32MB.
+@property int deletionBytesPerSecond;
+
+/// The number of files waiting to be deleted in background.
+@property (readonly) int64_t deletionBacklogCount;
+
+/// The total size in bytes of files waiting to be deleted in background.
+@property (readonly) int64_t deletionBacklogSize;
+
+/**
+ Whether the storage is opened. It's NO before the cache created with `openAsynchronously`
+ finishes opening, or if it fails to open.
+ */
+@property (readonly, getter=isOpened) BOOL opened;
+
+/**
+ The time (in seconds) it takes to open the storage, including the recovery of a
+ broken manifest. It's 0 before the storage is opened.
+ */
+@property (readonly) NSTimeInterval openDuration;
+
+/**
+ Invoke the block in background queue when the storage is opened (immediately if
+ it's already opened).
+ 
+ @param block  A block with whether the storage is opened successfully, and the
+     time (in seconds) it takes to open.
+ */
+- (void)waitUntilOpenedWithBlock:(void(^)(BOOL succeed, NSTimeInterval duration))block;
+
 #pragma mark - Initializer
 ///=============================================================================
 /// @name Initializer
@@ -157,7 +406,7 @@ NS_ASSUME_NONNULL_BEGIN
 - (nullable instancetype)initWithPath:(NSString *)path;
 
 /**
- The designated initializer.
+ Create a new cache based on the specified path.
  
  @param path       Full path of a directory in which the cache will write data.
      Once initialized you should not read and write to this directory.
@@ -175,7 +424,55 @@ NS_ASSUME_NONNULL_BEGIN
      this method will return it directly, instead of creating a new instance.
  */
 - (nullable instancetype)initWithPath:(NSString *)path
-                      inlineThreshold:(NSUInteger)threshold NS_DESIGNATED_INITIALIZER;
+                      inlineThreshold:(NSUInteger)threshold;
+
+/**
+ Create a new cache based on the specified path, the storage is opened synchronously.
+ 
+ @param path       Full path of a directory in which the cache will write data.
+     Once initialized you should not read and write to this directory.
+ 
+ @param threshold  The data store inline threshold in bytes. See `initWithPath:inlineThreshold:`.
+ 
+ @param useSegmentFiles  If YES, the objects larger than threshold will be appended
+     to a few large segment files instead of being stored as separated files. This
+     saves file system overhead when there are a very large number of objects. The 
+     space of removed objects is reclaimed during the automatic trim. It is ignored
+     if threshold is 0 or NSUIntegerMax.
+     After first initialized you should not change this value of the specified path.
+ 
+ @return A new cache object, or nil if an error occurs.
+ 
+ @warning If the cache instance for the specified path already exists in memory,
+     this method will return it directly, instead of creating a new instance.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path
+                      inlineThreshold:(NSUInteger)threshold
+                      useSegmentFiles:(BOOL)useSegmentFiles;
+
+/**
+ The designated initializer.
+ 
+ @param path             Full path of a directory in which the cache will write data.
+     Once initialized you should not read and write to this directory.
+ @param threshold        The data store inline threshold in bytes. See `initWithPath:inlineThreshold:`.
+ @param useSegmentFiles  Whether to use segment files. See `initWithPath:inlineThreshold:useSegmentFiles:`.
+ @param openAsynchronously  If YES, the directory and sqlite manifest are opened (and
+     recovered if broken) in background, this method returns without waiting for disk.
+     The access methods called before it's opened wait until it's opened. Use
+     `waitUntilOpenedWithBlock:` to get the result and the time it takes.
+ 
+ @return A new cache object, or nil if an error occurs. If `openAsynchronously` is YES,
+     the cache is returned even if it fails to open later, all its methods do nothing then,
+     and it's no longer returned by the next call of this method for the same path.
+ 
+ @warning If the cache instance for the specified path already exists in memory,
+     this method will return it directly, instead of creating a new instance.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path
+                      inlineThreshold:(NSUInteger)threshold
+                      useSegmentFiles:(BOOL)useSegmentFiles
+                   openAsynchronously:(BOOL)openAsynchronously NS_DESIGNATED_INITIALIZER;
 
 
 #pragma mark - Access Methods
@@ -206,6 +503,12 @@ NS_ASSUME_NONNULL_BEGIN
  Returns the value associated with a given key.
  This method may blocks the calling thread until file read finished.
  
+ @discussion The read doesn't wait for the writes of other keys: it uses a read-only
+ sqlite connection, and the files are written before the cache is locked. The access
+ time of the object is written a few seconds later. If there're asynchronous writes
+ not committed yet, or `adaptiveInlineThresholdEnabled` is YES, the read takes the
+ cache lock instead.
+ 
  @param key A string identifying the value. If nil, just return nil.
  @return The value associated with key, or nil if no value is associated with key.
  */
@@ -221,6 +524,20 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)objectForKey:(NSString *)key withBlock:(void(^)(NSString *key, id<NSCoding> _Nullable object))block;
 
+/**
+ Returns the value associated with a given key.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param key      A string identifying the value. If nil, just return nil.
+ @param priority The priority of the operation.
+ @param block    A block which will be invoked in background queue when finished.
+ @return A token to cancel the operation, or nil if the block is nil.
+ */
+- (nullable YYDiskCacheTask *)objectForKey:(NSString *)key
+                                  priority:(YYDiskCachePriority)priority
+                                 withBlock:(void(^)(NSString *key, id<NSCoding> _Nullable object))block;
+
 /**
  Sets the value of the specified key in the cache.
  This method may blocks the calling thread until file write finished.
@@ -235,6 +552,10 @@ NS_ASSUME_NONNULL_BEGIN
  This method returns immediately and invoke the passed block in background queue
  when the operation finished.
  
+ @discussion The asynchronous writes and removes are grouped and committed in one
+ sqlite transaction, within a short delay (about 20ms). The other methods of this
+ cache always see these pending writes.
+ 
  @param object The object to be stored in the cache. If nil, it calls `removeObjectForKey:`.
  @param block  A block which will be invoked in background queue when finished.
  */
@@ -258,6 +579,94 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)removeObjectForKey:(NSString *)key withBlock:(void(^)(NSString *key))block;
 
+/**
+ Returns the keys which are in cache, with a single sqlite query.
+ This method may blocks the calling thread until file read finished.
+ 
+ @param keys An array of keys.
+ @return A set of the keys which are in cache.
+ */
+- (NSSet<NSString *> *)containsObjectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Returns the keys which are in cache, with a single sqlite query.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys  An array of keys.
+ @param block A block which will be invoked in background queue when finished.
+ */
+- (void)containsObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSSet<NSString *> *keys))block;
+
+/**
+ Returns the values associated with the given keys, with a single sqlite query.
+ This method may blocks the calling thread until file read finished.
+ 
+ @param keys An array of keys.
+ @return A dictionary of the keys and values which are in cache.
+ */
+- (NSDictionary<NSString *, id<NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Returns the values associated with the given keys, with a single sqlite query.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys  An array of keys.
+ @param block A block which will be invoked in background queue when finished.
+ */
+- (void)objectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSDictionary<NSString *, id<NSCoding>> *objects))block;
+
+/**
+ Returns the values associated with the given keys, with a single sqlite query.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys     An array of keys.
+ @param priority The priority of the operation.
+ @param block    A block which will be invoked in background queue when finished.
+ @return A token to cancel the operation, or nil if the block is nil.
+ */
+- (nullable YYDiskCacheTask *)objectsForKeys:(NSArray<NSString *> *)keys
+                                    priority:(YYDiskCachePriority)priority
+                                   withBlock:(void(^)(NSDictionary<NSString *, id<NSCoding>> *objects))block;
+
+/**
+ Sets the keys and values of the dictionary in the cache, the lock is taken only once.
+ This method may blocks the calling thread until file write finished.
+ 
+ @param dictionary A dictionary of the keys and values to be stored in the cache.
+ */
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary;
+
+/**
+ Sets the keys and values of the dictionary in the cache, the lock is taken only once.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param dictionary A dictionary of the keys and values to be stored in the cache.
+ @param block      A block which will be invoked in background queue when finished.
+ */
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary withBlock:(nullable void(^)(void))block;
+
+/**
+ Removes the values of the specified keys in the cache, with a single sqlite query.
+ This method may blocks the calling thread until file delete finished.
+ 
+ @param keys An array of keys identifying the values to be removed.
+ */
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Removes the values of the specified keys in the cache, with a single sqlite query.
+ This method returns immediately and invoke the passed block in background queue
+ when the operation finished.
+ 
+ @param keys  An array of keys identifying the values to be removed.
+ @param block A block which will be invoked in background queue when finished.
+ */
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(nullable void(^)(NSArray<NSString *> *keys))block;
+
 /**
  Empties the cache.
  This method may blocks the calling thread until file delete finished.
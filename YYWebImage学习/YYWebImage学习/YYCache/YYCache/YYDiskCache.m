@@ -15,12 +15,130 @@
 #import <CommonCrypto/CommonCrypto.h>
 #import <objc/runtime.h>
 #import <time.h>
+#import <libkern/OSAtomic.h>
+#import <QuartzCore/QuartzCore.h>
+#import <pthread.h>
+#import <compression.h>
 
 #define Lock() dispatch_semaphore_wait(self->_lock, DISPATCH_TIME_FOREVER)
 #define Unlock() dispatch_semaphore_signal(self->_lock)
 
 static const int extended_data_key;
 
+/// Delay (in seconds) to write the deferred access times.
+static const NSTimeInterval kAccessTimeFlushDelay = 5;
+
+/// Max delay (in seconds) of the asynchronous writes.
+static const NSTimeInterval kWriteBehindDelay = 0.02;
+
+/// The asynchronous writes are committed immediately if there're too many of them.
+static const NSUInteger kWriteBehindMaxCount = 64;
+
+/// Number of the striped locks which serialize the reads and writes of the same key.
+#define kKeyLockCount 16
+
+/// Number of size classes of the adaptive inline threshold: <2KB, 2KB~4KB, ... >=1MB.
+#define kSizeClassCount 11
+
+/// Min size (in bytes) of the size class at index 1.
+static const NSUInteger kSizeClassBase = 1024;
+
+/// Weight of a new sample in the moving average latency.
+static const double kLatencySampleWeight = 0.1;
+
+/// A size class is compared only after both sides have this many read samples.
+static const NSUInteger kLatencyMinSampleCount = 8;
+
+/// One of this many writes is stored on the other side of the inline threshold.
+static const int32_t kLatencyProbeInterval = 32;
+
+/// The header of the data archived in binary format: "YYB" and the format version.
+static const uint8_t kBinaryArchiveHeader[4] = {'Y', 'Y', 'B', 1};
+
+/// Max nesting depth of the objects in binary archive.
+static const int kBinaryArchiveMaxDepth = 64;
+
+/// The type tags of the objects in binary archive.
+enum {
+    _YYBinaryTagNil = 0,
+    _YYBinaryTagNull,
+    _YYBinaryTagTrue,
+    _YYBinaryTagFalse,
+    _YYBinaryTagInteger,
+    _YYBinaryTagDouble,
+    _YYBinaryTagString,
+    _YYBinaryTagData,
+    _YYBinaryTagDate,
+    _YYBinaryTagArray,
+    _YYBinaryTagDictionary,
+    _YYBinaryTagCoding,  // YYDiskCacheBinaryCoding object: class, version, length, properties
+    _YYBinaryTagKeyed,   // NSCoding object archived by NSKeyedArchiver
+};
+
+/// Measured latency of one size class, index 0 for sqlite and 1 for file.
+typedef struct {
+    NSTimeInterval readLatency[2];
+    NSTimeInterval writeLatency[2];
+    NSUInteger readCount[2];
+    NSUInteger writeCount[2];
+} _YYDiskCacheSizeClass;
+
+static int _YYDiskCacheSizeClassIndex(NSUInteger size) {
+    int index = 0;
+    while (index < kSizeClassCount - 1 && size >= (kSizeClassBase << (index + 1))) index++;
+    return index;
+}
+
+static NSUInteger _YYDiskCacheSizeClassMinSize(int index) {
+    return index == 0 ? 0 : kSizeClassBase << index;
+}
+
+static void _YYDiskCacheAddSample(NSTimeInterval *latency, NSUInteger *count, NSTimeInterval sample) {
+    *latency = *count == 0 ? sample : *latency + (sample - *latency) * kLatencySampleWeight;
+    (*count)++;
+}
+
+static compression_algorithm _YYDiskCacheCompressionAlgorithm(YYDiskCacheCodec codec) {
+    switch (codec) {
+        case YYDiskCacheCodecLZ4: return COMPRESSION_LZ4;
+        case YYDiskCacheCodecLZFSE: return COMPRESSION_LZFSE;
+        case YYDiskCacheCodecLZMA: return COMPRESSION_LZMA;
+        default: return (compression_algorithm)0;
+    }
+}
+
+/**
+ Compress the data with the codec, the result is prefixed by the original length
+ (uint64, little endian). Returns nil if failed or it can't save 1/8 of the size.
+ */
+static NSData *_YYDiskCacheCompress(NSData *data, YYDiskCacheCodec codec) {
+    compression_algorithm algorithm = _YYDiskCacheCompressionAlgorithm(codec);
+    if (!algorithm || data.length == 0 || data.length > INT_MAX) return nil;
+    size_t capacity = data.length - data.length / 8;
+    NSMutableData *result = [NSMutableData dataWithLength:sizeof(uint64_t) + capacity];
+    if (!result) return nil;
+    uint64_t length = CFSwapInt64HostToLittle(data.length);
+    memcpy(result.mutableBytes, &length, sizeof(uint64_t));
+    size_t size = compression_encode_buffer((uint8_t *)result.mutableBytes + sizeof(uint64_t), capacity, data.bytes, data.length, NULL, algorithm);
+    if (size == 0) return nil;
+    result.length = sizeof(uint64_t) + size;
+    return result;
+}
+
+static NSData *_YYDiskCacheDecompress(NSData *data, YYDiskCacheCodec codec) {
+    compression_algorithm algorithm = _YYDiskCacheCompressionAlgorithm(codec);
+    if (!algorithm || data.length <= sizeof(uint64_t)) return nil;
+    uint64_t length;
+    memcpy(&length, data.bytes, sizeof(uint64_t));
+    length = CFSwapInt64LittleToHost(length);
+    if (length == 0 || length > INT_MAX) return nil;
+    NSMutableData *result = [NSMutableData dataWithLength:(NSUInteger)length];
+    if (!result) return nil;
+    size_t size = compression_decode_buffer(result.mutableBytes, (size_t)length, (const uint8_t *)data.bytes + sizeof(uint64_t), data.length - sizeof(uint64_t), NULL, algorithm);
+    if (size != length) return nil;
+    return result;
+}
+
 /// Free disk space in bytes.
 static int64_t _YYDiskSpaceFree() {
     NSError *error = nil;
@@ -31,19 +149,73 @@ static int64_t _YYDiskSpaceFree() {
     return space;
 }
 
-/// String's md5 hash.
-static NSString *_YYNSStringMD5(NSString *string) {
+static inline uint64_t _YYRotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _YYFmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/// MurmurHash3 (x64, 128-bit), a fast non-cryptographic hash.
+static void _YYMurmurHash3_128(const void *bytes, size_t length, uint64_t result[2]) {
+    const uint8_t *data = (const uint8_t *)bytes;
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+    size_t blocks = length / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+        k1 *= c1; k1 = _YYRotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = _YYRotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = _YYRotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = _YYRotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    
+    const uint8_t *tail = data + blocks * 16;
+    size_t rest = length & 15;
+    k1 = 0;
+    k2 = 0;
+    for (size_t i = rest; i > 8; i--) k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    if (rest > 8) {
+        k2 *= c2; k2 = _YYRotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (size_t i = MIN(rest, 8); i > 0; i--) k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    if (rest > 0) {
+        k1 *= c1; k1 = _YYRotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    
+    h1 ^= length; h2 ^= length;
+    h1 += h2; h2 += h1;
+    h1 = _YYFmix64(h1); h2 = _YYFmix64(h2);
+    h1 += h2; h2 += h1;
+    result[0] = h1;
+    result[1] = h2;
+}
+
+/// String's 128-bit hash (MurmurHash3).
+static NSString *_YYNSStringHash128(NSString *string) {
     if (!string) return nil;
     NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
-    unsigned char result[CC_MD5_DIGEST_LENGTH];
-    CC_MD5(data.bytes, (CC_LONG)data.length, result);
-    return [NSString stringWithFormat:
-                @"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-                result[0],  result[1],  result[2],  result[3],
-                result[4],  result[5],  result[6],  result[7],
-                result[8],  result[9],  result[10], result[11],
-                result[12], result[13], result[14], result[15]
-            ];
+    uint64_t result[2];
+    _YYMurmurHash3_128(data.bytes, data.length, result);
+    return [NSString stringWithFormat:@"%016llx%016llx", result[0], result[1]];
+}
+
+/// Data's sha256 hash.
+static NSString *_YYNSDataSHA256(NSData *data) {
+    unsigned char result[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, result);
+    NSMutableString *hash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [hash appendFormat:@"%02x", result[i]];
+    }
+    return hash;
 }
 
 /// weak reference for all instances
@@ -75,12 +247,743 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
     dispatch_semaphore_signal(_globalInstancesLock);
 }
 
+/// Remove the cache from the global instances if it's still the one for its path.
+static void _YYDiskCacheRemoveGlobal(YYDiskCache *cache) {
+    if (cache.path.length == 0) return;
+    _YYDiskCacheInitGlobal();
+    dispatch_semaphore_wait(_globalInstancesLock, DISPATCH_TIME_FOREVER);
+    if ([_globalInstances objectForKey:cache.path] == cache) {
+        [_globalInstances removeObjectForKey:cache.path];
+    }
+    dispatch_semaphore_signal(_globalInstancesLock);
+}
+
+
+@interface YYDiskCacheLatencyStats ()
+- (instancetype)_initWithSizeClass:(const _YYDiskCacheSizeClass *)sizeClass index:(int)index;
+@end
+
+@implementation YYDiskCacheLatencyStats
+
+- (instancetype)_initWithSizeClass:(const _YYDiskCacheSizeClass *)sizeClass index:(int)index {
+    self = [super init];
+    _minSize = _YYDiskCacheSizeClassMinSize(index);
+    _maxSize = index == kSizeClassCount - 1 ? NSUIntegerMax : _YYDiskCacheSizeClassMinSize(index + 1) - 1;
+    _inlineReadLatency = sizeClass->readLatency[0];
+    _fileReadLatency = sizeClass->readLatency[1];
+    _inlineReadCount = sizeClass->readCount[0];
+    _fileReadCount = sizeClass->readCount[1];
+    _inlineWriteLatency = sizeClass->writeLatency[0];
+    _fileWriteLatency = sizeClass->writeLatency[1];
+    _inlineWriteCount = sizeClass->writeCount[0];
+    _fileWriteCount = sizeClass->writeCount[1];
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p> (%lu~%lu) read sqlite:%.3fms(%lu) file:%.3fms(%lu)", self.class, self,
+            (unsigned long)_minSize, (unsigned long)_maxSize,
+            _inlineReadLatency * 1000, (unsigned long)_inlineReadCount,
+            _fileReadLatency * 1000, (unsigned long)_fileReadCount];
+}
+
+@end
+
+
+@interface YYDiskCacheTask () {
+    @package
+    void (^_block)(void);
+    volatile int32_t _cancelled;
+}
+@property (readwrite) YYDiskCachePriority priority;
+@end
+
+@implementation YYDiskCacheTask
+
+- (BOOL)isCancelled {
+    return _cancelled != 0;
+}
+
+- (void)cancel {
+    OSAtomicCompareAndSwap32Barrier(0, 1, &_cancelled);
+}
+
+@end
+
+
+/// Whether the number can be written as a bool, int64 or double without loss.
+static BOOL _YYBinaryIsPlainNumber(NSNumber *number) {
+    if ([number isKindOfClass:[NSDecimalNumber class]]) return NO;
+    if (strcmp(number.objCType, @encode(unsigned long long)) == 0 && number.unsignedLongLongValue > INT64_MAX) return NO;
+    return YES;
+}
+
+@interface YYDiskCacheBinaryWriter () {
+    @package
+    NSMutableData *_data;
+    NSMutableArray *_classes; // the classes written, referenced by index later
+    int _depth;
+    BOOL _failed;
+}
+@end
+
+@implementation YYDiskCacheBinaryWriter
+
+- (instancetype)init {
+    self = [super init];
+    _data = [NSMutableData new];
+    _classes = [NSMutableArray new];
+    return self;
+}
+
+- (void)_writeVarint:(uint64_t)value {
+    uint8_t buffer[10];
+    int length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    [_data appendBytes:buffer length:length];
+}
+
+- (void)_writeTag:(uint8_t)tag {
+    [_data appendBytes:&tag length:1];
+}
+
+- (void)writeBool:(BOOL)value {
+    uint8_t byte = value ? 1 : 0;
+    [_data appendBytes:&byte length:1];
+}
+
+- (void)writeInteger:(int64_t)value {
+    [self _writeVarint:((uint64_t)value << 1) ^ (uint64_t)(value >> 63)]; // zigzag
+}
+
+- (void)writeDouble:(double)value {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = CFSwapInt64HostToLittle(bits);
+    [_data appendBytes:&bits length:sizeof(bits)];
+}
+
+- (void)writeString:(NSString *)value {
+    if (!value) {
+        [self _writeVarint:0];
+        return;
+    }
+    NSUInteger length = [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (length == 0 && value.length > 0) _failed = YES; // can't be converted
+    [self _writeVarint:(uint64_t)length + 1];
+    NSUInteger offset = _data.length;
+    [_data increaseLengthBy:length];
+    [value getBytes:(uint8_t *)_data.mutableBytes + offset maxLength:length usedLength:NULL encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, value.length) remainingRange:NULL];
+}
+
+- (void)writeData:(NSData *)value {
+    if (!value) {
+        [self _writeVarint:0];
+        return;
+    }
+    [self _writeVarint:(uint64_t)value.length + 1];
+    [_data appendData:value];
+}
+
+- (void)_writeCodingObject:(id<YYDiskCacheBinaryCoding>)value {
+    Class cls = [value class];
+    NSUInteger index = [_classes indexOfObjectIdenticalTo:cls];
+    [self _writeTag:_YYBinaryTagCoding];
+    if (index == NSNotFound) {
+        [_classes addObject:cls];
+        [self _writeVarint:0];
+        [self writeString:NSStringFromClass(cls)];
+    } else {
+        [self _writeVarint:index + 1];
+    }
+    uint32_t version = [cls respondsToSelector:@selector(binaryCodingVersion)] ? [cls binaryCodingVersion] : 0;
+    [self _writeVarint:version];
+    
+    // the length of properties is filled after they're written
+    NSUInteger offset = _data.length;
+    uint32_t length = 0;
+    [_data appendBytes:&length length:sizeof(length)];
+    [value encodeWithBinaryWriter:self];
+    NSUInteger written = _data.length - offset - sizeof(length);
+    if (written > UINT32_MAX) _failed = YES;
+    length = CFSwapInt32HostToLittle((uint32_t)written);
+    [_data replaceBytesInRange:NSMakeRange(offset, sizeof(length)) withBytes:&length];
+}
+
+- (void)writeObject:(id)value {
+    if (_failed) return;
+    if (!value) {
+        [self _writeTag:_YYBinaryTagNil];
+        return;
+    }
+    if (_depth >= kBinaryArchiveMaxDepth) {
+        _failed = YES;
+        return;
+    }
+    _depth++;
+    if ([value conformsToProtocol:@protocol(YYDiskCacheBinaryCoding)]) {
+        [self _writeCodingObject:value];
+    } else if ([value isKindOfClass:[NSString class]]) {
+        [self _writeTag:_YYBinaryTagString];
+        [self writeString:value];
+    } else if ([value isKindOfClass:[NSNumber class]] && _YYBinaryIsPlainNumber(value)) {
+        if ((__bridge CFBooleanRef)value == kCFBooleanTrue) {
+            [self _writeTag:_YYBinaryTagTrue];
+        } else if ((__bridge CFBooleanRef)value == kCFBooleanFalse) {
+            [self _writeTag:_YYBinaryTagFalse];
+        } else if (CFNumberIsFloatType((__bridge CFNumberRef)value)) {
+            [self _writeTag:_YYBinaryTagDouble];
+            [self writeDouble:[value doubleValue]];
+        } else {
+            [self _writeTag:_YYBinaryTagInteger];
+            [self writeInteger:[value longLongValue]];
+        }
+    } else if ([value isKindOfClass:[NSData class]]) {
+        [self _writeTag:_YYBinaryTagData];
+        [self writeData:value];
+    } else if ([value isKindOfClass:[NSDate class]]) {
+        [self _writeTag:_YYBinaryTagDate];
+        [self writeDouble:[value timeIntervalSinceReferenceDate]];
+    } else if (value == (id)kCFNull) {
+        [self _writeTag:_YYBinaryTagNull];
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        [self _writeTag:_YYBinaryTagArray];
+        [self _writeVarint:[value count]];
+        for (id object in value) {
+            [self writeObject:object];
+        }
+    } else if ([value isKindOfClass:[NSDictionary class]]) {
+        [self _writeTag:_YYBinaryTagDictionary];
+        [self _writeVarint:[value count]];
+        [value enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL *stop) {
+            [self writeObject:key];
+            [self writeObject:object];
+        }];
+    } else if ([value conformsToProtocol:@protocol(NSCoding)]) {
+        NSData *data = nil;
+        @try {
+            data = [NSKeyedArchiver archivedDataWithRootObject:value];
+        }
+        @catch (NSException *exception) {
+            // nothing to do...
+        }
+        if (data) {
+            [self _writeTag:_YYBinaryTagKeyed];
+            [self writeData:data];
+        } else {
+            _failed = YES;
+        }
+    } else {
+        _failed = YES;
+    }
+    _depth--;
+}
+
+@end
+
+
+@interface YYDiskCacheBinaryReader () {
+    @package
+    NSData *_data;
+    const uint8_t *_pos;
+    const uint8_t *_end;        // end of the data, or of the object being read
+    NSMutableArray *_classes;   // the classes read, referenced by index later
+    int _depth;
+}
+@property (nonatomic, readwrite) BOOL failed;
+- (instancetype)_initWithData:(NSData *)data;
+@end
+
+@implementation YYDiskCacheBinaryReader
+
+- (instancetype)_initWithData:(NSData *)data {
+    self = [super init];
+    _data = data;
+    _pos = data.bytes;
+    _end = _pos + data.length;
+    _classes = [NSMutableArray new];
+    return self;
+}
+
+- (BOOL)_readBytes:(void *)bytes length:(size_t)length {
+    if (_failed || (size_t)(_end - _pos) < length) {
+        _failed = YES;
+        return NO;
+    }
+    memcpy(bytes, _pos, length);
+    _pos += length;
+    return YES;
+}
+
+- (uint64_t)_readVarint {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && !_failed && _pos < _end; shift += 7) {
+        uint8_t byte = *_pos++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    _failed = YES;
+    return 0;
+}
+
+/// Read the length prefix of a string or data, it's `NSNotFound` for nil.
+- (NSUInteger)_readLength {
+    uint64_t length = [self _readVarint];
+    if (length == 0) return NSNotFound;
+    if (length - 1 > (uint64_t)(_end - _pos)) {
+        _failed = YES;
+        return NSNotFound;
+    }
+    return (NSUInteger)(length - 1);
+}
+
+- (BOOL)readBool {
+    uint8_t value = 0;
+    [self _readBytes:&value length:1];
+    return value != 0;
+}
+
+- (int64_t)readInteger {
+    uint64_t value = [self _readVarint];
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+- (double)readDouble {
+    uint64_t bits = 0;
+    if (![self _readBytes:&bits length:sizeof(bits)]) return 0;
+    bits = CFSwapInt64LittleToHost(bits);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+- (NSString *)readString {
+    NSUInteger length = [self _readLength];
+    if (length == NSNotFound) return nil;
+    NSString *value = [[NSString alloc] initWithBytes:_pos length:length encoding:NSUTF8StringEncoding];
+    if (!value) _failed = YES;
+    _pos += length;
+    return value;
+}
+
+- (NSData *)readData {
+    NSUInteger length = [self _readLength];
+    if (length == NSNotFound) return nil;
+    NSData *value = [NSData dataWithBytes:_pos length:length];
+    _pos += length;
+    return value;
+}
+
+- (id)_readCodingObject {
+    uint64_t index = [self _readVarint];
+    Class cls = nil;
+    if (index == 0) {
+        NSString *name = [self readString];
+        cls = name ? NSClassFromString(name) : nil;
+        if (!cls || ![cls conformsToProtocol:@protocol(YYDiskCacheBinaryCoding)]) {
+            _failed = YES;
+            return nil;
+        }
+        [_classes addObject:cls];
+    } else if (index <= _classes.count) {
+        cls = _classes[(NSUInteger)index - 1];
+    } else {
+        _failed = YES;
+        return nil;
+    }
+    uint32_t version = (uint32_t)[self _readVarint];
+    uint32_t length = 0;
+    if (![self _readBytes:&length length:sizeof(length)]) return nil;
+    length = CFSwapInt32LittleToHost(length);
+    if (length > (size_t)(_end - _pos)) {
+        _failed = YES;
+        return nil;
+    }
+    
+    // the object can't read beyond its properties, and the properties it doesn't read are skipped
+    const uint8_t *end = _end;
+    _end = _pos + length;
+    id object = [[cls alloc] initWithBinaryReader:self version:version];
+    _pos = _end;
+    _end = end;
+    return _failed ? nil : object;
+}
+
+- (id)readObject {
+    uint8_t tag = 0;
+    if (![self _readBytes:&tag length:1]) return nil;
+    if (_depth >= kBinaryArchiveMaxDepth) {
+        _failed = YES;
+        return nil;
+    }
+    _depth++;
+    id object = nil;
+    switch (tag) {
+        case _YYBinaryTagNil: break;
+        case _YYBinaryTagNull: object = [NSNull null]; break;
+        case _YYBinaryTagTrue: object = @YES; break;
+        case _YYBinaryTagFalse: object = @NO; break;
+        case _YYBinaryTagInteger: object = @([self readInteger]); break;
+        case _YYBinaryTagDouble: object = @([self readDouble]); break;
+        case _YYBinaryTagString: object = [self readString]; break;
+        case _YYBinaryTagData: object = [self readData]; break;
+        case _YYBinaryTagDate: object = [NSDate dateWithTimeIntervalSinceReferenceDate:[self readDouble]]; break;
+        case _YYBinaryTagArray: {
+            uint64_t count = [self _readVarint];
+            if (count > (uint64_t)(_end - _pos)) { // each object takes 1 byte at least
+                _failed = YES;
+                break;
+            }
+            NSMutableArray *array = [NSMutableArray arrayWithCapacity:(NSUInteger)count];
+            for (uint64_t i = 0; i < count && !_failed; i++) {
+                id element = [self readObject];
+                if (element) [array addObject:element];
+                else _failed = YES;
+            }
+            object = array;
+        } break;
+        case _YYBinaryTagDictionary: {
+            uint64_t count = [self _readVarint];
+            if (count > (uint64_t)(_end - _pos) / 2) {
+                _failed = YES;
+                break;
+            }
+            NSMutableDictionary *dic = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)count];
+            for (uint64_t i = 0; i < count && !_failed; i++) {
+                id key = [self readObject];
+                id element = [self readObject];
+                if (key && element) dic[key] = element;
+                else _failed = YES;
+            }
+            object = dic;
+        } break;
+        case _YYBinaryTagCoding: object = [self _readCodingObject]; break;
+        case _YYBinaryTagKeyed: {
+            NSData *data = [self readData];
+            @try {
+                object = data ? [NSKeyedUnarchiver unarchiveObjectWithData:data] : nil;
+            }
+            @catch (NSException *exception) {
+                // nothing to do...
+            }
+            if (!object) _failed = YES;
+        } break;
+        default: _failed = YES; break;
+    }
+    _depth--;
+    return _failed ? nil : object;
+}
+
+@end
+
+
+/// Archive the object in binary format, nil if it fails.
+static NSData *_YYDiskCacheBinaryArchive(id<YYDiskCacheBinaryCoding> object) {
+    YYDiskCacheBinaryWriter *writer = [YYDiskCacheBinaryWriter new];
+    [writer->_data appendBytes:kBinaryArchiveHeader length:sizeof(kBinaryArchiveHeader)];
+    @try {
+        [writer writeObject:object];
+    }
+    @catch (NSException *exception) {
+        return nil;
+    }
+    return writer->_failed ? nil : writer->_data;
+}
+
+static BOOL _YYDiskCacheIsBinaryArchive(NSData *data) {
+    return data.length > sizeof(kBinaryArchiveHeader) && memcmp(data.bytes, kBinaryArchiveHeader, sizeof(kBinaryArchiveHeader)) == 0;
+}
+
+static id _YYDiskCacheBinaryUnarchive(NSData *data) {
+    YYDiskCacheBinaryReader *reader = [[YYDiskCacheBinaryReader alloc] _initWithData:data];
+    reader->_pos += sizeof(kBinaryArchiveHeader);
+    id object = nil;
+    @try {
+        object = [reader readObject];
+    }
+    @catch (NSException *exception) {
+        return nil;
+    }
+    return reader.failed ? nil : object;
+}
+
+
+static dispatch_queue_t _YYDiskCacheExecutorQueue(YYDiskCachePriority priority) {
+    switch (priority) {
+        case YYDiskCachePriorityHigh: return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0);
+        case YYDiskCachePriorityLow: return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
+        default: return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    }
+}
+
+/**
+ Runs the asynchronous operations with a limited number of threads. The pending
+ operations with higher priority run first, in FIFO or LIFO order, each one in the
+ global queue of its priority.
+ */
+@interface _YYDiskCacheExecutor : NSObject {
+    @package
+    pthread_mutex_t _lock;
+    NSUInteger _maxConcurrentCount;  // guarded by _lock
+    BOOL _lastInFirstOut;            // guarded by _lock
+}
+- (YYDiskCacheTask *)addBlock:(void (^)(void))block priority:(YYDiskCachePriority)priority;
+- (void)setMaxConcurrentCount:(NSUInteger)maxConcurrentCount; // starts the workers if it's raised
+@end
+
+@implementation _YYDiskCacheExecutor {
+    NSMutableArray *_pendingTasks[YYDiskCachePriorityHigh + 1]; // YYDiskCacheTask, index is priority
+    NSUInteger _runningCount;
+}
+
+- (instancetype)init {
+    self = [super init];
+    pthread_mutex_init(&_lock, NULL);
+    for (int i = 0; i <= YYDiskCachePriorityHigh; i++) {
+        _pendingTasks[i] = [NSMutableArray new];
+    }
+    _maxConcurrentCount = 4;
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+- (YYDiskCacheTask *)addBlock:(void (^)(void))block priority:(YYDiskCachePriority)priority {
+    if (priority < YYDiskCachePriorityLow) priority = YYDiskCachePriorityLow;
+    if (priority > YYDiskCachePriorityHigh) priority = YYDiskCachePriorityHigh;
+    YYDiskCacheTask *task = [YYDiskCacheTask new];
+    task.priority = priority;
+    task->_block = block;
+    
+    pthread_mutex_lock(&_lock);
+    [_pendingTasks[priority] addObject:task];
+    [self _startWorkers];
+    pthread_mutex_unlock(&_lock);
+    return task;
+}
+
+- (void)setMaxConcurrentCount:(NSUInteger)maxConcurrentCount {
+    pthread_mutex_lock(&_lock);
+    _maxConcurrentCount = maxConcurrentCount;
+    [self _startWorkers]; // the limit may be raised
+    pthread_mutex_unlock(&_lock);
+}
+
+/// Remove and return the pending task to run next, must be called with _lock held.
+- (YYDiskCacheTask *)_nextTask {
+    for (int i = YYDiskCachePriorityHigh; i >= 0; i--) {
+        NSMutableArray *tasks = _pendingTasks[i];
+        if (tasks.count == 0) continue;
+        YYDiskCacheTask *task;
+        if (_lastInFirstOut) {
+            task = tasks.lastObject;
+            [tasks removeLastObject];
+        } else {
+            task = tasks.firstObject;
+            [tasks removeObjectAtIndex:0];
+        }
+        return task;
+    }
+    return nil;
+}
+
+/// Start the workers for the pending tasks up to the limit, must be called with _lock held.
+- (void)_startWorkers {
+    while (_runningCount < MAX(_maxConcurrentCount, 1)) {
+        YYDiskCacheTask *task = [self _nextTask];
+        if (!task) break;
+        _runningCount++;
+        [self _runTask:task];
+    }
+}
+
+/**
+ Run the task in the global queue of its priority, then the worker continues with
+ the next pending task (in the queue of that task), until there's none.
+ */
+- (void)_runTask:(YYDiskCacheTask *)task {
+    dispatch_async(_YYDiskCacheExecutorQueue(task.priority), ^{
+        void (^block)(void) = task->_block;
+        task->_block = nil;
+        if (!task.isCancelled && block) block();
+        
+        pthread_mutex_lock(&self->_lock);
+        BOOL overLimit = self->_runningCount > MAX(self->_maxConcurrentCount, 1); // the limit is lowered
+        YYDiskCacheTask *next = overLimit ? nil : [self _nextTask];
+        if (next) [self _runTask:next];
+        else self->_runningCount--;
+        pthread_mutex_unlock(&self->_lock);
+    });
+}
+
+@end
 
 
 @implementation YYDiskCache {
     YYKVStorage *_kv;
+    YYKVStorageType _storageType;
+    BOOL _opened;      // set after _kv is opened, guarded by _readLock
+    BOOL _errorLogsEnabled; // applied to _kv when it's opened, guarded by _lock
+    BOOL _mappedReadEnabled; // applied to _kv when it's opened, guarded by _readLock
     dispatch_semaphore_t _lock;
     dispatch_queue_t _queue;
+    _YYDiskCacheExecutor *_executor;
+    volatile int32_t _accessTimeFlushScheduled;
+    
+    dispatch_semaphore_t _pendingLock;      // guards the pending writes
+    NSMutableArray *_pendingWrites;         // void (^)(YYKVStorage *kv)
+    NSMutableArray *_pendingWriteCallbacks; // void (^)(void)
+    volatile int32_t _pendingWriteCount;
+    BOOL _pendingWriteScheduled;
+    
+    BOOL _adaptiveInlineThresholdEnabled;
+    BOOL _contentDedupEnabled; // applied to _kv when it's opened, guarded by _readLock
+    _YYDiskCacheSizeClass _sizeClasses[kSizeClassCount]; // guarded by _lock
+    volatile int32_t _probeCounter;
+    
+    dispatch_semaphore_t _readLock;     // guards the _kv pointer and _accessedKeys for the readers without _lock
+    NSMutableSet *_accessedKeys;        // keys read without _lock, their access time is written later
+    pthread_mutex_t _keyLocks[kKeyLockCount];
+}
+
+- (pthread_mutex_t *)_lockForKey:(NSString *)key {
+    return &_keyLocks[key.hash % kKeyLockCount];
+}
+
+/// The storage for the methods which don't hold the lock, nil after app terminated.
+- (YYKVStorage *)_storage {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    YYKVStorage *kv = _kv;
+    dispatch_semaphore_signal(_readLock);
+    return kv;
+}
+
+/// Write the values which will be stored as files to temporary files without the lock.
+/// Returns the temporary filenames, or NSNull for the items stored in sqlite.
+- (NSArray *)_temporaryFilenamesForItems:(NSArray *)items {
+    YYKVStorage *kv = [self _storage];
+    NSMutableArray *filenames = [NSMutableArray arrayWithCapacity:items.count];
+    for (YYKVStorageItem *item in items) {
+        NSString *filename = item.filename ? [kv writeTemporaryFileWithValue:item.value] : nil;
+        [filenames addObject:filename ?: (id)kCFNull];
+    }
+    return filenames;
+}
+
+/**
+ Save the item, move its temporary file to the place if it's not nil.
+ The lock should be held, the key's lock is held during the save.
+ */
+- (BOOL)_saveItem:(YYKVStorageItem *)item temporaryFilename:(NSString *)temporaryFilename {
+    BOOL adaptive = [self _isAdaptiveInlineThresholdAvailable];
+    NSTimeInterval begin = adaptive ? CACurrentMediaTime() : 0;
+    pthread_mutex_t *keyLock = [self _lockForKey:item.key];
+    pthread_mutex_lock(keyLock);
+    BOOL suc = [_kv saveItem:item temporaryFilename:temporaryFilename];
+    pthread_mutex_unlock(keyLock);
+    if (suc && adaptive) {
+        [self _recordWriteOfItem:item latency:CACurrentMediaTime() - begin];
+    }
+    return suc;
+}
+
+/// Remove the item with the key's lock held. The lock should be held.
+- (BOOL)_removeItemForKey:(NSString *)key {
+    pthread_mutex_t *keyLock = [self _lockForKey:key];
+    pthread_mutex_lock(keyLock);
+    BOOL suc = [_kv removeItemForKey:key];
+    pthread_mutex_unlock(keyLock);
+    return suc;
+}
+
+/// Read the item without the lock, only the key's lock is held.
+- (YYKVStorageItem *)_readItemForKey:(NSString *)key {
+    YYKVStorage *kv = [self _storage];
+    pthread_mutex_t *keyLock = [self _lockForKey:key];
+    pthread_mutex_lock(keyLock);
+    YYKVStorageItem *item = [kv readItemForKey:key];
+    pthread_mutex_unlock(keyLock);
+    if (item) {
+        dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+        if (!_accessedKeys) _accessedKeys = [NSMutableSet new];
+        [_accessedKeys addObject:key];
+        dispatch_semaphore_signal(_readLock);
+        [self _scheduleAccessTimeFlush];
+    }
+    return item;
+}
+
+/// Write the access time of the items read without the lock. The lock should be held.
+- (void)_applyAccessedKeys {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    NSSet *keys = _accessedKeys;
+    _accessedKeys = nil;
+    dispatch_semaphore_signal(_readLock);
+    if (keys.count) [_kv updateAccessTimeForKeys:keys.allObjects];
+}
+
+- (void)_recordReadOfItem:(YYKVStorageItem *)item latency:(NSTimeInterval)latency {
+    _YYDiskCacheSizeClass *sizeClass = &_sizeClasses[_YYDiskCacheSizeClassIndex(item.value.length)];
+    int side = item.filename ? 1 : 0;
+    _YYDiskCacheAddSample(&sizeClass->readLatency[side], &sizeClass->readCount[side], latency);
+}
+
+- (void)_recordWriteOfItem:(YYKVStorageItem *)item latency:(NSTimeInterval)latency {
+    _YYDiskCacheSizeClass *sizeClass = &_sizeClasses[_YYDiskCacheSizeClassIndex(item.value.length)];
+    int side = item.filename ? 1 : 0;
+    _YYDiskCacheAddSample(&sizeClass->writeLatency[side], &sizeClass->writeCount[side], latency);
+}
+
+/**
+ Move the inline threshold to the lower bound of the first size class in which file
+ reads are faster than sqlite reads. The size classes without enough samples keep
+ their current side. The lock should be held.
+ */
+- (void)_updateInlineThreshold {
+    NSUInteger threshold = _inlineThreshold;
+    BOOL measured = NO;
+    int index = 1;
+    for (; index < kSizeClassCount - 1; index++) {
+        _YYDiskCacheSizeClass *sizeClass = &_sizeClasses[index];
+        BOOL file;
+        if (sizeClass->readCount[0] >= kLatencyMinSampleCount && sizeClass->readCount[1] >= kLatencyMinSampleCount) {
+            file = sizeClass->readLatency[1] < sizeClass->readLatency[0];
+            measured = YES;
+        } else {
+            file = _YYDiskCacheSizeClassMinSize(index) >= threshold;
+        }
+        if (file) break;
+    }
+    if (measured) _inlineThreshold = _YYDiskCacheSizeClassMinSize(index);
+}
+
+/**
+ Move the item to the other side of the inline threshold if it's stored on the wrong
+ side and not in the size classes next to the threshold. The lock should be held.
+ */
+- (void)_migrateItemIfNeeded:(YYKVStorageItem *)item {
+    NSUInteger size = item.value.length;
+    BOOL file = size > _inlineThreshold;
+    if (file == (item.filename != nil)) return;
+    int distance = abs(_YYDiskCacheSizeClassIndex(size) - _YYDiskCacheSizeClassIndex(_inlineThreshold));
+    if (distance <= 1) return;
+    YYKVStorageItem *migrated = [YYKVStorageItem new];
+    migrated.key = item.key;
+    migrated.value = item.value;
+    migrated.filename = file ? [self _filenameForKey:item.key value:item.value] : nil;
+    migrated.extendedData = item.extendedData;
+    migrated.codec = item.codec;
+    [self _saveItem:migrated temporaryFilename:nil];
+}
+
+- (BOOL)_isAdaptiveInlineThresholdAvailable {
+    return _adaptiveInlineThresholdEnabled && _storageType != YYKVStorageTypeSQLite && _storageType != YYKVStorageTypeFile;
 }
 
 - (void)_trimRecursively {
@@ -99,10 +1002,13 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
         __strong typeof(_self) self = _self;
         if (!self) return;
         Lock();
+        [self _applyPendingWrites];
         [self _trimToCost:self.costLimit];
         [self _trimToCount:self.countLimit];
         [self _trimToAge:self.ageLimit];
         [self _trimToFreeDiskSpace:self.freeDiskSpaceLimit];
+        [self->_kv compactSegments];
+        if ([self _isAdaptiveInlineThresholdAvailable]) [self _updateInlineThreshold];
         Unlock();
     });
 }
@@ -143,16 +1049,204 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
     [self _trimToCost:(int)costLimit];
 }
 
-- (NSString *)_filenameForKey:(NSString *)key {
+- (NSString *)_filenameForKey:(NSString *)key value:(NSData *)value {
+    if (_contentDedupEnabled) return _YYNSDataSHA256(value);
     NSString *filename = nil;
     if (_customFileNameBlock) filename = _customFileNameBlock(key);
-    if (!filename) filename = _YYNSStringMD5(key);
+    if (!filename) filename = _YYNSStringHash128(key);
     return filename;
 }
 
+- (YYKVStorageItem *)_itemWithObject:(id<NSCoding>)object forKey:(NSString *)key {
+    NSData *value = nil;
+    if (_customArchiveBlock) {
+        value = _customArchiveBlock(object);
+    } else {
+        if ([(id)object conformsToProtocol:@protocol(YYDiskCacheBinaryCoding)]) {
+            value = _YYDiskCacheBinaryArchive((id<YYDiskCacheBinaryCoding>)object);
+        }
+        if (!value) {
+            @try {
+                value = [NSKeyedArchiver archivedDataWithRootObject:object];
+            }
+            @catch (NSException *exception) {
+                // nothing to do...
+            }
+        }
+    }
+    if (!value) return nil;
+    
+    YYDiskCacheCodec codec = YYDiskCacheCodecNone;
+    if (value.length >= _compressionThreshold) {
+        YYDiskCacheCodec (^codecBlock)(id object, NSData *data) = _codecBlock;
+        codec = codecBlock ? codecBlock(object, value) : _codec;
+    }
+    if (codec != YYDiskCacheCodecNone) {
+        NSData *compressed = _YYDiskCacheCompress(value, codec);
+        if (compressed) {
+            value = compressed;
+        } else {
+            codec = YYDiskCacheCodecNone;
+        }
+    }
+    
+    NSString *filename = nil;
+    if (_storageType != YYKVStorageTypeSQLite) {
+        BOOL file = value.length > _inlineThreshold;
+        if ([self _isAdaptiveInlineThresholdAvailable] &&
+            OSAtomicIncrement32(&_probeCounter) % kLatencyProbeInterval == 0 &&
+            _YYDiskCacheSizeClassIndex(value.length) < kSizeClassCount - 1) {
+            file = !file; // measure the other side
+        }
+        if (file) {
+            filename = [self _filenameForKey:key value:value];
+        }
+    }
+    
+    YYKVStorageItem *item = [YYKVStorageItem new];
+    item.key = key;
+    item.value = value;
+    item.filename = filename;
+    item.extendedData = [YYDiskCache getExtendedDataFromObject:object];
+    item.codec = (int)codec;
+    return item;
+}
+
+- (id)_objectFromItem:(YYKVStorageItem *)item {
+    NSData *value = item.value;
+    if (value && item.codec != YYDiskCacheCodecNone) {
+        value = _YYDiskCacheDecompress(value, item.codec);
+    }
+    if (!value) return nil;
+    
+    id object = nil;
+    if (_customUnarchiveBlock) {
+        object = _customUnarchiveBlock(value);
+    } else if (_YYDiskCacheIsBinaryArchive(value)) {
+        object = _YYDiskCacheBinaryUnarchive(value);
+    } else {
+        @try {
+            object = [NSKeyedUnarchiver unarchiveObjectWithData:value];
+        }
+        @catch (NSException *exception) {
+            // nothing to do...
+        }
+    }
+    if (object && item.extendedData) {
+        [YYDiskCache setExtendedData:item.extendedData toObject:object];
+    }
+    return object;
+}
+
+/**
+ Add an asynchronous write, it will be committed with other writes in one
+ transaction within `kWriteBehindDelay`, and then the callback is invoked in
+ background queue.
+ */
+- (void)_enqueueWrite:(void (^)(YYKVStorage *kv))write callback:(void (^)(void))callback {
+    BOOL flushNow = NO, schedule = NO;
+    dispatch_semaphore_wait(_pendingLock, DISPATCH_TIME_FOREVER);
+    if (!_pendingWrites) {
+        _pendingWrites = [NSMutableArray new];
+        _pendingWriteCallbacks = [NSMutableArray new];
+    }
+    [_pendingWrites addObject:write];
+    if (callback) [_pendingWriteCallbacks addObject:callback];
+    OSAtomicIncrement32Barrier(&_pendingWriteCount);
+    if (_pendingWrites.count >= kWriteBehindMaxCount) {
+        flushNow = YES;
+    } else if (!_pendingWriteScheduled) {
+        _pendingWriteScheduled = YES;
+        schedule = YES;
+    }
+    dispatch_semaphore_signal(_pendingLock);
+    
+    if (!flushNow && !schedule) return;
+    __weak typeof(self) _self = self;
+    dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, flushNow ? 0 : (int64_t)(kWriteBehindDelay * NSEC_PER_SEC));
+    dispatch_after(when, _queue, ^{
+        __strong typeof(_self) self = _self;
+        if (!self) return;
+        Lock();
+        [self _applyPendingWrites];
+        Unlock();
+    });
+}
+
+/**
+ Commit the pending asynchronous writes in one transaction, the lock should be held.
+ Each access to the storage calls this method first, so it sees the pending writes.
+ */
+- (void)_applyPendingWrites {
+    if (_pendingWriteCount == 0) return;
+    dispatch_semaphore_wait(_pendingLock, DISPATCH_TIME_FOREVER);
+    NSArray *writes = _pendingWrites;
+    NSArray *callbacks = _pendingWriteCallbacks;
+    _pendingWrites = nil;
+    _pendingWriteCallbacks = nil;
+    _pendingWriteScheduled = NO;
+    OSAtomicAnd32Barrier(0, (volatile uint32_t *)&_pendingWriteCount);
+    dispatch_semaphore_signal(_pendingLock);
+    
+    if (writes.count) {
+        BOOL transaction = [_kv beginTransaction];
+        for (void (^write)(YYKVStorage *kv) in writes) {
+            write(_kv);
+        }
+        if (transaction) [_kv commitTransaction];
+    }
+    if (callbacks.count) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            for (void (^callback)(void) in callbacks) {
+                callback();
+            }
+        });
+    }
+}
+
+/// Write the deferred access times later, if there's no pending flush.
+- (void)_scheduleAccessTimeFlush {
+    if (_accessTimeFlushScheduled || !OSAtomicCompareAndSwap32Barrier(0, 1, &_accessTimeFlushScheduled)) return;
+    __weak typeof(self) _self = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kAccessTimeFlushDelay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        __strong typeof(_self) self = _self;
+        if (!self) return;
+        OSAtomicAnd32Barrier(0, (volatile uint32_t *)&self->_accessTimeFlushScheduled);
+        Lock();
+        [self _applyPendingWrites];
+        [self _applyAccessedKeys];
+        [self->_kv flushAccessTimes];
+        Unlock();
+    });
+}
+
+/// Open the storage and record the time it takes, including the recovery.
+- (BOOL)_openStorage {
+    NSTimeInterval begin = CACurrentMediaTime();
+    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:_path type:_storageType];
+    _openDuration = CACurrentMediaTime() - begin;
+    if (!kv) return NO;
+    kv.errorLogsEnabled = _errorLogsEnabled;
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    // the settings may be changed without _lock while opening, see `_setOptionBeforeOpened:`
+    kv.mappedReadEnabled = _mappedReadEnabled;
+    kv.contentDedupEnabled = _contentDedupEnabled;
+    _contentDedupEnabled = kv.contentDedupEnabled;
+    _kv = kv;
+    _opened = YES;
+    dispatch_semaphore_signal(_readLock);
+    return YES;
+}
+
 - (void)_appWillBeTerminated {
     Lock();
+    [self _applyPendingWrites];
+    [self _applyAccessedKeys];
+    YYKVStorage *kv = _kv;
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
     _kv = nil;
+    dispatch_semaphore_signal(_readLock);
+    kv = nil;
     Unlock();
 }
 
@@ -160,6 +1254,9 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationWillTerminateNotification object:nil];
+    for (int i = 0; i < kKeyLockCount; i++) {
+        pthread_mutex_destroy(&_keyLocks[i]);
+    }
 }
 
 - (instancetype)init {
@@ -173,6 +1270,19 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 
 - (instancetype)initWithPath:(NSString *)path
              inlineThreshold:(NSUInteger)threshold {
+    return [self initWithPath:path inlineThreshold:threshold useSegmentFiles:NO];
+}
+
+- (instancetype)initWithPath:(NSString *)path
+             inlineThreshold:(NSUInteger)threshold
+             useSegmentFiles:(BOOL)useSegmentFiles {
+    return [self initWithPath:path inlineThreshold:threshold useSegmentFiles:useSegmentFiles openAsynchronously:NO];
+}
+
+- (instancetype)initWithPath:(NSString *)path
+             inlineThreshold:(NSUInteger)threshold
+             useSegmentFiles:(BOOL)useSegmentFiles
+          openAsynchronously:(BOOL)openAsynchronously {
     self = [super init];
     if (!self) return nil;
     
@@ -184,18 +1294,30 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
         type = YYKVStorageTypeFile;
     } else if (threshold == NSUIntegerMax) {
         type = YYKVStorageTypeSQLite;
+    } else if (useSegmentFiles) {
+        type = YYKVStorageTypeSegment;
     } else {
         type = YYKVStorageTypeMixed;
     }
     
-    YYKVStorage *kv = [[YYKVStorage alloc] initWithPath:path type:type];
-    if (!kv) return nil;
-    
-    _kv = kv;
+    _storageType = type;
     _path = path;
     _lock = dispatch_semaphore_create(1);
+    _pendingLock = dispatch_semaphore_create(1);
+    _readLock = dispatch_semaphore_create(1);
+    for (int i = 0; i < kKeyLockCount; i++) {
+        pthread_mutex_init(&_keyLocks[i], NULL);
+    }
+    _errorLogsEnabled = YES;
+    if (openAsynchronously) {
+        Lock(); // the other methods wait until the storage is opened
+    } else if (![self _openStorage]) {
+        return nil;
+    }
     _queue = dispatch_queue_create("com.ibireme.cache.disk", DISPATCH_QUEUE_CONCURRENT);
+    _executor = [_YYDiskCacheExecutor new];
     _inlineThreshold = threshold;
+    _compressionThreshold = 1024;
     _countLimit = NSUIntegerMax;
     _costLimit = NSUIntegerMax;
     _ageLimit = DBL_MAX;
@@ -205,13 +1327,29 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
     [self _trimRecursively];
     _YYDiskCacheSetGlobal(self);
     
+    if (openAsynchronously) {
+        // registered before opening, so a failed cache is always removed from the global instances,
+        // and the next `initWithPath:` for this path tries to open it again.
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+            if (![self _openStorage]) {
+                _YYDiskCacheRemoveGlobal(self);
+                if (self->_errorLogsEnabled) NSLog(@"YYDiskCache open error: %@", self->_path);
+            }
+            Unlock();
+        });
+    }
+    
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appWillBeTerminated) name:UIApplicationWillTerminateNotification object:nil];
     return self;
 }
 
 - (BOOL)containsObjectForKey:(NSString *)key {
     if (!key) return NO;
+    if (_pendingWriteCount == 0 && _opened && ![[self _storage] itemMayExistForKey:key]) {
+        return NO; // a definite miss, without the lock and sqlite
+    }
     Lock();
+    [self _applyPendingWrites];
     BOOL contains = [_kv itemExistsForKey:key];
     Unlock();
     return contains;
@@ -220,45 +1358,52 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 - (void)containsObjectForKey:(NSString *)key withBlock:(void(^)(NSString *key, BOOL contains))block {
     if (!block) return;
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         BOOL contains = [self containsObjectForKey:key];
         block(key, contains);
-    });
+    } priority:YYDiskCachePriorityNormal];
 }
 
 - (id<NSCoding>)objectForKey:(NSString *)key {
     if (!key) return nil;
-    Lock();
-    YYKVStorageItem *item = [_kv getItemForKey:key];
-    Unlock();
-    if (!item.value) return nil;
-    
-    id object = nil;
-    if (_customUnarchiveBlock) {
-        object = _customUnarchiveBlock(item.value);
-    } else {
-        @try {
-            object = [NSKeyedUnarchiver unarchiveObjectWithData:item.value];
-        }
-        @catch (NSException *exception) {
-            // nothing to do...
+    if (_pendingWriteCount == 0 && _opened) {
+        // a definite miss, without the lock and sqlite
+        if (![[self _storage] itemMayExistForKey:key]) return nil;
+        if (![self _isAdaptiveInlineThresholdAvailable]) {
+            // read concurrently with the other readers and writers
+            return [self _objectFromItem:[self _readItemForKey:key]];
         }
     }
-    if (object && item.extendedData) {
-        [YYDiskCache setExtendedData:item.extendedData toObject:object];
+    Lock();
+    [self _applyPendingWrites];
+    BOOL adaptive = [self _isAdaptiveInlineThresholdAvailable];
+    NSTimeInterval begin = adaptive ? CACurrentMediaTime() : 0;
+    YYKVStorageItem *item = [_kv getItemForKey:key];
+    if (item && adaptive) {
+        [self _recordReadOfItem:item latency:CACurrentMediaTime() - begin];
+        [self _migrateItemIfNeeded:item];
     }
-    return object;
+    BOOL deferred = _kv.deferredAccessTimeEnabled;
+    Unlock();
+    if (item && deferred) [self _scheduleAccessTimeFlush];
+    return [self _objectFromItem:item];
 }
 
 - (void)objectForKey:(NSString *)key withBlock:(void(^)(NSString *key, id<NSCoding> object))block {
-    if (!block) return;
+    [self objectForKey:key priority:YYDiskCachePriorityNormal withBlock:block];
+}
+
+- (YYDiskCacheTask *)objectForKey:(NSString *)key
+                         priority:(YYDiskCachePriority)priority
+                        withBlock:(void(^)(NSString *key, id<NSCoding> object))block {
+    if (!block) return nil;
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    return [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         id<NSCoding> object = [self objectForKey:key];
         block(key, object);
-    });
+    } priority:priority];
 }
 
 - (void)setObject:(id<NSCoding>)object forKey:(NSString *)key {
@@ -268,88 +1413,210 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
         return;
     }
     
-    NSData *extendedData = [YYDiskCache getExtendedDataFromObject:object];
-    NSData *value = nil;
-    if (_customArchiveBlock) {
-        value = _customArchiveBlock(object);
-    } else {
-        @try {
-            value = [NSKeyedArchiver archivedDataWithRootObject:object];
-        }
-        @catch (NSException *exception) {
-            // nothing to do...
-        }
-    }
-    if (!value) return;
-    NSString *filename = nil;
-    if (_kv.type != YYKVStorageTypeSQLite) {
-        if (value.length > _inlineThreshold) {
-            filename = [self _filenameForKey:key];
-        }
-    }
+    YYKVStorageItem *item = [self _itemWithObject:object forKey:key];
+    if (!item) return;
+    NSString *temporaryFilename = item.filename ? [[self _storage] writeTemporaryFileWithValue:item.value] : nil;
     
     Lock();
-    [_kv saveItemWithKey:key value:value filename:filename extendedData:extendedData];
+    [self _applyPendingWrites];
+    [self _saveItem:item temporaryFilename:temporaryFilename];
     Unlock();
 }
 
 - (void)setObject:(id<NSCoding>)object forKey:(NSString *)key withBlock:(void(^)(void))block {
+    if (!key || !object) {
+        if (key) {
+            [self removeObjectForKey:key withBlock:block ? ^(NSString *key) { block(); } : nil];
+        } else if (block) {
+            dispatch_async(_queue, block);
+        }
+        return;
+    }
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
-        [self setObject:object forKey:key];
-        if (block) block();
-    });
+        YYKVStorageItem *item = [self _itemWithObject:object forKey:key];
+        if (!item) {
+            if (block) block();
+            return;
+        }
+        NSString *temporaryFilename = item.filename ? [[self _storage] writeTemporaryFileWithValue:item.value] : nil;
+        [self _enqueueWrite:^(YYKVStorage *kv) {
+            [self _saveItem:item temporaryFilename:temporaryFilename];
+        } callback:block];
+    } priority:YYDiskCachePriorityNormal];
 }
 
 - (void)removeObjectForKey:(NSString *)key {
     if (!key) return;
     Lock();
-    [_kv removeItemForKey:key];
+    [self _applyPendingWrites];
+    [self _removeItemForKey:key];
     Unlock();
 }
 
 - (void)removeObjectForKey:(NSString *)key withBlock:(void(^)(NSString *key))block {
+    if (!key) {
+        if (block) dispatch_async(_queue, ^{ block(key); });
+        return;
+    }
+    [self _enqueueWrite:^(YYKVStorage *kv) {
+        [self _removeItemForKey:key];
+    } callback:block ? ^{ block(key); } : nil];
+}
+
+- (NSSet<NSString *> *)containsObjectsForKeys:(NSArray<NSString *> *)keys {
+    NSMutableSet *contained = [NSMutableSet new];
+    if (keys.count == 0) return contained;
+    Lock();
+    [self _applyPendingWrites];
+    NSArray *items = [_kv getItemInfoForKeys:keys];
+    Unlock();
+    for (YYKVStorageItem *item in items) {
+        if (item.key) [contained addObject:item.key];
+    }
+    return contained;
+}
+
+- (void)containsObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSSet<NSString *> *keys))block {
+    if (!block) return;
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
-        [self removeObjectForKey:key];
-        if (block) block(key);
-    });
+        NSSet *contained = [self containsObjectsForKeys:keys];
+        block(contained ?: [NSSet set]);
+    } priority:YYDiskCachePriorityNormal];
+}
+
+- (NSDictionary<NSString *, id<NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys {
+    NSMutableDictionary *objects = [NSMutableDictionary new];
+    if (keys.count == 0) return objects;
+    Lock();
+    [self _applyPendingWrites];
+    NSArray *items = [_kv getItemForKeys:keys];
+    BOOL deferred = _kv.deferredAccessTimeEnabled;
+    Unlock();
+    if (items.count && deferred) [self _scheduleAccessTimeFlush];
+    for (YYKVStorageItem *item in items) {
+        id object = [self _objectFromItem:item];
+        if (object && item.key) objects[item.key] = object;
+    }
+    return objects;
+}
+
+- (void)objectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSDictionary<NSString *, id<NSCoding>> *objects))block {
+    [self objectsForKeys:keys priority:YYDiskCachePriorityNormal withBlock:block];
+}
+
+- (YYDiskCacheTask *)objectsForKeys:(NSArray<NSString *> *)keys
+                           priority:(YYDiskCachePriority)priority
+                          withBlock:(void(^)(NSDictionary<NSString *, id<NSCoding>> *objects))block {
+    if (!block) return nil;
+    __weak typeof(self) _self = self;
+    return [_executor addBlock:^{
+        __strong typeof(_self) self = _self;
+        NSDictionary *objects = [self objectsForKeys:keys];
+        block(objects ?: @{});
+    } priority:priority];
+}
+
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary {
+    if (dictionary.count == 0) return;
+    NSMutableArray *items = [NSMutableArray arrayWithCapacity:dictionary.count];
+    [dictionary enumerateKeysAndObjectsUsingBlock:^(NSString *key, id<NSCoding> object, BOOL *stop) {
+        YYKVStorageItem *item = [self _itemWithObject:object forKey:key];
+        if (item) [items addObject:item];
+    }];
+    if (items.count == 0) return;
+    NSArray *temporaryFilenames = [self _temporaryFilenamesForItems:items];
+    
+    Lock();
+    [self _applyPendingWrites];
+    BOOL transaction = [_kv beginTransaction];
+    for (NSUInteger i = 0; i < items.count; i++) {
+        id temporaryFilename = temporaryFilenames[i];
+        [self _saveItem:items[i] temporaryFilename:temporaryFilename == (id)kCFNull ? nil : temporaryFilename];
+    }
+    if (transaction) [_kv commitTransaction];
+    Unlock();
+}
+
+- (void)setObjectsWithDictionary:(NSDictionary<NSString *, id<NSCoding>> *)dictionary withBlock:(void(^)(void))block {
+    __weak typeof(self) _self = self;
+    [_executor addBlock:^{
+        __strong typeof(_self) self = _self;
+        NSMutableArray *items = [NSMutableArray arrayWithCapacity:dictionary.count];
+        [dictionary enumerateKeysAndObjectsUsingBlock:^(NSString *key, id<NSCoding> object, BOOL *stop) {
+            YYKVStorageItem *item = [self _itemWithObject:object forKey:key];
+            if (item) [items addObject:item];
+        }];
+        if (items.count == 0) {
+            if (block) block();
+            return;
+        }
+        NSArray *temporaryFilenames = [self _temporaryFilenamesForItems:items];
+        [self _enqueueWrite:^(YYKVStorage *kv) {
+            for (NSUInteger i = 0; i < items.count; i++) {
+                id temporaryFilename = temporaryFilenames[i];
+                [self _saveItem:items[i] temporaryFilename:temporaryFilename == (id)kCFNull ? nil : temporaryFilename];
+            }
+        } callback:block];
+    } priority:YYDiskCachePriorityNormal];
+}
+
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys {
+    if (keys.count == 0) return;
+    Lock();
+    [self _applyPendingWrites];
+    [_kv removeItemForKeys:keys];
+    Unlock();
+}
+
+- (void)removeObjectsForKeys:(NSArray<NSString *> *)keys withBlock:(void(^)(NSArray<NSString *> *keys))block {
+    if (keys.count == 0) {
+        if (block) dispatch_async(_queue, ^{ block(keys); });
+        return;
+    }
+    [self _enqueueWrite:^(YYKVStorage *kv) {
+        [kv removeItemForKeys:keys];
+    } callback:block ? ^{ block(keys); } : nil];
 }
 
 - (void)removeAllObjects {
     Lock();
+    [self _applyPendingWrites];
     [_kv removeAllItems];
     Unlock();
 }
 
 - (void)removeAllObjectsWithBlock:(void(^)(void))block {
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         [self removeAllObjects];
         if (block) block();
-    });
+    } priority:YYDiskCachePriorityLow];
 }
 
 - (void)removeAllObjectsWithProgressBlock:(void(^)(int removedCount, int totalCount))progress
                                  endBlock:(void(^)(BOOL error))end {
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         if (!self) {
             if (end) end(YES);
             return;
         }
         Lock();
-        [_kv removeAllItemsWithProgressBlock:progress endBlock:end];
+        [self _applyPendingWrites];
+        [self->_kv removeAllItemsWithProgressBlock:progress endBlock:end];
         Unlock();
-    });
+    } priority:YYDiskCachePriorityLow];
 }
 
 - (NSInteger)totalCount {
     Lock();
+    [self _applyPendingWrites];
     int count = [_kv getItemsCount];
     Unlock();
     return count;
@@ -358,15 +1625,16 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 - (void)totalCountWithBlock:(void(^)(NSInteger totalCount))block {
     if (!block) return;
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         NSInteger totalCount = [self totalCount];
         block(totalCount);
-    });
+    } priority:YYDiskCachePriorityNormal];
 }
 
 - (NSInteger)totalCost {
     Lock();
+    [self _applyPendingWrites];
     int count = [_kv getItemsSize];
     Unlock();
     return count;
@@ -375,56 +1643,59 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 - (void)totalCostWithBlock:(void(^)(NSInteger totalCost))block {
     if (!block) return;
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         NSInteger totalCost = [self totalCost];
         block(totalCost);
-    });
+    } priority:YYDiskCachePriorityNormal];
 }
 
 - (void)trimToCount:(NSUInteger)count {
     Lock();
+    [self _applyPendingWrites];
     [self _trimToCount:count];
     Unlock();
 }
 
 - (void)trimToCount:(NSUInteger)count withBlock:(void(^)(void))block {
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         [self trimToCount:count];
         if (block) block();
-    });
+    } priority:YYDiskCachePriorityLow];
 }
 
 - (void)trimToCost:(NSUInteger)cost {
     Lock();
+    [self _applyPendingWrites];
     [self _trimToCost:cost];
     Unlock();
 }
 
 - (void)trimToCost:(NSUInteger)cost withBlock:(void(^)(void))block {
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         [self trimToCost:cost];
         if (block) block();
-    });
+    } priority:YYDiskCachePriorityLow];
 }
 
 - (void)trimToAge:(NSTimeInterval)age {
     Lock();
+    [self _applyPendingWrites];
     [self _trimToAge:age];
     Unlock();
 }
 
 - (void)trimToAge:(NSTimeInterval)age withBlock:(void(^)(void))block {
     __weak typeof(self) _self = self;
-    dispatch_async(_queue, ^{
+    [_executor addBlock:^{
         __strong typeof(_self) self = _self;
         [self trimToAge:age];
         if (block) block();
-    });
+    } priority:YYDiskCachePriorityLow];
 }
 
 + (NSData *)getExtendedDataFromObject:(id)object {
@@ -444,15 +1715,179 @@ static void _YYDiskCacheSetGlobal(YYDiskCache *cache) {
 
 - (BOOL)errorLogsEnabled {
     Lock();
-    BOOL enabled = _kv.errorLogsEnabled;
+    BOOL enabled = _errorLogsEnabled;
     Unlock();
     return enabled;
 }
 
 - (void)setErrorLogsEnabled:(BOOL)errorLogsEnabled {
     Lock();
+    _errorLogsEnabled = errorLogsEnabled;
     _kv.errorLogsEnabled = errorLogsEnabled;
     Unlock();
 }
 
+- (BOOL)isOpened {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    BOOL opened = _opened;
+    dispatch_semaphore_signal(_readLock);
+    return opened;
+}
+
+- (void)waitUntilOpenedWithBlock:(void(^)(BOOL succeed, NSTimeInterval duration))block {
+    if (!block) return;
+    __weak typeof(self) _self = self;
+    dispatch_async(_queue, ^{
+        __strong typeof(_self) self = _self;
+        if (!self) return;
+        Lock();
+        BOOL succeed = self->_kv != nil;
+        NSTimeInterval duration = self->_openDuration;
+        Unlock();
+        block(succeed, duration);
+    });
+}
+
+- (BOOL)adaptiveInlineThresholdEnabled {
+    Lock();
+    BOOL enabled = _adaptiveInlineThresholdEnabled;
+    Unlock();
+    return enabled;
+}
+
+- (void)setAdaptiveInlineThresholdEnabled:(BOOL)adaptiveInlineThresholdEnabled {
+    Lock();
+    _adaptiveInlineThresholdEnabled = adaptiveInlineThresholdEnabled;
+    Unlock();
+}
+
+- (NSArray<YYDiskCacheLatencyStats *> *)latencyStats {
+    NSMutableArray *stats = [NSMutableArray arrayWithCapacity:kSizeClassCount];
+    Lock();
+    for (int i = 0; i < kSizeClassCount; i++) {
+        [stats addObject:[[YYDiskCacheLatencyStats alloc] _initWithSizeClass:&_sizeClasses[i] index:i]];
+    }
+    Unlock();
+    return stats;
+}
+
+/**
+ Runs the block under _readLock if the storage is not opened yet, the option is
+ applied in `_openStorage` later, so the caller doesn't wait for an asynchronous open.
+ Returns NO if the storage is opened, the caller should change it under _lock.
+ */
+- (BOOL)_setOptionBeforeOpened:(void (^)(void))block {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    BOOL opened = _opened;
+    if (!opened) block();
+    dispatch_semaphore_signal(_readLock);
+    return !opened;
+}
+
+- (BOOL)mappedReadEnabled {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    BOOL enabled = _mappedReadEnabled;
+    dispatch_semaphore_signal(_readLock);
+    return enabled;
+}
+
+- (void)setMappedReadEnabled:(BOOL)mappedReadEnabled {
+    if ([self _setOptionBeforeOpened:^{ self->_mappedReadEnabled = mappedReadEnabled; }]) return;
+    Lock();
+    _kv.mappedReadEnabled = mappedReadEnabled;
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    _mappedReadEnabled = mappedReadEnabled;
+    dispatch_semaphore_signal(_readLock);
+    Unlock();
+}
+
+- (BOOL)contentDedupEnabled {
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    BOOL enabled = _contentDedupEnabled;
+    dispatch_semaphore_signal(_readLock);
+    return enabled;
+}
+
+- (void)setContentDedupEnabled:(BOOL)contentDedupEnabled {
+    if ([self _setOptionBeforeOpened:^{ self->_contentDedupEnabled = contentDedupEnabled; }]) return;
+    Lock();
+    if (_kv) _kv.contentDedupEnabled = contentDedupEnabled;
+    dispatch_semaphore_wait(_readLock, DISPATCH_TIME_FOREVER);
+    _contentDedupEnabled = _kv ? _kv.contentDedupEnabled : contentDedupEnabled;
+    dispatch_semaphore_signal(_readLock);
+    Unlock();
+}
+
+- (int)deletionFilesPerSecond {
+    Lock();
+    int rate = _kv.deletionFilesPerSecond;
+    Unlock();
+    return rate;
+}
+
+- (void)setDeletionFilesPerSecond:(int)deletionFilesPerSecond {
+    Lock();
+    _kv.deletionFilesPerSecond = deletionFilesPerSecond;
+    Unlock();
+}
+
+- (int)deletionBytesPerSecond {
+    Lock();
+    int rate = _kv.deletionBytesPerSecond;
+    Unlock();
+    return rate;
+}
+
+- (void)setDeletionBytesPerSecond:(int)deletionBytesPerSecond {
+    Lock();
+    _kv.deletionBytesPerSecond = deletionBytesPerSecond;
+    Unlock();
+}
+
+- (int64_t)deletionBacklogCount {
+    return [self _storage].deletionBacklogCount;
+}
+
+- (int64_t)deletionBacklogSize {
+    return [self _storage].deletionBacklogSize;
+}
+
+- (NSUInteger)maxConcurrentOperationCount {
+    pthread_mutex_lock(&_executor->_lock);
+    NSUInteger count = _executor->_maxConcurrentCount;
+    pthread_mutex_unlock(&_executor->_lock);
+    return count;
+}
+
+- (void)setMaxConcurrentOperationCount:(NSUInteger)maxConcurrentOperationCount {
+    [_executor setMaxConcurrentCount:maxConcurrentOperationCount];
+}
+
+- (BOOL)lastInFirstOutEnabled {
+    pthread_mutex_lock(&_executor->_lock);
+    BOOL enabled = _executor->_lastInFirstOut;
+    pthread_mutex_unlock(&_executor->_lock);
+    return enabled;
+}
+
+- (void)setLastInFirstOutEnabled:(BOOL)lastInFirstOutEnabled {
+    pthread_mutex_lock(&_executor->_lock);
+    _executor->_lastInFirstOut = lastInFirstOutEnabled;
+    pthread_mutex_unlock(&_executor->_lock);
+}
+
+- (BOOL)deferredAccessTimeEnabled {
+    Lock();
+    BOOL enabled = _kv.deferredAccessTimeEnabled;
+    Unlock();
+    return enabled;
+}
+
+- (void)setDeferredAccessTimeEnabled:(BOOL)deferredAccessTimeEnabled {
+    Lock();
+    _kv.deferredAccessTimeEnabled = deferredAccessTimeEnabled;
+    if (!deferredAccessTimeEnabled) [_kv flushAccessTimes];
+    Unlock();
+}
+
 @end
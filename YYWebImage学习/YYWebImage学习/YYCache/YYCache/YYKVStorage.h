@@ -20,11 +20,12 @@ NS_ASSUME_NONNULL_BEGIN
 @interface YYKVStorageItem : NSObject
 @property (nonatomic, strong) NSString *key;                ///< key
 @property (nonatomic, strong) NSData *value;                ///< value
-@property (nullable, nonatomic, strong) NSString *filename; ///< filename (nil if inline)
+@property (nullable, nonatomic, strong) NSString *filename; ///< filename (nil if inline), or location in segment files
 @property (nonatomic) int size;                             ///< value's size in bytes
 @property (nonatomic) int modTime;                          ///< modification unix timestamp
 @property (nonatomic) int accessTime;                       ///< last access unix timestamp
 @property (nullable, nonatomic, strong) NSData *extendedData; ///< extended data (nil if no extended data)
+@property (nonatomic) int codec;                            ///< how the value is encoded, defined by the user of storage (0 if not encoded)
 @end
 
 /**
@@ -40,6 +41,8 @@ NS_ASSUME_NONNULL_BEGIN
  * If you want to store large files (such as image cache),
    use YYKVStorageTypeFile to get better performance.
  * You can use YYKVStorageTypeMixed and choice your storage type for each item.
+ * If you want to store a very large number of files, use YYKVStorageTypeSegment
+   to avoid creating a file for each item.
  
  See <http://www.sqlite.org/intern-v-extern-blob.html> for more information.
  */
@@ -53,6 +56,10 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
     
     /// The `value` is stored in file system or sqlite based on your choice.
     YYKVStorageTypeMixed = 2,
+    
+    /// The `value` is appended to a large segment file or stored in sqlite based
+    /// on your choice. The space of removed values is reclaimed by `compactSegments`.
+    YYKVStorageTypeSegment = 3,
 };
 
 
@@ -71,7 +78,9 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
  @warning The instance of this class is *NOT* thread safe, you need to make sure 
  that there's only one thread to access the instance at the same time. If you really 
  need to process large amounts of data in multi-thread, you should split the data
- to multiple KVStorage instance (sharding).
+ to multiple KVStorage instance (sharding). The only exceptions are `readItemForKey:`,
+ `itemMayExistForKey:` and `writeTemporaryFileWithValue:`, which may be called from
+ any thread at any time.
  */
 @interface YYKVStorage : NSObject
 
@@ -84,6 +93,63 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
 @property (nonatomic, readonly) YYKVStorageType type;  ///< The type of this storage.
 @property (nonatomic) BOOL errorLogsEnabled;           ///< Set `YES` to enable error logs for debug.
 
+/**
+ If `YES`, reading an item doesn't update its last access time in sqlite immediately.
+ The access times are kept in memory and written in one transaction when there are
+ too many of them, when `flushAccessTimes` is called, or before the items are removed
+ by size, count or time. Default is NO.
+ 
+ @discussion A read won't cause a sqlite write in this mode. The access times
+ which are not flushed are lost if the app crashes.
+ */
+@property (nonatomic) BOOL deferredAccessTimeEnabled;
+
+/**
+ If `YES`, the large values stored in files are read with memory mapping instead of
+ being copied into memory. Default is NO.
+ 
+ @discussion The returned data shares the file's pages with the system page cache,
+ and the pages are loaded on demand, so large values don't take twice the memory.
+ Files are written atomically in this mode, so that the mapped data is not changed
+ when the item is overwritten or removed. The values stored in sqlite are always copied.
+ */
+@property (nonatomic) BOOL mappedReadEnabled;
+
+/**
+ If `YES`, the items with the same filename share one file, and the file is deleted
+ when the last of them is removed. Default is NO.
+ 
+ @discussion The caller should name the file by a hash of the value (for example,
+ SHA-256), then the same value saved for many keys costs only one file, and the
+ file is not written again if it exists. The number of items which reference a 
+ file is kept in the manifest. Files are written atomically in this mode.
+ 
+ It only works if the `type` is YYKVStorageTypeFile or YYKVStorageTypeMixed. Once
+ it's enabled, it's kept in the manifest and can't be disabled, the storage opened
+ for the same path is always in this mode, because a shared file would be deleted
+ with one of its items otherwise. The size of a shared value is counted once for
+ each item in `getItemsSize`.
+ */
+@property (nonatomic) BOOL contentDedupEnabled;
+
+/**
+ The removed files are moved to a trash directory and deleted by a background
+ queue at a limited rate, so the deletion doesn't slow down the reads. The deletion
+ also waits a little longer when there are reads from files.
+ 
+ The maximum number of files deleted per second, 0 means no limit. Default is 256.
+ */
+@property (nonatomic) int deletionFilesPerSecond;
+
+/// The maximum bytes of files deleted per second, 0 means no limit. Default is 32MB.
+@property (nonatomic) int deletionBytesPerSecond;
+
+/// The number of files waiting to be deleted in the trash. It's thread-safe.
+@property (nonatomic, readonly) int64_t deletionBacklogCount;
+
+/// The total size in bytes of files waiting to be deleted in the trash. It's thread-safe.
+@property (nonatomic, readonly) int64_t deletionBacklogSize;
+
 #pragma mark - Initializer
 ///=============================================================================
 /// @name Initializer
@@ -113,14 +179,17 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
 /**
  Save an item or update the item with 'key' if it already exists.
  
- @discussion This method will save the item.key, item.value, item.filename and
- item.extendedData to disk or sqlite, other properties will be ignored. item.key 
+ @discussion This method will save the item.key, item.value, item.filename,
+ item.extendedData and item.codec to disk or sqlite, other properties will be ignored. item.key 
  and item.value should not be empty (nil or zero length).
  
  If the `type` is YYKVStorageTypeFile, then the item.filename should not be empty.
  If the `type` is YYKVStorageTypeSQLite, then the item.filename will be ignored.
  It the `type` is YYKVStorageTypeMixed, then the item.value will be saved to file 
  system if the item.filename is not empty, otherwise it will be saved to sqlite.
+ If the `type` is YYKVStorageTypeSegment, then the item.value will be appended to
+ segment file if the item.filename is not empty (the name itself is ignored),
+ otherwise it will be saved to sqlite.
  
  @param item  An item.
  @return Whether succeed.
@@ -147,6 +216,8 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
  If the `type` is YYKVStorageTypeSQLite, then the `filename` will be ignored.
  It the `type` is YYKVStorageTypeMixed, then the `value` will be saved to file
  system if the `filename` is not empty, otherwise it will be saved to sqlite.
+ If the `type` is YYKVStorageTypeSegment, then the `value` will be appended to
+ segment file if the `filename` is not empty, otherwise it will be saved to sqlite.
  
  @param key           The key, should not be empty (nil or zero length).
  @param value         The key, should not be empty (nil or zero length).
@@ -160,6 +231,58 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
                filename:(nullable NSString *)filename
            extendedData:(nullable NSData *)extendedData;
 
+/**
+ Write the value to a new temporary file, so the caller doesn't need to hold its
+ lock during the file I/O. The file is moved to its place by
+ `saveItem:temporaryFilename:`.
+ 
+ @discussion This method is thread-safe. It only works if the `type` is 
+ YYKVStorageTypeFile or YYKVStorageTypeMixed.
+ 
+ @param value  The value, should not be empty (nil or zero length).
+ @return The name of the temporary file, or nil if an error occurs.
+ */
+- (nullable NSString *)writeTemporaryFileWithValue:(NSData *)value;
+
+/**
+ Save an item or update the item with 'key' if it already exists. The item.value
+ has been written by `writeTemporaryFileWithValue:`, the temporary file is renamed
+ to item.filename atomically. The temporary file is removed if an error occurs.
+ 
+ @param item               An item, its filename should not be empty.
+ @param temporaryFilename  The name returned by `writeTemporaryFileWithValue:`. If it's
+     nil, this method works as `saveItem:`.
+ 
+ @return Whether succeed.
+ */
+- (BOOL)saveItem:(YYKVStorageItem *)item temporaryFilename:(nullable NSString *)temporaryFilename;
+
+/**
+ Reclaim the space of removed values in segment files. Only the segment with the
+ most dead space is compacted (if at least half of it is dead), so you may call
+ it periodically. It does nothing if the `type` is not YYKVStorageTypeSegment,
+ or inside a transaction (see `beginTransaction`).
+ 
+ @return Whether a segment is compacted.
+ */
+- (BOOL)compactSegments;
+
+/**
+ Begin a transaction, the following saves and removes are committed together by
+ `commitTransaction`, so they pay only one sqlite commit.
+ 
+ @discussion Nested transaction is not supported.
+ @return Whether succeed. If NO, the following operations are committed one by one.
+ */
+- (BOOL)beginTransaction;
+
+/**
+ Commit the transaction begun by `beginTransaction`.
+ 
+ @return Whether succeed. If NO, the transaction is rolled back.
+ */
+- (BOOL)commitTransaction;
+
 #pragma mark - Remove Items
 ///=============================================================================
 /// @name Remove Items
@@ -202,6 +325,10 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
  Remove items to make the total size not larger than a specified size.
  The least recently used (LRU) items will be removed first.
  
+ @discussion The first call loads the keys of all items into an in-memory index
+ ordered by access time, which is kept in sync with the later changes, so the
+ items to remove are found without sorting the manifest again.
+ 
  @param maxSize The specified size in bytes.
  @return Whether succeed.
  */
@@ -294,6 +421,34 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
  */
 - (nullable NSDictionary<NSString *, NSData *> *)getItemValueForKeys:(NSArray<NSString *> *)keys;
 
+/**
+ Get item with a specified key, with a read-only sqlite connection from a small pool.
+ 
+ @discussion This method is thread-safe, it can run concurrently with itself and
+ with the other methods, and it sees the committed changes only. It doesn't update 
+ the item's access time (call `updateAccessTimeForKeys:` later) and doesn't remove
+ the broken item.
+ 
+ @param key A specified key.
+ @return Item for the key, or nil if not exists / error occurs.
+ */
+- (nullable YYKVStorageItem *)readItemForKey:(NSString *)key;
+
+/**
+ Update the access time of the items to now, or defer it if `deferredAccessTimeEnabled`.
+ 
+ @param keys  An array of specified keys.
+ @return Whether succeed.
+ */
+- (BOOL)updateAccessTimeForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Write the deferred access times to sqlite in one transaction.
+ 
+ @return Whether succeed.
+ */
+- (BOOL)flushAccessTimes;
+
 #pragma mark - Get Storage Status
 ///=============================================================================
 /// @name Get Storage Status
@@ -308,6 +463,20 @@ typedef NS_ENUM(NSUInteger, YYKVStorageType) {
  */
 - (BOOL)itemExistsForKey:(NSString *)key;
 
+/**
+ Whether an item may exist for a specified key, answered by an in-memory filter of
+ the keys without sqlite.
+ 
+ @discussion This method is thread-safe. `NO` means there's no item for the key,
+ `YES` means there may be one (the filter has about 1% false positives, and it
+ always returns `YES` if the filter fails to build).
+ 
+ @param key  A specified key.
+ 
+ @return `NO` if the item doesn't exist.
+ */
+- (BOOL)itemMayExistForKey:(NSString *)key;
+
 /**
  Get total item count.
  @return Total item count, -1 when an error occurs.
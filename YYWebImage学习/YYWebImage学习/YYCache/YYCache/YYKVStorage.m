@@ -12,6 +12,12 @@
 #import "YYKVStorage.h"
 #import <UIKit/UIKit.h>
 #import <time.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
+#import <pthread.h>
+#import <libkern/OSAtomic.h>
 
 #if __has_include(<sqlite3.h>)
 #import <sqlite3.h>
@@ -28,6 +34,17 @@ static NSString *const kDBShmFileName = @"manifest.sqlite-shm";
 static NSString *const kDBWalFileName = @"manifest.sqlite-wal";
 static NSString *const kDataDirectoryName = @"data";
 static NSString *const kTrashDirectoryName = @"trash";
+static NSString *const kTempDirectoryName = @"tmp";
+static const NSUInteger kMaxKeysPerStmt = 128;
+static const NSUInteger kMaxDeferredAccessTimeCount = 256;
+static const off_t kSegmentSizeMax = 16 * 1024 * 1024;
+static const size_t kMappedReadMinSize = 16 * 1024;
+static const long kMaxReaderCount = 4;
+static const CFTimeInterval kTrashSliceInterval = 0.1;
+static const int kFileLayoutVersion = 1; // 1: data/xx/yy/filename
+static const NSUInteger kKeyFilterMinCapacity = 1024;
+static const NSUInteger kKeyFilterCountersPerKey = 10; // ~1% false positive with 7 hashes
+static const int kKeyFilterHashCount = 7;
 
 
 /*
@@ -37,8 +54,11 @@ static NSString *const kTrashDirectoryName = @"trash";
       /manifest.sqlite-shm
       /manifest.sqlite-wal
       /data/
-           /e10adc3949ba59abbe56e057f20f883e
-           /e10adc3949ba59abbe56e057f20f883e
+           /3f/a2/e10adc3949ba59abbe56e057f20f883e
+           /7c/01/e10adc3949ba59abbe56e057f20f883e
+           /segment-1 (YYKVStorageTypeSegment only)
+      /tmp/
+           /unsaved_file
       /trash/
             /unused_file_or_folder
  
@@ -51,10 +71,117 @@ static NSString *const kTrashDirectoryName = @"trash";
     modification_time   integer,
     last_access_time    integer,
     extended_data       blob,
+    codec               integer default 0,
     primary key(key)
  ); 
  create index if not exists last_access_time_idx on manifest(last_access_time);
+ create index if not exists filename_idx on manifest(filename);
+ The `codec` column (integer default 0) is added by `alter table` if the db is
+ created by an old version.
+ 
+ The total count and size of items, maintained by triggers in the same transaction:
+ create table if not exists manifest_total (
+    id                  integer,
+    count               integer,
+    size                integer,
+    primary key(id)
+ );
+ create trigger if not exists manifest_insert_trigger after insert on manifest ...
+ create trigger if not exists manifest_delete_trigger after delete on manifest ...
+ create trigger if not exists manifest_update_trigger after update of size on manifest ...
+ The `recursive_triggers` is enabled so the rows deleted by `insert or replace` fire
+ the delete trigger.
+ create temp trigger if not exists manifest_delete_count_trigger after delete on manifest ...
+ It counts the deleted rows in memory, so a save knows whether it replaced an item.
+ 
+ YYKVStorageTypeSegment only:
+ create table if not exists segment (
+    id                  integer,
+    size                integer,
+    dead_size           integer,
+    primary key(id)
+ );
+ The `filename` of an item stored in segment file is its location: "id:offset:length".
+ 
+ The files are placed in "data/xx/yy/" by the FNV-1a hash of the filename, so no
+ directory holds too many files. The `pragma user_version` is the layout version,
+ the files in the flat "data/" of an old version are moved when the db is opened.
+ 
+ Content deduplication only (`contentDedupEnabled`):
+ create table if not exists content (
+    filename            text,
+    ref_count           integer,
+    primary key(filename)
+ );
+ create index if not exists content_ref_count_idx on content(ref_count);
+ create trigger if not exists content_insert_trigger after insert on manifest ...
+ create trigger if not exists content_delete_trigger after delete on manifest ...
+ The file is deleted when its `ref_count` drops to 0.
+ 
+ A counting bloom filter of the keys in manifest is built when the db is opened, and
+ updated by the inserts and deletes, so most of the lookups for a key which doesn't
+ exist are answered without sqlite.
+ */
+
+/**
+ The number of keys bound to a multi-key statement. The keys are padded to 1, 8,
+ 32 or 128, so only a few statements are prepared and cached for each query.
  */
+static int _YYKVStorageKeyBucket(NSUInteger count) {
+    if (count <= 1) return 1;
+    if (count <= 8) return 8;
+    if (count <= 32) return 32;
+    return (int)kMaxKeysPerStmt;
+}
+
+/// FNV-1a hash of the filename, selects the fan-out directories of the file.
+static uint32_t _YYKVStorageFilenameHash(const char *filename) {
+    uint32_t hash = 2166136261U;
+    for (const unsigned char *c = (const unsigned char *)filename; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/// FNV-1a hash of the key with the MurmurHash3 finalizer, the halves make the indexes in key filter.
+static uint64_t _YYKVStorageKeyHash(NSString *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)key.UTF8String; c && *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/// The sqlite function `yy_manifest_deleted()`, it increases the counter passed as user data.
+static void _YYKVStorageManifestDeleted(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    NSUInteger *count = sqlite3_user_data(context);
+    (*count)++;
+}
+
+/// Parse the location of a value in segment files.
+static BOOL _YYKVStorageParseSegmentLocation(NSString *location, int *segment, long long *offset, int *length) {
+    if (location.length == 0) return NO;
+    return sscanf(location.UTF8String, "%d:%lld:%d", segment, offset, length) == 3 && *segment > 0 && *offset >= 0 && *length >= 0;
+}
+
+/// Map a region of the file to memory. The region is unmapped when the returned data is released.
+static NSData *_YYKVStorageMapFile(int fd, off_t offset, size_t length) {
+    if (fd < 0 || length == 0) return nil;
+    off_t start = offset - offset % getpagesize();
+    size_t delta = (size_t)(offset - start);
+    void *map = mmap(NULL, length + delta, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED) return nil;
+    return [[NSData alloc] initWithBytesNoCopy:(uint8_t *)map + delta length:length deallocator:^(void *bytes, NSUInteger len) {
+        munmap(map, len + delta);
+    }];
+}
 
 /// Returns nil in App Extension.
 static UIApplication *_YYSharedApplication() {
@@ -75,18 +202,445 @@ static UIApplication *_YYSharedApplication() {
 @implementation YYKVStorageItem
 @end
 
+
+/**
+ A read-only sqlite connection used by `readItemForKey:`.
+ */
+@interface _YYKVStorageReader : NSObject {
+    @package
+    sqlite3 *_db;
+    sqlite3_stmt *_stmt;
+    int32_t _generation;
+}
+@end
+
+@implementation _YYKVStorageReader
+- (void)dealloc {
+    if (_stmt) sqlite3_finalize(_stmt);
+    if (_db) sqlite3_close(_db);
+}
+@end
+
+
+/**
+ A node in the eviction index.
+ */
+@interface _YYKVStorageIndexNode : NSObject {
+    @package
+    __unsafe_unretained _YYKVStorageIndexNode *_prev; // retained by dic
+    __unsafe_unretained _YYKVStorageIndexNode *_next; // retained by dic
+    NSString *_key;
+    int _size;
+    int _time;
+}
+@end
+
+@implementation _YYKVStorageIndexNode
+@end
+
+
+/**
+ The keys of all items in the order of last access time, head is the oldest.
+ The items to evict are taken from head without sorting the manifest in sqlite.
+ */
+@interface _YYKVStorageIndex : NSObject {
+    @package
+    CFMutableDictionaryRef _dic; // do not set object directly
+    _YYKVStorageIndexNode *_head; // least recently used, do not change it directly
+    _YYKVStorageIndexNode *_tail; // most recently used, do not change it directly
+}
+
+/// Insert a node at tail, or update the node and move it to tail if the key exists.
+- (void)setKey:(NSString *)key size:(int)size time:(int)time;
+
+/// Move the node to tail, if the key exists.
+- (void)touchKey:(NSString *)key time:(int)time;
+
+/// Remove the node with the key, if exists.
+- (void)removeKey:(NSString *)key;
+
+/// Remove the nodes whose size is larger than `size`.
+- (void)removeNodesLargerThanSize:(int)size;
+
+/// Remove the nodes whose time is earlier than `time`.
+- (void)removeNodesEarlierThanTime:(int)time;
+
+@end
+
+@implementation _YYKVStorageIndex
+
+- (instancetype)init {
+    self = [super init];
+    _dic = CFDictionaryCreateMutable(CFAllocatorGetDefault(), 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    return self;
+}
+
+- (void)dealloc {
+    CFRelease(_dic);
+}
+
+- (void)_unlinkNode:(_YYKVStorageIndexNode *)node {
+    if (node->_prev) node->_prev->_next = node->_next;
+    if (node->_next) node->_next->_prev = node->_prev;
+    if (_head == node) _head = node->_next;
+    if (_tail == node) _tail = node->_prev;
+    node->_prev = nil;
+    node->_next = nil;
+}
+
+- (void)_appendNode:(_YYKVStorageIndexNode *)node {
+    node->_prev = _tail;
+    node->_next = nil;
+    if (_tail) _tail->_next = node;
+    _tail = node;
+    if (!_head) _head = node;
+}
+
+- (void)setKey:(NSString *)key size:(int)size time:(int)time {
+    _YYKVStorageIndexNode *node = CFDictionaryGetValue(_dic, (__bridge const void *)(key));
+    if (node) {
+        [self _unlinkNode:node];
+    } else {
+        node = [_YYKVStorageIndexNode new];
+        node->_key = key.copy;
+        CFDictionarySetValue(_dic, (__bridge const void *)(node->_key), (__bridge const void *)(node));
+    }
+    node->_size = size;
+    node->_time = time;
+    [self _appendNode:node];
+}
+
+- (void)touchKey:(NSString *)key time:(int)time {
+    _YYKVStorageIndexNode *node = CFDictionaryGetValue(_dic, (__bridge const void *)(key));
+    if (!node) return;
+    node->_time = time;
+    if (_tail == node) return;
+    [self _unlinkNode:node];
+    [self _appendNode:node];
+}
+
+- (void)removeKey:(NSString *)key {
+    _YYKVStorageIndexNode *node = CFDictionaryGetValue(_dic, (__bridge const void *)(key));
+    if (!node) return;
+    [self _unlinkNode:node];
+    CFDictionaryRemoveValue(_dic, (__bridge const void *)(key));
+}
+
+- (void)removeNodesLargerThanSize:(int)size {
+    _YYKVStorageIndexNode *node = _head;
+    while (node) {
+        _YYKVStorageIndexNode *next = node->_next;
+        if (node->_size > size) [self removeKey:node->_key];
+        node = next;
+    }
+}
+
+- (void)removeNodesEarlierThanTime:(int)time {
+    while (_head && _head->_time < time) {
+        [self removeKey:_head->_key];
+    }
+}
+
+@end
+
+
+/**
+ A counting bloom filter of keys, with 4-bit counters. A key which is not added is
+ found with a small false positive rate, and a key can be removed if it's added.
+ It's thread-safe, so the lookup doesn't wait for the storage.
+ */
+@interface _YYKVStorageFilter : NSObject {
+    @package
+    pthread_mutex_t _lock;
+    uint8_t *_counters;     // two counters per byte, NULL if not built
+    uint32_t _mask;         // number of counters - 1
+    NSUInteger _count;      // number of keys
+    NSUInteger _capacity;   // the false positive rate grows if the count exceeds it
+}
+
+/// Create an empty filter, it's not built if the capacity is 0.
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/// `NO` if the key is not added, always `YES` if the filter is not built.
+- (BOOL)mayContainKey:(NSString *)key;
+
+- (void)addKey:(NSString *)key;
+
+/// The key should be added, or the other keys may be lost.
+- (void)removeKey:(NSString *)key;
+
+/// Take the counters of another filter.
+- (void)replaceWithFilter:(_YYKVStorageFilter *)filter;
+
+/// Drop the counters, `mayContainKey:` returns `YES` until it's replaced.
+- (void)unload;
+
+/// Whether the count exceeds the capacity, it should be rebuilt larger.
+- (BOOL)isFull;
+
+/// Whether the counters are built, the removed keys should be known then.
+- (BOOL)isLoaded;
+@end
+
+@implementation _YYKVStorageFilter
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity {
+    self = [super init];
+    pthread_mutex_init(&_lock, NULL);
+    if (capacity > 0) {
+        capacity = MIN(MAX(capacity, kKeyFilterMinCapacity), (NSUInteger)(1U << 31) / kKeyFilterCountersPerKey);
+        uint32_t size = 2;
+        while (size < capacity * kKeyFilterCountersPerKey) size <<= 1;
+        _counters = calloc(size / 2, 1);
+        if (_counters) {
+            _mask = size - 1;
+            _capacity = capacity;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_counters) free(_counters);
+    pthread_mutex_destroy(&_lock);
+}
+
+- (BOOL)mayContainKey:(NSString *)key {
+    uint64_t hash = _YYKVStorageKeyHash(key);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    BOOL contains = YES;
+    pthread_mutex_lock(&_lock);
+    if (_counters) {
+        for (uint32_t i = 0; i < kKeyFilterHashCount; i++) {
+            uint32_t index = (h1 + i * h2) & _mask;
+            if (((_counters[index >> 1] >> ((index & 1) << 2)) & 0xF) == 0) {
+                contains = NO;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return contains;
+}
+
+- (void)_updateKey:(NSString *)key increase:(BOOL)increase {
+    uint64_t hash = _YYKVStorageKeyHash(key);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    pthread_mutex_lock(&_lock);
+    if (_counters) {
+        for (uint32_t i = 0; i < kKeyFilterHashCount; i++) {
+            uint32_t index = (h1 + i * h2) & _mask;
+            int shift = (index & 1) << 2;
+            int counter = (_counters[index >> 1] >> shift) & 0xF;
+            if (counter == 0xF) continue; // saturated, it's never decreased
+            if (increase) {
+                counter++;
+            } else if (counter > 0) {
+                counter--;
+            } else {
+                continue;
+            }
+            _counters[index >> 1] = (uint8_t)((_counters[index >> 1] & ~(0xF << shift)) | (counter << shift));
+        }
+        if (increase) {
+            _count++;
+        } else if (_count > 0) {
+            _count--;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)addKey:(NSString *)key {
+    [self _updateKey:key increase:YES];
+}
+
+- (void)removeKey:(NSString *)key {
+    [self _updateKey:key increase:NO];
+}
+
+- (void)replaceWithFilter:(_YYKVStorageFilter *)filter {
+    pthread_mutex_lock(&_lock);
+    if (_counters) free(_counters);
+    _counters = filter->_counters;
+    _mask = filter->_mask;
+    _count = filter->_count;
+    _capacity = filter->_capacity;
+    filter->_counters = NULL;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)unload {
+    pthread_mutex_lock(&_lock);
+    if (_counters) free(_counters);
+    _counters = NULL;
+    _count = 0;
+    _capacity = 0;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (BOOL)isFull {
+    pthread_mutex_lock(&_lock);
+    BOOL full = _counters && _count > _capacity;
+    pthread_mutex_unlock(&_lock);
+    return full;
+}
+
+- (BOOL)isLoaded {
+    pthread_mutex_lock(&_lock);
+    BOOL loaded = _counters != NULL;
+    pthread_mutex_unlock(&_lock);
+    return loaded;
+}
+
+@end
+
+
+/**
+ Deletes the files in trash directory in background, at a limited rate so the
+ deletion doesn't cause I/O latency spikes for the reads. It's thread-safe, and
+ it's retained by the deletion, so the storage can be released before it finishes.
+ */
+@interface _YYKVStorageTrash : NSObject {
+    @package
+    NSString *_path;
+    NSString *_prefix;                  // prefix of the files moved by this instance
+    dispatch_queue_t _queue;
+    volatile int32_t _scheduled;
+    volatile int64_t _counter;
+    volatile int64_t _backlogCount;     // files waiting to be deleted
+    volatile int64_t _backlogSize;
+    volatile int32_t _readCount;        // increased by the reads, the deletion yields to them
+    volatile int _filesPerSecond;       // 0 means no limit
+    volatile int _bytesPerSecond;       // 0 means no limit
+}
+
+- (instancetype)initWithPath:(NSString *)path;
+
+/// Move a file to trash, the file is deleted later by `emptyInBackground`.
+- (BOOL)moveFileAtPath:(NSString *)path;
+
+/// Delete all files in trash in background.
+- (void)emptyInBackground;
+@end
+
+@implementation _YYKVStorageTrash
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    _path = path.copy;
+    CFUUIDRef uuidRef = CFUUIDCreate(NULL);
+    _prefix = (__bridge_transfer NSString *)CFUUIDCreateString(NULL, uuidRef);
+    CFRelease(uuidRef);
+    _queue = dispatch_queue_create("com.ibireme.cache.disk.trash", DISPATCH_QUEUE_SERIAL);
+    dispatch_set_target_queue(_queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    _filesPerSecond = 256;
+    _bytesPerSecond = 32 * 1024 * 1024;
+    return self;
+}
+
+- (BOOL)moveFileAtPath:(NSString *)path {
+    struct stat st;
+    if (lstat(path.fileSystemRepresentation, &st) != 0) return NO;
+    NSString *name = [NSString stringWithFormat:@"%@-%lld", _prefix, OSAtomicIncrement64(&_counter)];
+    NSString *trashPath = [_path stringByAppendingPathComponent:name];
+    // count it first, the deletion may run before rename returns
+    OSAtomicIncrement64Barrier(&_backlogCount);
+    OSAtomicAdd64Barrier(st.st_size, &_backlogSize);
+    if (rename(path.fileSystemRepresentation, trashPath.fileSystemRepresentation) != 0) {
+        OSAtomicDecrement64Barrier(&_backlogCount);
+        OSAtomicAdd64Barrier(-st.st_size, &_backlogSize);
+        return NO;
+    }
+    [self emptyInBackground];
+    return YES;
+}
+
+- (void)emptyInBackground {
+    if (!OSAtomicCompareAndSwap32Barrier(0, 1, &_scheduled)) return;
+    dispatch_async(_queue, ^{
+        // the files moved from now on schedule another pass
+        OSAtomicCompareAndSwap32Barrier(1, 0, &self->_scheduled);
+        [self _empty];
+    });
+}
+
+- (void)_empty {
+    NSFileManager *manager = [NSFileManager new];
+    NSDirectoryEnumerator *enumerator = [manager enumeratorAtPath:_path];
+    NSMutableArray *directories = [NSMutableArray new];
+    CFAbsoluteTime sliceBegin = CFAbsoluteTimeGetCurrent();
+    int32_t readCount = _readCount;
+    int64_t sliceFiles = 0, sliceBytes = 0;
+    NSString *relativePath;
+    while ((relativePath = enumerator.nextObject)) {
+        NSDictionary *attributes = enumerator.fileAttributes;
+        NSString *path = [_path stringByAppendingPathComponent:relativePath];
+        if ([attributes.fileType isEqualToString:NSFileTypeDirectory]) {
+            [directories addObject:path];
+            continue;
+        }
+        int64_t size = (int64_t)attributes.fileSize;
+        // the files moved by `moveFileAtPath:` are counted already
+        if (enumerator.level != 1 || ![relativePath hasPrefix:_prefix]) {
+            OSAtomicIncrement64Barrier(&_backlogCount);
+            OSAtomicAdd64Barrier(size, &_backlogSize);
+        }
+        
+        int filesPerSecond = _filesPerSecond, bytesPerSecond = _bytesPerSecond;
+        if ((filesPerSecond > 0 && sliceFiles >= MAX(1, filesPerSecond * kTrashSliceInterval)) ||
+            (bytesPerSecond > 0 && sliceBytes >= MAX(1, bytesPerSecond * kTrashSliceInterval))) {
+            // the budget of this slice is used up, wait for the next one
+            CFAbsoluteTime wait = sliceBegin + kTrashSliceInterval - CFAbsoluteTimeGetCurrent();
+            if (readCount != _readCount) wait += kTrashSliceInterval; // yield a slice to the reads
+            if (wait > 0) usleep((useconds_t)(wait * USEC_PER_SEC));
+            sliceBegin = CFAbsoluteTimeGetCurrent();
+            readCount = _readCount;
+            sliceFiles = 0;
+            sliceBytes = 0;
+        }
+        unlink(path.fileSystemRepresentation);
+        sliceFiles++;
+        sliceBytes += size;
+        OSAtomicDecrement64Barrier(&_backlogCount);
+        OSAtomicAdd64Barrier(-size, &_backlogSize);
+    }
+    for (NSString *path in directories.reverseObjectEnumerator) {
+        rmdir(path.fileSystemRepresentation);
+    }
+}
+
+@end
+
+
 @implementation YYKVStorage {
-    dispatch_queue_t _trashQueue;
+    _YYKVStorageTrash *_trash;
     
     NSString *_path;
     NSString *_dbPath;
     NSString *_dataPath;
     NSString *_trashPath;
+    NSString *_tempPath;
     
     sqlite3 *_db;
     CFMutableDictionaryRef _dbStmtCache;
     NSTimeInterval _dbLastOpenErrorTime;
     NSUInteger _dbOpenErrorCount;
+    NSUInteger _dbDeleteCount; // rows deleted from manifest, increased by the temp trigger
+    
+    NSMutableDictionary *_deferredAccessTimes; // key: NSString, value: NSNumber (int timestamp)
+    
+    int _segmentFile;   // file descriptor of the segment being appended, -1 if not opened
+    int _segmentID;
+    off_t _segmentSize;
+    
+    NSMutableArray *_readers;               // idle readers, guarded by _readerLock
+    dispatch_semaphore_t _readerLock;
+    dispatch_semaphore_t _readerSemaphore;  // limits the number of readers
+    volatile int32_t _readerGeneration;     // increased when the db file is removed
+    
+    _YYKVStorageIndex *_index; // loaded at the first trim by size or count, nil if not loaded
+    _YYKVStorageFilter *_filter; // keys in manifest, built when the db is opened
 }
 
 
@@ -162,10 +716,83 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (BOOL)_dbInitialize {
-    NSString *sql = @"pragma journal_mode = wal; pragma synchronous = normal; create table if not exists manifest (key text, filename text, size integer, inline_data blob, modification_time integer, last_access_time integer, extended_data blob, primary key(key)); create index if not exists last_access_time_idx on manifest(last_access_time);";
+    NSString *sql = @"pragma journal_mode = wal; pragma synchronous = normal; pragma recursive_triggers = on; create table if not exists manifest (key text, filename text, size integer, inline_data blob, modification_time integer, last_access_time integer, extended_data blob, codec integer default 0, primary key(key)); create index if not exists last_access_time_idx on manifest(last_access_time); create index if not exists filename_idx on manifest(filename);"
+    @"create table if not exists manifest_total (id integer, count integer, size integer, primary key(id));"
+    @"create trigger if not exists manifest_insert_trigger after insert on manifest begin update manifest_total set count = count + 1, size = size + new.size where id = 0; end;"
+    @"create trigger if not exists manifest_delete_trigger after delete on manifest begin update manifest_total set count = count - 1, size = size - old.size where id = 0; end;"
+    @"create trigger if not exists manifest_update_trigger after update of size on manifest begin update manifest_total set size = size - old.size + new.size where id = 0; end;";
+    if (_type == YYKVStorageTypeSegment) {
+        sql = [sql stringByAppendingString:@"create table if not exists segment (id integer, size integer, dead_size integer, primary key(id));"];
+    }
+    // the temp trigger lives in this connection only, it's created each time the db is opened
+    sqlite3_create_function(_db, "yy_manifest_deleted", 0, SQLITE_UTF8, &_dbDeleteCount, _YYKVStorageManifestDeleted, NULL, NULL);
+    sql = [sql stringByAppendingString:@"create temp trigger if not exists manifest_delete_count_trigger after delete on manifest begin select yy_manifest_deleted(); end;"];
+    if (![self _dbExecute:sql] || ![self _dbUpgradeSchema] || ![self _dbRepairTotal]) return NO;
+    // the items saved with content dedup may share files, so the mode is kept for the db
+    if (!_contentDedupEnabled) _contentDedupEnabled = [self _dbContentExists];
+    if (_contentDedupEnabled && ![self _dbInitializeContent]) return NO;
+    return [self _fileMigrateLayout];
+}
+
+/// Whether the reference counts of files exist, they're created when content dedup is enabled.
+- (BOOL)_dbContentExists {
+    sqlite3_stmt *stmt = NULL;
+    BOOL exists = NO;
+    if (sqlite3_prepare_v2(_db, "select count(*) from sqlite_master where type = 'table' and name = 'content';", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) exists = sqlite3_column_int(stmt, 0) > 0;
+        sqlite3_finalize(stmt);
+    }
+    return exists;
+}
+
+/// Create the reference counts of files, count the existing items if it's new.
+- (BOOL)_dbInitializeContent {
+    if ([self _dbContentExists]) return YES;
+    
+    NSString *sql = @"create table if not exists content (filename text, ref_count integer, primary key(filename)); create index if not exists content_ref_count_idx on content(ref_count);"
+    @"create trigger if not exists content_insert_trigger after insert on manifest when new.filename is not null begin insert or ignore into content (filename, ref_count) values (new.filename, 0); update content set ref_count = ref_count + 1 where filename = new.filename; end;"
+    @"create trigger if not exists content_delete_trigger after delete on manifest when old.filename is not null begin update content set ref_count = ref_count - 1 where filename = old.filename; end;"
+    @"insert or replace into content (filename, ref_count) select filename, count(*) from manifest where filename is not null group by filename;";
     return [self _dbExecute:sql];
 }
 
+/// Add the columns which don't exist in the db created by an old version.
+- (BOOL)_dbUpgradeSchema {
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(_db, "select codec from manifest limit 0;", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return YES;
+    }
+    return [self _dbExecute:@"alter table manifest add column codec integer default 0;"];
+}
+
+/**
+ Rebuild the total count and size if they're missing (the db is created by an old
+ version without the triggers) or broken.
+ */
+- (BOOL)_dbRepairTotal {
+    sqlite3_stmt *stmt = NULL;
+    int result = sqlite3_prepare_v2(_db, "select count, size from manifest_total where id = 0;", -1, &stmt, NULL);
+    if (result != SQLITE_OK) return NO;
+    BOOL valid = NO;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        valid = sqlite3_column_int64(stmt, 0) >= 0 && sqlite3_column_int64(stmt, 1) >= 0;
+    }
+    sqlite3_finalize(stmt);
+    if (valid) return YES;
+    
+    if (_errorLogsEnabled) NSLog(@"%s line:%d rebuild the total count and size of manifest.", __FUNCTION__, __LINE__);
+    return [self _dbExecute:@"insert or replace into manifest_total (id, count, size) select 0, count(*), ifnull(sum(size), 0) from manifest;"];
+}
+
+/// Roll back the transaction, and reload the states which may include the changes rolled back.
+- (void)_dbRollback {
+    [self _dbExecute:@"rollback transaction;"];
+    _index = nil; // reload it
+    [self _dbLoadFilter]; // the keys removed in the transaction are back
+    [self _segmentRecoverAfterRollback];
+}
+
 - (void)_dbCheckpoint {
     if (![self _dbCheck]) return;
     // Cause a checkpoint to occur, merge `sqlite-wal` file to `sqlite` file.
@@ -202,26 +829,55 @@ static UIApplication *_YYSharedApplication() {
     return stmt;
 }
 
-- (NSString *)_dbJoinedKeys:(NSArray *)keys {
-    NSMutableString *string = [NSMutableString new];
-    for (NSUInteger i = 0,max = keys.count; i < max; i++) {
-        [string appendString:@"?"];
-        if (i + 1 != max) {
-            [string appendString:@","];
+- (NSString *)_dbJoinedKeysWithCount:(int)count {
+    static NSString *joined[4];
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        int buckets[4] = {1, 8, 32, (int)kMaxKeysPerStmt};
+        for (int b = 0; b < 4; b++) {
+            NSMutableString *string = [NSMutableString new];
+            for (int i = 0; i < buckets[b]; i++) {
+                [string appendString:@"?"];
+                if (i + 1 != buckets[b]) {
+                    [string appendString:@","];
+                }
+            }
+            joined[b] = string.copy;
         }
+    });
+    switch (count) {
+        case 1: return joined[0];
+        case 8: return joined[1];
+        case 32: return joined[2];
+        default: return joined[3];
     }
-    return string;
 }
 
-- (void)_dbBindJoinedKeys:(NSArray *)keys stmt:(sqlite3_stmt *)stmt fromIndex:(int)index{
-    for (int i = 0, max = (int)keys.count; i < max; i++) {
+/// Bind the keys and pad the rest parameters (to `count`) with NULL, which never matches a key.
+- (void)_dbBindJoinedKeys:(NSArray *)keys stmt:(sqlite3_stmt *)stmt fromIndex:(int)index count:(int)count {
+    int max = (int)keys.count;
+    for (int i = 0; i < max; i++) {
         NSString *key = keys[i];
         sqlite3_bind_text(stmt, index + i, key.UTF8String, -1, NULL);
     }
+    for (int i = max; i < count; i++) {
+        sqlite3_bind_null(stmt, index + i);
+    }
 }
 
-- (BOOL)_dbSaveWithKey:(NSString *)key value:(NSData *)value fileName:(NSString *)fileName extendedData:(NSData *)extendedData {
-    NSString *sql = @"insert or replace into manifest (key, filename, size, inline_data, modification_time, last_access_time, extended_data) values (?1, ?2, ?3, ?4, ?5, ?6, ?7);";
+/// Split the keys into chunks which can be bound to a multi-key statement.
+- (void)_dbEnumerateKeyChunks:(NSArray *)keys usingBlock:(void (^)(NSArray *chunk, int bucket, BOOL *stop))block {
+    NSUInteger count = keys.count;
+    BOOL stop = NO;
+    for (NSUInteger location = 0; location < count && !stop; location += kMaxKeysPerStmt) {
+        NSUInteger length = MIN(kMaxKeysPerStmt, count - location);
+        NSArray *chunk = (location == 0 && length == count) ? keys : [keys subarrayWithRange:NSMakeRange(location, length)];
+        block(chunk, _YYKVStorageKeyBucket(length), &stop);
+    }
+}
+
+- (BOOL)_dbSaveWithKey:(NSString *)key value:(NSData *)value fileName:(NSString *)fileName extendedData:(NSData *)extendedData codec:(int)codec {
+    NSString *sql = @"insert or replace into manifest (key, filename, size, inline_data, modification_time, last_access_time, extended_data, codec) values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return NO;
     
@@ -237,12 +893,25 @@ static UIApplication *_YYSharedApplication() {
     sqlite3_bind_int(stmt, 5, timestamp);
     sqlite3_bind_int(stmt, 6, timestamp);
     sqlite3_bind_blob(stmt, 7, extendedData.bytes, (int)extendedData.length, 0);
+    sqlite3_bind_int(stmt, 8, codec);
+    
+    // add a new key to the filter before the readers can see it, a key which may exist
+    // is added after the step if it doesn't replace an item (a false positive)
+    BOOL mayExist = [_filter mayContainKey:key];
+    if (!mayExist) [_filter addKey:key];
+    NSUInteger deleteCount = _dbDeleteCount;
     
     int result = sqlite3_step(stmt);
     if (result != SQLITE_DONE) {
         if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite insert error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        if (!mayExist) [_filter removeKey:key];
         return NO;
     }
+    BOOL newKey = !mayExist || _dbDeleteCount == deleteCount;
+    if (mayExist && newKey) [_filter addKey:key];
+    [_index setKey:key size:(int)value.length time:timestamp];
+    if (newKey && [_filter isFull]) [self _dbLoadFilter];
+    if (_contentDedupEnabled) [self _dbDeleteUnreferencedContents];
     return YES;
 }
 
@@ -250,36 +919,117 @@ static UIApplication *_YYSharedApplication() {
     NSString *sql = @"update manifest set last_access_time = ?1 where key = ?2;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return NO;
-    sqlite3_bind_int(stmt, 1, (int)time(NULL));
+    int timestamp = (int)time(NULL);
+    sqlite3_bind_int(stmt, 1, timestamp);
     sqlite3_bind_text(stmt, 2, key.UTF8String, -1, NULL);
     int result = sqlite3_step(stmt);
     if (result != SQLITE_DONE) {
         if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite update error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
         return NO;
     }
+    [_index touchKey:key time:timestamp];
     return YES;
 }
 
+- (void)_dbDeferAccessTimeWithKey:(NSString *)key {
+    if (!_deferredAccessTimes) _deferredAccessTimes = [NSMutableDictionary new];
+    int timestamp = (int)time(NULL);
+    _deferredAccessTimes[key] = @(timestamp);
+    [_index touchKey:key time:timestamp];
+    if (_deferredAccessTimes.count >= kMaxDeferredAccessTimeCount) [self _dbFlushAccessTimes];
+}
+
+- (BOOL)_dbFlushAccessTimes {
+    if (_deferredAccessTimes.count == 0) return YES;
+    if (![self _dbCheck]) return NO;
+    NSString *sql = @"update manifest set last_access_time = ?1 where key = ?2 and last_access_time < ?1;";
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+    if (!stmt) return NO;
+    
+    BOOL transaction = sqlite3_get_autocommit(_db) && [self _dbExecute:@"begin immediate transaction;"];
+    __block BOOL suc = YES;
+    [_deferredAccessTimes enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSNumber *timestamp, BOOL *stop) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, timestamp.intValue);
+        sqlite3_bind_text(stmt, 2, key.UTF8String, -1, NULL);
+        int result = sqlite3_step(stmt);
+        if (result != SQLITE_DONE) {
+            if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite update error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+            suc = NO;
+            *stop = YES;
+        }
+    }];
+    sqlite3_reset(stmt);
+    if (transaction) {
+        if (suc) suc = [self _dbExecute:@"commit transaction;"];
+        if (!suc) [self _dbExecute:@"rollback transaction;"];
+    }
+    if (suc) [_deferredAccessTimes removeAllObjects];
+    return suc;
+}
+
 - (BOOL)_dbUpdateAccessTimeWithKeys:(NSArray *)keys {
     if (![self _dbCheck]) return NO;
     int t = (int)time(NULL);
-     NSString *sql = [NSString stringWithFormat:@"update manifest set last_access_time = %d where key in (%@);", t, [self _dbJoinedKeys:keys]];
+    __block BOOL suc = YES;
+    [self _dbEnumerateKeyChunks:keys usingBlock:^(NSArray *chunk, int bucket, BOOL *stop) {
+        NSString *sql = [NSString stringWithFormat:@"update manifest set last_access_time = ?1 where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+        sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+        if (!stmt) {
+            suc = NO;
+            *stop = YES;
+            return;
+        }
+        sqlite3_bind_int(stmt, 1, t);
+        [self _dbBindJoinedKeys:chunk stmt:stmt fromIndex:2 count:bucket];
+        int result = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (result != SQLITE_DONE) {
+            if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite update error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+            suc = NO;
+            *stop = YES;
+        }
+    }];
+    if (suc && _index) {
+        for (NSString *key in keys) {
+            [_index touchKey:key time:t];
+        }
+    }
+    return suc;
+}
+
+/// Get an idle reader, or open a new one. Waits if there are too many readers.
+- (_YYKVStorageReader *)_dbReaderCheckout {
+    dispatch_semaphore_wait(_readerSemaphore, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_wait(_readerLock, DISPATCH_TIME_FOREVER);
+    _YYKVStorageReader *reader = _readers.lastObject;
+    if (reader) [_readers removeLastObject];
+    dispatch_semaphore_signal(_readerLock);
+    if (reader && reader->_generation == _readerGeneration) return reader;
     
-    sqlite3_stmt *stmt = NULL;
-    int result = sqlite3_prepare_v2(_db, sql.UTF8String, -1, &stmt, NULL);
+    reader = [_YYKVStorageReader new];
+    reader->_generation = _readerGeneration;
+    int result = sqlite3_open_v2(_dbPath.UTF8String, &reader->_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (result == SQLITE_OK) {
+        NSString *sql = @"select key, filename, size, inline_data, modification_time, last_access_time, extended_data, codec from manifest where key = ?1;";
+        result = sqlite3_prepare_v2(reader->_db, sql.UTF8String, -1, &reader->_stmt, NULL);
+    }
     if (result != SQLITE_OK) {
-        if (_errorLogsEnabled)  NSLog(@"%s line:%d sqlite stmt prepare error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return NO;
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite reader open failed (%d).", __FUNCTION__, __LINE__, result);
+        dispatch_semaphore_signal(_readerSemaphore);
+        return nil;
     }
-    
-    [self _dbBindJoinedKeys:keys stmt:stmt fromIndex:1];
-    result = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (result != SQLITE_DONE) {
-        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite update error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return NO;
+    return reader;
+}
+
+- (void)_dbReaderCheckin:(_YYKVStorageReader *)reader {
+    sqlite3_reset(reader->_stmt);
+    if (reader->_generation == _readerGeneration) {
+        dispatch_semaphore_wait(_readerLock, DISPATCH_TIME_FOREVER);
+        [_readers addObject:reader];
+        dispatch_semaphore_signal(_readerLock);
     }
-    return YES;
+    dispatch_semaphore_signal(_readerSemaphore);
 }
 
 - (BOOL)_dbDeleteItemWithKey:(NSString *)key {
@@ -293,30 +1043,56 @@ static UIApplication *_YYSharedApplication() {
         if (_errorLogsEnabled) NSLog(@"%s line:%d db delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
         return NO;
     }
+    if (sqlite3_changes(_db) > 0) [_filter removeKey:key];
+    [_index removeKey:key];
+    if (_contentDedupEnabled) [self _dbDeleteUnreferencedContents];
     return YES;
 }
 
 - (BOOL)_dbDeleteItemWithKeys:(NSArray *)keys {
     if (![self _dbCheck]) return NO;
-    NSString *sql =  [NSString stringWithFormat:@"delete from manifest where key in (%@);", [self _dbJoinedKeys:keys]];
-    sqlite3_stmt *stmt = NULL;
-    int result = sqlite3_prepare_v2(_db, sql.UTF8String, -1, &stmt, NULL);
-    if (result != SQLITE_OK) {
-        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite stmt prepare error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return NO;
-    }
-    
-    [self _dbBindJoinedKeys:keys stmt:stmt fromIndex:1];
-    result = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (result == SQLITE_ERROR) {
-        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return NO;
-    }
-    return YES;
+    BOOL filterLoaded = [_filter isLoaded];
+    if (filterLoaded) keys = [NSOrderedSet orderedSetWithArray:keys].array; // a key is removed from the filter once
+    __block BOOL suc = YES;
+    [self _dbEnumerateKeyChunks:keys usingBlock:^(NSArray *chunk, int bucket, BOOL *stop) {
+        NSArray *existingKeys = nil; // the keys to remove from the filter
+        if (filterLoaded) {
+            existingKeys = [self _dbGetExistingKeys:chunk bucket:bucket];
+            if (!existingKeys) {
+                suc = NO;
+                *stop = YES;
+                return;
+            }
+        }
+        NSString *sql = [NSString stringWithFormat:@"delete from manifest where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+        sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+        if (!stmt) {
+            suc = NO;
+            *stop = YES;
+            return;
+        }
+        [self _dbBindJoinedKeys:chunk stmt:stmt fromIndex:1 count:bucket];
+        int result = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (result == SQLITE_ERROR) {
+            if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+            suc = NO;
+            *stop = YES;
+            return;
+        }
+        for (NSString *key in existingKeys) {
+            [_filter removeKey:key];
+        }
+        for (NSString *key in chunk) {
+            [_index removeKey:key];
+        }
+    }];
+    if (_contentDedupEnabled) [self _dbDeleteUnreferencedContents];
+    return suc;
 }
 
 - (BOOL)_dbDeleteItemsWithSizeLargerThan:(int)size {
+    NSArray *keys = [self _dbGetKeysWithSql:@"select key from manifest where size > ?1;" value:size];
     NSString *sql = @"delete from manifest where size > ?1;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return NO;
@@ -326,10 +1102,14 @@ static UIApplication *_YYSharedApplication() {
         if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
         return NO;
     }
+    [self _filterRemoveKeys:keys];
+    [_index removeNodesLargerThanSize:size];
+    if (_contentDedupEnabled) [self _dbDeleteUnreferencedContents];
     return YES;
 }
 
 - (BOOL)_dbDeleteItemsWithTimeEarlierThan:(int)time {
+    NSArray *keys = [self _dbGetKeysWithSql:@"select key from manifest where last_access_time < ?1;" value:time];
     NSString *sql = @"delete from manifest where last_access_time < ?1;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return NO;
@@ -339,9 +1119,145 @@ static UIApplication *_YYSharedApplication() {
         if (_errorLogsEnabled)  NSLog(@"%s line:%d sqlite delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
         return NO;
     }
+    [self _filterRemoveKeys:keys];
+    [_index removeNodesEarlierThanTime:time];
+    if (_contentDedupEnabled) [self _dbDeleteUnreferencedContents];
+    return YES;
+}
+
+/**
+ Remove the items of the other keys with the same filename (a collision of the hashed
+ filenames), because the file is going to be overwritten.
+ 
+ @return The old filename of the key, its file should be deleted after saving if
+ it's not the same.
+ */
+- (NSString *)_dbPrepareSaveWithFilename:(NSString *)filename key:(NSString *)key {
+    NSString *oldFilename = [self _dbGetFilenameWithKey:key];
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"select key from manifest where filename = ?1 and key != ?2;"];
+    if (!stmt) return oldFilename;
+    sqlite3_bind_text(stmt, 1, filename.UTF8String, -1, NULL);
+    sqlite3_bind_text(stmt, 2, key.UTF8String, -1, NULL);
+    NSMutableArray *keys = nil;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        char *otherKey = (char *)sqlite3_column_text(stmt, 0);
+        if (!otherKey) continue;
+        if (!keys) keys = [NSMutableArray new];
+        [keys addObject:[NSString stringWithUTF8String:otherKey]];
+    }
+    sqlite3_reset(stmt);
+    for (NSString *otherKey in keys) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d filename collision: %@ (%@ and %@)", __FUNCTION__, __LINE__, filename, otherKey, key);
+        [_deferredAccessTimes removeObjectForKey:otherKey];
+        [self _dbDeleteItemWithKey:otherKey];
+    }
+    return oldFilename;
+}
+
+/// Delete the files which are no longer referenced by any item.
+- (BOOL)_dbDeleteUnreferencedContents {
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"select filename from content where ref_count <= 0;"];
+    if (!stmt) return NO;
+    NSMutableArray *filenames = nil;
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char *filename = (char *)sqlite3_column_text(stmt, 0);
+        if (!filename) continue;
+        if (!filenames) filenames = [NSMutableArray new];
+        [filenames addObject:[NSString stringWithUTF8String:filename]];
+    }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return NO;
+    }
+    if (!filenames) return YES;
+    
+    for (NSString *filename in filenames) {
+        [_trash moveFileAtPath:[self _filePathWithName:filename]];
+    }
+    stmt = [self _dbPrepareStmt:@"delete from content where ref_count <= 0;"];
+    if (!stmt) return NO;
+    result = sqlite3_step(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite delete error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return NO;
+    }
+    return YES;
+}
+
+/// Load the eviction index from sqlite if it's not loaded.
+- (BOOL)_dbLoadIndex {
+    if (_index) return YES;
+    if (![self _dbFlushAccessTimes]) return NO;
+    NSString *sql = @"select key, size, last_access_time from manifest order by last_access_time asc;";
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+    if (!stmt) return NO;
+    _YYKVStorageIndex *index = [_YYKVStorageIndex new];
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char *key = (char *)sqlite3_column_text(stmt, 0);
+        if (!key) continue;
+        [index setKey:[NSString stringWithUTF8String:key] size:sqlite3_column_int(stmt, 1) time:sqlite3_column_int(stmt, 2)];
+    }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return NO;
+    }
+    _index = index;
+    return YES;
+}
+
+/// Build the key filter from sqlite, the filter answers "maybe" for any key until it's built.
+- (BOOL)_dbLoadFilter {
+    int count = [self _dbGetTotalItemCount];
+    sqlite3_stmt *stmt = count < 0 ? NULL : [self _dbPrepareStmt:@"select key from manifest;"];
+    if (!stmt) {
+        [_filter unload];
+        return NO;
+    }
+    _YYKVStorageFilter *filter = [[_YYKVStorageFilter alloc] initWithCapacity:MAX((NSUInteger)count * 2, kKeyFilterMinCapacity)];
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char *key = (char *)sqlite3_column_text(stmt, 0);
+        if (key) [filter addKey:[NSString stringWithUTF8String:key]];
+    }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        [_filter unload];
+        return NO;
+    }
+    [_filter replaceWithFilter:filter];
     return YES;
 }
 
+/**
+ Remove the least recently used items in the eviction index until the total is
+ not larger than `limit`. Each item counts its size, or 1 if `bySize` is NO.
+ */
+- (BOOL)_removeIndexedItemsWithTotal:(int)total toLimit:(int)limit bySize:(BOOL)bySize {
+    BOOL transaction = [self beginTransaction];
+    BOOL suc = YES;
+    while (total > limit && _index->_head && suc) {
+        NSMutableArray *keys = [NSMutableArray new];
+        for (_YYKVStorageIndexNode *node = _index->_head; node && total > limit && keys.count < kMaxKeysPerStmt; node = node->_next) {
+            [keys addObject:node->_key];
+            total -= bySize ? node->_size : 1;
+        }
+        if (_type != YYKVStorageTypeSQLite) {
+            NSArray *filenames = [self _dbGetFilenameWithKeys:keys];
+            for (NSString *filename in filenames) {
+                [self _fileDeleteWithName:filename];
+            }
+        }
+        suc = [self _dbDeleteItemWithKeys:keys];
+    }
+    if (transaction) suc = [self commitTransaction] && suc;
+    return suc;
+}
+
 - (YYKVStorageItem *)_dbGetItemFromStmt:(sqlite3_stmt *)stmt excludeInlineData:(BOOL)excludeInlineData {
     int i = 0;
     char *key = (char *)sqlite3_column_text(stmt, i++);
@@ -353,6 +1269,7 @@ static UIApplication *_YYSharedApplication() {
     int last_access_time = sqlite3_column_int(stmt, i++);
     const void *extended_data = sqlite3_column_blob(stmt, i);
     int extended_data_bytes = sqlite3_column_bytes(stmt, i++);
+    int codec = sqlite3_column_int(stmt, i++);
     
     YYKVStorageItem *item = [YYKVStorageItem new];
     if (key) item.key = [NSString stringWithUTF8String:key];
@@ -362,11 +1279,12 @@ static UIApplication *_YYSharedApplication() {
     item.modTime = modification_time;
     item.accessTime = last_access_time;
     if (extended_data_bytes > 0 && extended_data) item.extendedData = [NSData dataWithBytes:extended_data length:extended_data_bytes];
+    item.codec = codec;
     return item;
 }
 
 - (YYKVStorageItem *)_dbGetItemWithKey:(NSString *)key excludeInlineData:(BOOL)excludeInlineData {
-    NSString *sql = excludeInlineData ? @"select key, filename, size, modification_time, last_access_time, extended_data from manifest where key = ?1;" : @"select key, filename, size, inline_data, modification_time, last_access_time, extended_data from manifest where key = ?1;";
+    NSString *sql = excludeInlineData ? @"select key, filename, size, modification_time, last_access_time, extended_data, codec from manifest where key = ?1;" : @"select key, filename, size, inline_data, modification_time, last_access_time, extended_data, codec from manifest where key = ?1;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return nil;
     sqlite3_bind_text(stmt, 1, key.UTF8String, -1, NULL);
@@ -376,45 +1294,47 @@ static UIApplication *_YYSharedApplication() {
     if (result == SQLITE_ROW) {
         item = [self _dbGetItemFromStmt:stmt excludeInlineData:excludeInlineData];
     } else {
-        if (result != SQLITE_DONE) {
-            if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        }
-    }
-    return item;
-}
-
-- (NSMutableArray *)_dbGetItemWithKeys:(NSArray *)keys excludeInlineData:(BOOL)excludeInlineData {
-    if (![self _dbCheck]) return nil;
-    NSString *sql;
-    if (excludeInlineData) {
-        sql = [NSString stringWithFormat:@"select key, filename, size, modification_time, last_access_time, extended_data from manifest where key in (%@);", [self _dbJoinedKeys:keys]];
-    } else {
-        sql = [NSString stringWithFormat:@"select key, filename, size, inline_data, modification_time, last_access_time, extended_data from manifest where key in (%@)", [self _dbJoinedKeys:keys]];
-    }
-    
-    sqlite3_stmt *stmt = NULL;
-    int result = sqlite3_prepare_v2(_db, sql.UTF8String, -1, &stmt, NULL);
-    if (result != SQLITE_OK) {
-        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite stmt prepare error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return nil;
-    }
-    
-    [self _dbBindJoinedKeys:keys stmt:stmt fromIndex:1];
-    NSMutableArray *items = [NSMutableArray new];
-    do {
-        result = sqlite3_step(stmt);
-        if (result == SQLITE_ROW) {
-            YYKVStorageItem *item = [self _dbGetItemFromStmt:stmt excludeInlineData:excludeInlineData];
-            if (item) [items addObject:item];
-        } else if (result == SQLITE_DONE) {
-            break;
-        } else {
+        if (result != SQLITE_DONE) {
             if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        }
+    }
+    return item;
+}
+
+- (NSMutableArray *)_dbGetItemWithKeys:(NSArray *)keys excludeInlineData:(BOOL)excludeInlineData {
+    if (![self _dbCheck]) return nil;
+    __block NSMutableArray *items = [NSMutableArray new];
+    [self _dbEnumerateKeyChunks:keys usingBlock:^(NSArray *chunk, int bucket, BOOL *stop) {
+        NSString *sql;
+        if (excludeInlineData) {
+            sql = [NSString stringWithFormat:@"select key, filename, size, modification_time, last_access_time, extended_data, codec from manifest where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+        } else {
+            sql = [NSString stringWithFormat:@"select key, filename, size, inline_data, modification_time, last_access_time, extended_data, codec from manifest where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+        }
+        sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+        if (!stmt) {
             items = nil;
-            break;
+            *stop = YES;
+            return;
         }
-    } while (1);
-    sqlite3_finalize(stmt);
+        
+        [self _dbBindJoinedKeys:chunk stmt:stmt fromIndex:1 count:bucket];
+        do {
+            int result = sqlite3_step(stmt);
+            if (result == SQLITE_ROW) {
+                YYKVStorageItem *item = [self _dbGetItemFromStmt:stmt excludeInlineData:excludeInlineData];
+                if (item) [items addObject:item];
+            } else if (result == SQLITE_DONE) {
+                break;
+            } else {
+                if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+                items = nil;
+                *stop = YES;
+                break;
+            }
+        } while (1);
+        sqlite3_reset(stmt);
+    }];
     return items;
 }
 
@@ -459,33 +1379,36 @@ static UIApplication *_YYSharedApplication() {
 
 - (NSMutableArray *)_dbGetFilenameWithKeys:(NSArray *)keys {
     if (![self _dbCheck]) return nil;
-    NSString *sql = [NSString stringWithFormat:@"select filename from manifest where key in (%@);", [self _dbJoinedKeys:keys]];
-    sqlite3_stmt *stmt = NULL;
-    int result = sqlite3_prepare_v2(_db, sql.UTF8String, -1, &stmt, NULL);
-    if (result != SQLITE_OK) {
-        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite stmt prepare error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
-        return nil;
-    }
-    
-    [self _dbBindJoinedKeys:keys stmt:stmt fromIndex:1];
-    NSMutableArray *filenames = [NSMutableArray new];
-    do {
-        result = sqlite3_step(stmt);
-        if (result == SQLITE_ROW) {
-            char *filename = (char *)sqlite3_column_text(stmt, 0);
-            if (filename && *filename != 0) {
-                NSString *name = [NSString stringWithUTF8String:filename];
-                if (name) [filenames addObject:name];
-            }
-        } else if (result == SQLITE_DONE) {
-            break;
-        } else {
-            if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+    __block NSMutableArray *filenames = [NSMutableArray new];
+    [self _dbEnumerateKeyChunks:keys usingBlock:^(NSArray *chunk, int bucket, BOOL *stop) {
+        NSString *sql = [NSString stringWithFormat:@"select filename from manifest where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+        sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+        if (!stmt) {
             filenames = nil;
-            break;
+            *stop = YES;
+            return;
         }
-    } while (1);
-    sqlite3_finalize(stmt);
+        
+        [self _dbBindJoinedKeys:chunk stmt:stmt fromIndex:1 count:bucket];
+        do {
+            int result = sqlite3_step(stmt);
+            if (result == SQLITE_ROW) {
+                char *filename = (char *)sqlite3_column_text(stmt, 0);
+                if (filename && *filename != 0) {
+                    NSString *name = [NSString stringWithUTF8String:filename];
+                    if (name) [filenames addObject:name];
+                }
+            } else if (result == SQLITE_DONE) {
+                break;
+            } else {
+                if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+                filenames = nil;
+                *stop = YES;
+                break;
+            }
+        } while (1);
+        sqlite3_reset(stmt);
+    }];
     return filenames;
 }
 
@@ -570,6 +1493,48 @@ static UIApplication *_YYSharedApplication() {
     return items;
 }
 
+/// The keys of the items to delete by a query with an int parameter, nil if the filter is not built or an error occurs.
+- (NSMutableArray *)_dbGetKeysWithSql:(NSString *)sql value:(int)value {
+    if (![_filter isLoaded]) return nil;
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+    if (!stmt) return nil;
+    sqlite3_bind_int(stmt, 1, value);
+    
+    NSMutableArray *keys = [NSMutableArray new];
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char *key = (char *)sqlite3_column_text(stmt, 0);
+        if (key) [keys addObject:[NSString stringWithUTF8String:key]];
+    }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return nil;
+    }
+    return keys;
+}
+
+/// The keys of a chunk which exist in manifest, nil if an error occurs.
+- (NSMutableArray *)_dbGetExistingKeys:(NSArray *)chunk bucket:(int)bucket {
+    NSString *sql = [NSString stringWithFormat:@"select key from manifest where key in (%@);", [self _dbJoinedKeysWithCount:bucket]];
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
+    if (!stmt) return nil;
+    [self _dbBindJoinedKeys:chunk stmt:stmt fromIndex:1 count:bucket];
+    
+    NSMutableArray *keys = [NSMutableArray new];
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char *key = (char *)sqlite3_column_text(stmt, 0);
+        if (key) [keys addObject:[NSString stringWithUTF8String:key]];
+    }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return nil;
+    }
+    return keys;
+}
+
 - (int)_dbGetItemCountWithKey:(NSString *)key {
     NSString *sql = @"select count(key) from manifest where key = ?1;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
@@ -584,7 +1549,7 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (int)_dbGetTotalItemSize {
-    NSString *sql = @"select sum(size) from manifest;";
+    NSString *sql = @"select size from manifest_total where id = 0;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return -1;
     int result = sqlite3_step(stmt);
@@ -596,7 +1561,7 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (int)_dbGetTotalItemCount {
-    NSString *sql = @"select count(*) from manifest;";
+    NSString *sql = @"select count from manifest_total where id = 0;";
     sqlite3_stmt *stmt = [self _dbPrepareStmt:sql];
     if (!stmt) return -1;
     int result = sqlite3_step(stmt);
@@ -608,22 +1573,343 @@ static UIApplication *_YYSharedApplication() {
 }
 
 
+#pragma mark - segment
+
+- (NSString *)_segmentPathWithID:(int)segment {
+    return [_dataPath stringByAppendingPathComponent:[NSString stringWithFormat:@"segment-%d", segment]];
+}
+
+- (void)_segmentClose {
+    if (_segmentFile >= 0) close(_segmentFile);
+    _segmentFile = -1;
+    _segmentID = 0;
+    _segmentSize = 0;
+}
+
+/// Open the last segment file to append, or create a new one if it's full.
+- (BOOL)_segmentOpen {
+    if (_segmentFile >= 0 && _segmentSize < kSegmentSizeMax) return YES;
+    [self _segmentClose];
+    
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"select ifnull(max(id), 0) from segment;"];
+    if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) return NO;
+    int segment = sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+    
+    if (segment > 0) {
+        int fd = open([self _segmentPathWithID:segment].fileSystemRepresentation, O_WRONLY | O_APPEND);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size < kSegmentSizeMax) {
+            _segmentFile = fd;
+            _segmentID = segment;
+            _segmentSize = st.st_size;
+            return YES;
+        }
+        if (fd >= 0) close(fd);
+    }
+    
+    segment++;
+    stmt = [self _dbPrepareStmt:@"insert or replace into segment (id, size, dead_size) values (?1, 0, 0);"];
+    if (!stmt) return NO;
+    sqlite3_bind_int(stmt, 1, segment);
+    int result = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite insert error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(_db));
+        return NO;
+    }
+    int fd = open([self _segmentPathWithID:segment].fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NO;
+    _segmentFile = fd;
+    _segmentID = segment;
+    _segmentSize = 0;
+    return YES;
+}
+
+/// Append the data to segment file, returns the location, or nil if an error occurs.
+- (NSString *)_segmentAppendData:(NSData *)data {
+    if (data.length > INT_MAX || ![self _segmentOpen]) return nil;
+    off_t offset = _segmentSize;
+    const uint8_t *bytes = data.bytes;
+    size_t left = data.length;
+    while (left > 0) {
+        ssize_t written = write(_segmentFile, bytes, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            ftruncate(_segmentFile, offset);
+            [self _segmentClose];
+            return nil;
+        }
+        bytes += written;
+        left -= written;
+    }
+    _segmentSize += data.length;
+    
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"update segment set size = ?1 where id = ?2;"];
+    if (stmt) {
+        sqlite3_bind_int64(stmt, 1, _segmentSize);
+        sqlite3_bind_int(stmt, 2, _segmentID);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    return [NSString stringWithFormat:@"%d:%lld:%d", _segmentID, (long long)offset, (int)data.length];
+}
+
+- (NSData *)_segmentReadWithLocation:(NSString *)location {
+    int segment, length;
+    long long offset;
+    if (!_YYKVStorageParseSegmentLocation(location, &segment, &offset, &length)) return nil;
+    int fd = open([self _segmentPathWithID:segment].fileSystemRepresentation, O_RDONLY);
+    if (fd < 0) return nil;
+    if (_mappedReadEnabled && length >= kMappedReadMinSize) {
+        NSData *data = _YYKVStorageMapFile(fd, offset, length);
+        close(fd); // the mapping is still valid after the file is closed
+        return data;
+    }
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    size_t read = 0;
+    while (read < (size_t)length) {
+        ssize_t result = pread(fd, bytes + read, length - read, offset + read);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) {
+            data = nil;
+            break;
+        }
+        read += result;
+    }
+    close(fd);
+    return data;
+}
+
+/// Mark the value's space as dead, it will be reclaimed by compaction.
+- (BOOL)_segmentDeleteWithLocation:(NSString *)location {
+    int segment, length;
+    long long offset;
+    if (!_YYKVStorageParseSegmentLocation(location, &segment, &offset, &length)) return NO;
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"update segment set dead_size = dead_size + ?1 where id = ?2;"];
+    if (!stmt) return NO;
+    sqlite3_bind_int(stmt, 1, length);
+    sqlite3_bind_int(stmt, 2, segment);
+    int result = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return result == SQLITE_DONE;
+}
+
+/**
+ The values appended in a rolled back transaction are still in the segment files,
+ count them as dead space so they're reclaimed by compaction. The segment files
+ created in the transaction have no row, they're moved to trash.
+ */
+- (void)_segmentRecoverAfterRollback {
+    if (_type != YYKVStorageTypeSegment) return;
+    [self _segmentClose];
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"select id, size from segment;"];
+    if (!stmt) return;
+    NSMutableDictionary *sizes = [NSMutableDictionary new];
+    int maxID = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int segment = sqlite3_column_int(stmt, 0);
+        sizes[@(segment)] = @(sqlite3_column_int64(stmt, 1));
+        maxID = MAX(maxID, segment);
+    }
+    sqlite3_reset(stmt);
+    
+    [sizes enumerateKeysAndObjectsUsingBlock:^(NSNumber *segment, NSNumber *size, BOOL *stop) {
+        struct stat st;
+        if (stat([self _segmentPathWithID:segment.intValue].fileSystemRepresentation, &st) != 0) return;
+        if (st.st_size <= size.longLongValue) return;
+        sqlite3_stmt *update = [self _dbPrepareStmt:@"update segment set size = ?1, dead_size = dead_size + ?1 - size where id = ?2;"];
+        if (!update) return;
+        sqlite3_bind_int64(update, 1, st.st_size);
+        sqlite3_bind_int(update, 2, segment.intValue);
+        sqlite3_step(update);
+        sqlite3_reset(update);
+    }];
+    for (int segment = maxID + 1; [_trash moveFileAtPath:[self _segmentPathWithID:segment]]; segment++);
+}
+
+/// Move the live values of the segment with the most dead space to the active
+/// segment, and delete the old segment file.
+- (BOOL)_segmentCompact {
+    // the old segment can be deleted only after the moved values are committed,
+    // so it's not compacted inside the caller's transaction
+    if (!sqlite3_get_autocommit(_db)) return NO;
+    // open the segment to append first, or the last segment may be compacted into itself
+    if (![self _segmentOpen]) return NO;
+    sqlite3_stmt *stmt = [self _dbPrepareStmt:@"select id, size, dead_size from segment where id != ?1 and dead_size * 2 >= size order by dead_size desc limit 1;"];
+    if (!stmt) return NO;
+    sqlite3_bind_int(stmt, 1, _segmentID);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_reset(stmt);
+        return NO;
+    }
+    int segment = sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+    
+    // the locations are "id:offset:length", a range (instead of `like`) can use the filename index
+    stmt = [self _dbPrepareStmt:@"select key, filename from manifest where filename >= ?1 and filename < ?2;"];
+    if (!stmt) return NO;
+    NSString *begin = [NSString stringWithFormat:@"%d:", segment];
+    NSString *end = [NSString stringWithFormat:@"%d;", segment];
+    sqlite3_bind_text(stmt, 1, begin.UTF8String, -1, NULL);
+    sqlite3_bind_text(stmt, 2, end.UTF8String, -1, NULL);
+    NSMutableArray *keys = [NSMutableArray new];
+    NSMutableArray *locations = [NSMutableArray new];
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        char *key = (char *)sqlite3_column_text(stmt, 0);
+        char *filename = (char *)sqlite3_column_text(stmt, 1);
+        if (!key || !filename) continue;
+        [keys addObject:[NSString stringWithUTF8String:key]];
+        [locations addObject:[NSString stringWithUTF8String:filename]];
+    }
+    sqlite3_reset(stmt);
+    
+    if (![self beginTransaction]) return NO;
+    BOOL suc = YES;
+    for (NSUInteger i = 0; i < keys.count && suc; i++) {
+        NSData *data = [self _segmentReadWithLocation:locations[i]];
+        if (!data) { // broken value, drop it
+            suc = [self _dbDeleteItemWithKey:keys[i]];
+            continue;
+        }
+        NSString *location = [self _segmentAppendData:data];
+        if (!location) {
+            suc = NO;
+            break;
+        }
+        stmt = [self _dbPrepareStmt:@"update manifest set filename = ?1 where key = ?2;"];
+        if (!stmt) {
+            suc = NO;
+            break;
+        }
+        sqlite3_bind_text(stmt, 1, location.UTF8String, -1, NULL);
+        sqlite3_bind_text(stmt, 2, [keys[i] UTF8String], -1, NULL);
+        suc = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    if (suc) {
+        stmt = [self _dbPrepareStmt:@"delete from segment where id = ?1;"];
+        if (stmt) {
+            sqlite3_bind_int(stmt, 1, segment);
+            suc = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        } else {
+            suc = NO;
+        }
+    }
+    if (suc) suc = [self commitTransaction];
+    else [self _dbRollback];
+    if (suc) {
+        [_trash moveFileAtPath:[self _segmentPathWithID:segment]];
+    } else if (_errorLogsEnabled) {
+        NSLog(@"%s line:%d segment compaction failed: %d", __FUNCTION__, __LINE__, segment);
+    }
+    return suc;
+}
+
+
 #pragma mark - file
 
+- (NSString *)_filePathWithName:(NSString *)filename {
+    uint32_t hash = _YYKVStorageFilenameHash(filename.UTF8String);
+    return [_dataPath stringByAppendingFormat:@"/%02x/%02x/%@", hash & 0xFF, (hash >> 8) & 0xFF, filename];
+}
+
+/// Create the fan-out directories of the file.
+- (BOOL)_fileCreateDirectoryForPath:(NSString *)path {
+    return [[NSFileManager defaultManager] createDirectoryAtPath:path.stringByDeletingLastPathComponent
+                                     withIntermediateDirectories:YES
+                                                      attributes:nil
+                                                           error:NULL];
+}
+
 - (BOOL)_fileWriteWithName:(NSString *)filename data:(NSData *)data {
-    NSString *path = [_dataPath stringByAppendingPathComponent:filename];
-    return [data writeToFile:path atomically:NO];
+    NSString *path = [self _filePathWithName:filename];
+    BOOL atomically = _mappedReadEnabled || _contentDedupEnabled;
+    if ([data writeToFile:path atomically:atomically]) return YES;
+    return [self _fileCreateDirectoryForPath:path] && [data writeToFile:path atomically:atomically];
+}
+
+/// Whether the file with the same content exists, so it doesn't need to be written again.
+- (BOOL)_fileExistsWithName:(NSString *)filename {
+    NSString *path = [self _filePathWithName:filename];
+    return access(path.fileSystemRepresentation, F_OK) == 0;
 }
 
 - (NSData *)_fileReadWithName:(NSString *)filename {
-    NSString *path = [_dataPath stringByAppendingPathComponent:filename];
+    OSAtomicIncrement32(&_trash->_readCount);
+    if (_type == YYKVStorageTypeSegment) return [self _segmentReadWithLocation:filename];
+    NSString *path = [self _filePathWithName:filename];
+    if (_mappedReadEnabled) {
+        int fd = open(path.fileSystemRepresentation, O_RDONLY);
+        if (fd < 0) return nil;
+        NSData *data = nil;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)kMappedReadMinSize) {
+            data = _YYKVStorageMapFile(fd, 0, (size_t)st.st_size);
+        }
+        close(fd);
+        if (data) return data;
+    }
     NSData *data = [NSData dataWithContentsOfFile:path];
     return data;
 }
 
 - (BOOL)_fileDeleteWithName:(NSString *)filename {
-    NSString *path = [_dataPath stringByAppendingPathComponent:filename];
-    return [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    if (_type == YYKVStorageTypeSegment) return [self _segmentDeleteWithLocation:filename];
+    if (_contentDedupEnabled) return YES; // deleted by `_dbDeleteUnreferencedContents` when not referenced
+    NSString *path = [self _filePathWithName:filename];
+    return [_trash moveFileAtPath:path];
+}
+
+- (NSString *)_fileWriteTemporaryWithData:(NSData *)data {
+    CFUUIDRef uuidRef = CFUUIDCreate(NULL);
+    NSString *filename = (__bridge_transfer NSString *)CFUUIDCreateString(NULL, uuidRef);
+    CFRelease(uuidRef);
+    NSString *path = [_tempPath stringByAppendingPathComponent:filename];
+    return [data writeToFile:path atomically:NO] ? filename : nil;
+}
+
+- (BOOL)_fileMoveTemporaryWithName:(NSString *)temporaryFilename toName:(NSString *)filename {
+    NSString *from = [_tempPath stringByAppendingPathComponent:temporaryFilename];
+    NSString *to = [self _filePathWithName:filename];
+    if (rename(from.fileSystemRepresentation, to.fileSystemRepresentation) == 0) return YES;
+    if (errno == ENOENT && [self _fileCreateDirectoryForPath:to] &&
+        rename(from.fileSystemRepresentation, to.fileSystemRepresentation) == 0) return YES;
+    unlink(from.fileSystemRepresentation);
+    return NO;
+}
+
+/// Move the files in the flat "data/" of an old version to the fan-out directories.
+- (BOOL)_fileMigrateLayout {
+    if (_type != YYKVStorageTypeFile && _type != YYKVStorageTypeMixed) return YES;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(_db, "pragma user_version;", -1, &stmt, NULL) != SQLITE_OK) return NO;
+    int version = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    if (version >= kFileLayoutVersion) return YES;
+    
+    NSArray *names = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_dataPath error:NULL];
+    int moved = 0, failed = 0;
+    for (NSString *name in names) {
+        NSString *from = [_dataPath stringByAppendingPathComponent:name];
+        struct stat st;
+        if (lstat(from.fileSystemRepresentation, &st) != 0 || !S_ISREG(st.st_mode)) continue; // fan-out directory
+        NSString *to = [self _filePathWithName:name];
+        if (rename(from.fileSystemRepresentation, to.fileSystemRepresentation) == 0 ||
+            ([self _fileCreateDirectoryForPath:to] && rename(from.fileSystemRepresentation, to.fileSystemRepresentation) == 0)) {
+            moved++;
+        } else {
+            failed++;
+        }
+    }
+    if (failed) {
+        // the version is not raised, so the rest are moved at next open
+        if (_errorLogsEnabled) NSLog(@"%s line:%d fail to move %d files (%d moved).", __FUNCTION__, __LINE__, failed, moved);
+        return YES;
+    }
+    return [self _dbExecute:[NSString stringWithFormat:@"pragma user_version = %d;", kFileLayoutVersion]];
 }
 
 - (BOOL)_fileMoveAllToTrash {
@@ -639,17 +1925,20 @@ static UIApplication *_YYSharedApplication() {
     return suc;
 }
 
+/// Move the temporary files left by last launch to trash.
+- (BOOL)_fileMoveTemporaryFilesToTrash {
+    if (![[NSFileManager defaultManager] fileExistsAtPath:_tempPath]) return YES;
+    CFUUIDRef uuidRef = CFUUIDCreate(NULL);
+    CFStringRef uuid = CFUUIDCreateString(NULL, uuidRef);
+    CFRelease(uuidRef);
+    NSString *tmpPath = [_trashPath stringByAppendingPathComponent:(__bridge NSString *)(uuid)];
+    BOOL suc = [[NSFileManager defaultManager] moveItemAtPath:_tempPath toPath:tmpPath error:nil];
+    CFRelease(uuid);
+    return suc;
+}
+
 - (void)_fileEmptyTrashInBackground {
-    NSString *trashPath = _trashPath;
-    dispatch_queue_t queue = _trashQueue;
-    dispatch_async(queue, ^{
-        NSFileManager *manager = [NSFileManager new];
-        NSArray *directoryContents = [manager contentsOfDirectoryAtPath:trashPath error:NULL];
-        for (NSString *path in directoryContents) {
-            NSString *fullPath = [trashPath stringByAppendingPathComponent:path];
-            [manager removeItemAtPath:fullPath error:NULL];
-        }
-    });
+    [_trash emptyInBackground];
 }
 
 
@@ -660,13 +1949,36 @@ static UIApplication *_YYSharedApplication() {
  Make sure the db is closed.
  */
 - (void)_reset {
+    [self _segmentClose];
+    _index = nil;
+    [_filter unload];
     [[NSFileManager defaultManager] removeItemAtPath:[_path stringByAppendingPathComponent:kDBFileName] error:nil];
     [[NSFileManager defaultManager] removeItemAtPath:[_path stringByAppendingPathComponent:kDBShmFileName] error:nil];
     [[NSFileManager defaultManager] removeItemAtPath:[_path stringByAppendingPathComponent:kDBWalFileName] error:nil];
+    OSAtomicIncrement32Barrier(&_readerGeneration);
     [self _fileMoveAllToTrash];
     [self _fileEmptyTrashInBackground];
 }
 
+/// Remove the keys of the items just deleted from the filter, rebuild it if the keys are unknown.
+- (void)_filterRemoveKeys:(NSArray *)keys {
+    if (keys) {
+        for (NSString *key in keys) {
+            [_filter removeKey:key];
+        }
+    } else if (sqlite3_changes(_db) > 0) {
+        [self _dbLoadFilter];
+    }
+}
+
+- (void)_updateAccessTimeWithKey:(NSString *)key {
+    if (_deferredAccessTimeEnabled) {
+        [self _dbDeferAccessTimeWithKey:key];
+    } else {
+        [self _dbUpdateAccessTimeWithKey:key];
+    }
+}
+
 #pragma mark - public
 
 - (instancetype)init {
@@ -679,7 +1991,7 @@ static UIApplication *_YYSharedApplication() {
         NSLog(@"YYKVStorage init error: invalid path: [%@].", path);
         return nil;
     }
-    if (type > YYKVStorageTypeMixed) {
+    if (type > YYKVStorageTypeSegment) {
         NSLog(@"YYKVStorage init error: invalid type: %lu.", (unsigned long)type);
         return nil;
     }
@@ -687,9 +1999,15 @@ static UIApplication *_YYSharedApplication() {
     self = [super init];
     _path = path.copy;
     _type = type;
+    _segmentFile = -1;
     _dataPath = [path stringByAppendingPathComponent:kDataDirectoryName];
     _trashPath = [path stringByAppendingPathComponent:kTrashDirectoryName];
-    _trashQueue = dispatch_queue_create("com.ibireme.cache.disk.trash", DISPATCH_QUEUE_SERIAL);
+    _tempPath = [path stringByAppendingPathComponent:kTempDirectoryName];
+    _readers = [NSMutableArray new];
+    _readerLock = dispatch_semaphore_create(1);
+    _readerSemaphore = dispatch_semaphore_create(kMaxReaderCount);
+    _trash = [[_YYKVStorageTrash alloc] initWithPath:_trashPath];
+    _filter = [[_YYKVStorageFilter alloc] initWithCapacity:0];
     _dbPath = [path stringByAppendingPathComponent:kDBFileName];
     _errorLogsEnabled = YES;
     NSError *error = nil;
@@ -702,6 +2020,11 @@ static UIApplication *_YYSharedApplication() {
                                                     attributes:nil
                                                          error:&error] ||
         ![[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:kTrashDirectoryName]
+                                   withIntermediateDirectories:YES
+                                                    attributes:nil
+                                                         error:&error] ||
+        ![self _fileMoveTemporaryFilesToTrash] ||
+        ![[NSFileManager defaultManager] createDirectoryAtPath:_tempPath
                                    withIntermediateDirectories:YES
                                                     attributes:nil
                                                          error:&error]) {
@@ -719,12 +2042,15 @@ static UIApplication *_YYSharedApplication() {
         }
         return nil;
     }
+    [self _dbLoadFilter];
     [self _fileEmptyTrashInBackground]; // empty the trash if failed at last time
     return self;
 }
 
 - (void)dealloc {
     UIBackgroundTaskIdentifier taskID = [_YYSharedApplication() beginBackgroundTaskWithExpirationHandler:^{}];
+    [self _dbFlushAccessTimes];
+    [self _segmentClose];
     [self _dbClose];
     if (taskID != UIBackgroundTaskInvalid) {
         [_YYSharedApplication() endBackgroundTask:taskID];
@@ -732,7 +2058,7 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (BOOL)saveItem:(YYKVStorageItem *)item {
-    return [self saveItemWithKey:item.key value:item.value filename:item.filename extendedData:item.extendedData];
+    return [self saveItem:item temporaryFilename:nil];
 }
 
 - (BOOL)saveItemWithKey:(NSString *)key value:(NSData *)value {
@@ -740,19 +2066,42 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (BOOL)saveItemWithKey:(NSString *)key value:(NSData *)value filename:(NSString *)filename extendedData:(NSData *)extendedData {
+    return [self _saveItemWithKey:key value:value filename:filename extendedData:extendedData codec:0];
+}
+
+- (BOOL)_saveItemWithKey:(NSString *)key value:(NSData *)value filename:(NSString *)filename extendedData:(NSData *)extendedData codec:(int)codec {
     if (key.length == 0 || value.length == 0) return NO;
     if (_type == YYKVStorageTypeFile && filename.length == 0) {
         return NO;
     }
+    [_deferredAccessTimes removeObjectForKey:key];
+    
+    if (_type == YYKVStorageTypeSegment) {
+        NSString *oldLocation = [self _dbGetFilenameWithKey:key];
+        NSString *location = nil;
+        if (filename.length) {
+            location = [self _segmentAppendData:value];
+            if (!location) return NO;
+        }
+        if (![self _dbSaveWithKey:key value:value fileName:location extendedData:extendedData codec:codec]) {
+            if (location) [self _segmentDeleteWithLocation:location];
+            return NO;
+        }
+        if (oldLocation) [self _segmentDeleteWithLocation:oldLocation];
+        return YES;
+    }
     
     if (filename.length) {
-        if (![self _fileWriteWithName:filename data:value]) {
+        BOOL shared = _contentDedupEnabled && [self _fileExistsWithName:filename];
+        NSString *oldFilename = _contentDedupEnabled ? nil : [self _dbPrepareSaveWithFilename:filename key:key];
+        if (!shared && ![self _fileWriteWithName:filename data:value]) {
             return NO;
         }
-        if (![self _dbSaveWithKey:key value:value fileName:filename extendedData:extendedData]) {
-            [self _fileDeleteWithName:filename];
+        if (![self _dbSaveWithKey:key value:value fileName:filename extendedData:extendedData codec:codec]) {
+            if (!shared) unlink([self _filePathWithName:filename].fileSystemRepresentation);
             return NO;
         }
+        if (oldFilename && ![oldFilename isEqualToString:filename]) [self _fileDeleteWithName:oldFilename];
         return YES;
     } else {
         if (_type != YYKVStorageTypeSQLite) {
@@ -761,18 +2110,103 @@ static UIApplication *_YYSharedApplication() {
                 [self _fileDeleteWithName:filename];
             }
         }
-        return [self _dbSaveWithKey:key value:value fileName:nil extendedData:extendedData];
+        return [self _dbSaveWithKey:key value:value fileName:nil extendedData:extendedData codec:codec];
+    }
+}
+
+- (NSString *)writeTemporaryFileWithValue:(NSData *)value {
+    if (value.length == 0) return nil;
+    if (_type != YYKVStorageTypeFile && _type != YYKVStorageTypeMixed) return nil;
+    return [self _fileWriteTemporaryWithData:value];
+}
+
+- (BOOL)saveItem:(YYKVStorageItem *)item temporaryFilename:(NSString *)temporaryFilename {
+    NSString *key = item.key, *filename = item.filename;
+    NSData *value = item.value;
+    if (!temporaryFilename) return [self _saveItemWithKey:key value:value filename:filename extendedData:item.extendedData codec:item.codec];
+    if (key.length == 0 || value.length == 0 || filename.length == 0 ||
+        (_type != YYKVStorageTypeFile && _type != YYKVStorageTypeMixed)) {
+        unlink([_tempPath stringByAppendingPathComponent:temporaryFilename].fileSystemRepresentation);
+        return NO;
+    }
+    [_deferredAccessTimes removeObjectForKey:key];
+    
+    BOOL shared = _contentDedupEnabled && [self _fileExistsWithName:filename];
+    NSString *oldFilename = _contentDedupEnabled ? nil : [self _dbPrepareSaveWithFilename:filename key:key];
+    if (shared) {
+        unlink([_tempPath stringByAppendingPathComponent:temporaryFilename].fileSystemRepresentation);
+    } else if (![self _fileMoveTemporaryWithName:temporaryFilename toName:filename]) {
+        return NO;
     }
+    if (![self _dbSaveWithKey:key value:value fileName:filename extendedData:item.extendedData codec:item.codec]) {
+        if (!shared) unlink([self _filePathWithName:filename].fileSystemRepresentation);
+        return NO;
+    }
+    if (oldFilename && ![oldFilename isEqualToString:filename]) [self _fileDeleteWithName:oldFilename];
+    return YES;
+}
+
+- (void)setContentDedupEnabled:(BOOL)contentDedupEnabled {
+    // it can't be disabled, a shared file would be deleted with one of its items
+    if (!contentDedupEnabled || _contentDedupEnabled) return;
+    if (_type != YYKVStorageTypeFile && _type != YYKVStorageTypeMixed) return;
+    if (![self _dbCheck] || ![self _dbInitializeContent]) return;
+    _contentDedupEnabled = YES;
+}
+
+- (int)deletionFilesPerSecond {
+    return _trash->_filesPerSecond;
+}
+
+- (void)setDeletionFilesPerSecond:(int)deletionFilesPerSecond {
+    _trash->_filesPerSecond = MAX(deletionFilesPerSecond, 0);
+}
+
+- (int)deletionBytesPerSecond {
+    return _trash->_bytesPerSecond;
+}
+
+- (void)setDeletionBytesPerSecond:(int)deletionBytesPerSecond {
+    _trash->_bytesPerSecond = MAX(deletionBytesPerSecond, 0);
+}
+
+- (int64_t)deletionBacklogCount {
+    return MAX(_trash->_backlogCount, 0);
+}
+
+- (int64_t)deletionBacklogSize {
+    return MAX(_trash->_backlogSize, 0);
+}
+
+- (BOOL)compactSegments {
+    if (_type != YYKVStorageTypeSegment) return NO;
+    if (![self _dbCheck]) return NO;
+    return [self _segmentCompact];
+}
+
+- (BOOL)beginTransaction {
+    if (![self _dbCheck]) return NO;
+    if (!sqlite3_get_autocommit(_db)) return NO; // already in a transaction
+    return [self _dbExecute:@"begin immediate transaction;"];
+}
+
+- (BOOL)commitTransaction {
+    if (!_db || sqlite3_get_autocommit(_db)) return NO;
+    if ([self _dbExecute:@"commit transaction;"]) return YES;
+    [self _dbRollback];
+    return NO;
 }
 
 - (BOOL)removeItemForKey:(NSString *)key {
     if (key.length == 0) return NO;
+    [_deferredAccessTimes removeObjectForKey:key];
     switch (_type) {
         case YYKVStorageTypeSQLite: {
             return [self _dbDeleteItemWithKey:key];
         } break;
         case YYKVStorageTypeFile:
-        case YYKVStorageTypeMixed: {
+        case YYKVStorageTypeMixed:
+        case YYKVStorageTypeSegment: {
             NSString *filename = [self _dbGetFilenameWithKey:key];
             if (filename) {
                 [self _fileDeleteWithName:filename];
@@ -785,12 +2219,14 @@ static UIApplication *_YYSharedApplication() {
 
 - (BOOL)removeItemForKeys:(NSArray *)keys {
     if (keys.count == 0) return NO;
+    [_deferredAccessTimes removeObjectsForKeys:keys];
     switch (_type) {
         case YYKVStorageTypeSQLite: {
             return [self _dbDeleteItemWithKeys:keys];
         } break;
         case YYKVStorageTypeFile:
-        case YYKVStorageTypeMixed: {
+        case YYKVStorageTypeMixed:
+        case YYKVStorageTypeSegment: {
             NSArray *filenames = [self _dbGetFilenameWithKeys:keys];
             for (NSString *filename in filenames) {
                 [self _fileDeleteWithName:filename];
@@ -813,7 +2249,8 @@ static UIApplication *_YYSharedApplication() {
             }
         } break;
         case YYKVStorageTypeFile:
-        case YYKVStorageTypeMixed: {
+        case YYKVStorageTypeMixed:
+        case YYKVStorageTypeSegment: {
             NSArray *filenames = [self _dbGetFilenamesWithSizeLargerThan:size];
             for (NSString *name in filenames) {
                 [self _fileDeleteWithName:name];
@@ -830,6 +2267,7 @@ static UIApplication *_YYSharedApplication() {
 - (BOOL)removeItemsEarlierThanTime:(int)time {
     if (time <= 0) return YES;
     if (time == INT_MAX) return [self removeAllItems];
+    [self _dbFlushAccessTimes];
     
     switch (_type) {
         case YYKVStorageTypeSQLite: {
@@ -839,7 +2277,8 @@ static UIApplication *_YYSharedApplication() {
             }
         } break;
         case YYKVStorageTypeFile:
-        case YYKVStorageTypeMixed: {
+        case YYKVStorageTypeMixed:
+        case YYKVStorageTypeSegment: {
             NSArray *filenames = [self _dbGetFilenamesWithTimeEarlierThan:time];
             for (NSString *name in filenames) {
                 [self _fileDeleteWithName:name];
@@ -860,6 +2299,12 @@ static UIApplication *_YYSharedApplication() {
     int total = [self _dbGetTotalItemSize];
     if (total < 0) return NO;
     if (total <= maxSize) return YES;
+    if ([self _dbLoadIndex]) {
+        BOOL suc = [self _removeIndexedItemsWithTotal:total toLimit:maxSize bySize:YES];
+        if (suc) [self _dbCheckpoint];
+        return suc;
+    }
+    [self _dbFlushAccessTimes];
     
     NSArray *items = nil;
     BOOL suc = NO;
@@ -890,6 +2335,12 @@ static UIApplication *_YYSharedApplication() {
     int total = [self _dbGetTotalItemCount];
     if (total < 0) return NO;
     if (total <= maxCount) return YES;
+    if ([self _dbLoadIndex]) {
+        BOOL suc = [self _removeIndexedItemsWithTotal:total toLimit:maxCount bySize:NO];
+        if (suc) [self _dbCheckpoint];
+        return suc;
+    }
+    [self _dbFlushAccessTimes];
     
     NSArray *items = nil;
     BOOL suc = NO;
@@ -914,10 +2365,12 @@ static UIApplication *_YYSharedApplication() {
 }
 
 - (BOOL)removeAllItems {
+    [_deferredAccessTimes removeAllObjects];
     if (![self _dbClose]) return NO;
     [self _reset];
     if (![self _dbOpen]) return NO;
     if (![self _dbInitialize]) return NO;
+    [self _dbLoadFilter];
     return YES;
 }
 
@@ -955,9 +2408,10 @@ static UIApplication *_YYSharedApplication() {
 
 - (YYKVStorageItem *)getItemForKey:(NSString *)key {
     if (key.length == 0) return nil;
+    if (![_filter mayContainKey:key]) return nil;
     YYKVStorageItem *item = [self _dbGetItemWithKey:key excludeInlineData:NO];
     if (item) {
-        [self _dbUpdateAccessTimeWithKey:key];
+        [self _updateAccessTimeWithKey:key];
         if (item.filename) {
             item.value = [self _fileReadWithName:item.filename];
             if (!item.value) {
@@ -971,12 +2425,14 @@ static UIApplication *_YYSharedApplication() {
 
 - (YYKVStorageItem *)getItemInfoForKey:(NSString *)key {
     if (key.length == 0) return nil;
+    if (![_filter mayContainKey:key]) return nil;
     YYKVStorageItem *item = [self _dbGetItemWithKey:key excludeInlineData:YES];
     return item;
 }
 
 - (NSData *)getItemValueForKey:(NSString *)key {
     if (key.length == 0) return nil;
+    if (![_filter mayContainKey:key]) return nil;
     NSData *value = nil;
     switch (_type) {
         case YYKVStorageTypeFile: {
@@ -992,7 +2448,8 @@ static UIApplication *_YYSharedApplication() {
         case YYKVStorageTypeSQLite: {
             value = [self _dbGetValueWithKey:key];
         } break;
-        case YYKVStorageTypeMixed: {
+        case YYKVStorageTypeMixed:
+        case YYKVStorageTypeSegment: {
             NSString *filename = [self _dbGetFilenameWithKey:key];
             if (filename) {
                 value = [self _fileReadWithName:filename];
@@ -1006,7 +2463,7 @@ static UIApplication *_YYSharedApplication() {
         } break;
     }
     if (value) {
-        [self _dbUpdateAccessTimeWithKey:key];
+        [self _updateAccessTimeWithKey:key];
     }
     return value;
 }
@@ -1029,7 +2486,13 @@ static UIApplication *_YYSharedApplication() {
         }
     }
     if (items.count > 0) {
-        [self _dbUpdateAccessTimeWithKeys:keys];
+        if (_deferredAccessTimeEnabled) {
+            for (YYKVStorageItem *item in items) {
+                if (item.key) [self _dbDeferAccessTimeWithKey:item.key];
+            }
+        } else {
+            [self _dbUpdateAccessTimeWithKeys:keys];
+        }
     }
     return items.count ? items : nil;
 }
@@ -1050,11 +2513,54 @@ static UIApplication *_YYSharedApplication() {
     return kv.count ? kv : nil;
 }
 
+- (YYKVStorageItem *)readItemForKey:(NSString *)key {
+    if (key.length == 0) return nil;
+    if (![_filter mayContainKey:key]) return nil;
+    _YYKVStorageReader *reader = [self _dbReaderCheckout];
+    if (!reader) return nil;
+    sqlite3_bind_text(reader->_stmt, 1, key.UTF8String, -1, NULL);
+    YYKVStorageItem *item = nil;
+    int result = sqlite3_step(reader->_stmt);
+    if (result == SQLITE_ROW) {
+        item = [self _dbGetItemFromStmt:reader->_stmt excludeInlineData:NO];
+    } else if (result != SQLITE_DONE) {
+        if (_errorLogsEnabled) NSLog(@"%s line:%d sqlite query error (%d): %s", __FUNCTION__, __LINE__, result, sqlite3_errmsg(reader->_db));
+    }
+    [self _dbReaderCheckin:reader];
+    
+    if (item.filename) {
+        item.value = [self _fileReadWithName:item.filename];
+        if (!item.value) item = nil; // removed by another thread, or broken
+    }
+    return item;
+}
+
+- (BOOL)updateAccessTimeForKeys:(NSArray *)keys {
+    if (keys.count == 0) return NO;
+    if (_deferredAccessTimeEnabled) {
+        for (NSString *key in keys) {
+            [self _dbDeferAccessTimeWithKey:key];
+        }
+        return YES;
+    }
+    return [self _dbUpdateAccessTimeWithKeys:keys];
+}
+
+- (BOOL)flushAccessTimes {
+    return [self _dbFlushAccessTimes];
+}
+
 - (BOOL)itemExistsForKey:(NSString *)key {
     if (key.length == 0) return NO;
+    if (![_filter mayContainKey:key]) return NO;
     return [self _dbGetItemCountWithKey:key] > 0;
 }
 
+- (BOOL)itemMayExistForKey:(NSString *)key {
+    if (key.length == 0) return NO;
+    return [_filter mayContainKey:key];
+}
+
 - (int)getItemsCount {
     return [self _dbGetTotalItemCount];
 }
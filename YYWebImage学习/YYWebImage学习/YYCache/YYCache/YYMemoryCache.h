@@ -13,6 +13,69 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ The policy which YYMemoryCache uses to choose the objects to evict.
+ */
+typedef NS_ENUM(NSUInteger, YYMemoryCacheEvictionPolicy) {
+    
+    /// Least recently used objects are evicted first.
+    YYMemoryCacheEvictionPolicyLRU = 0,
+    
+    /// W-TinyLFU. New objects enter a small LRU window, and then are admitted to
+    /// the main (segmented LRU) area only if they are accessed more frequently than
+    /// the objects they would replace. Objects which are accessed only once (such
+    /// as a long scrolling feed) can't flush the frequently accessed objects.
+    YYMemoryCacheEvictionPolicyTinyLFU = 1,
+};
+
+/**
+ Memory pressure level, delivered by `YYMemoryPressureSource`.
+ */
+typedef NS_ENUM(NSUInteger, YYMemoryPressureLevel) {
+    
+    /// The memory pressure is back to normal, nothing to do.
+    YYMemoryPressureLevelNormal = 0,
+    
+    /// The memory cache trims its total cost and count to 50%.
+    YYMemoryPressureLevelWarning = 1,
+    
+    /// The memory cache trims its total cost and count to 25%.
+    YYMemoryPressureLevelUrgent = 2,
+    
+    /// The memory cache removes all objects except the pinned ones.
+    YYMemoryPressureLevelCritical = 3,
+};
+
+/**
+ An object which tells the memory cache about the memory pressure.
+ You may implement your own source to simulate the memory pressure.
+ */
+@protocol YYMemoryPressureSource <NSObject>
+
+/**
+ Begin to deliver the memory pressure level to the handler, the handler may be
+ called on any thread. It's called once by the cache which owns the source.
+ */
+- (void)startWithHandler:(void(^)(YYMemoryPressureLevel level))handler;
+
+/**
+ Stop delivering the memory pressure.
+ */
+- (void)stop;
+
+@end
+
+/**
+ The default memory pressure source of YYMemoryCache.
+ 
+ It delivers `YYMemoryPressureLevelWarning` and `YYMemoryPressureLevelCritical`
+ from the system memory pressure dispatch source, and `YYMemoryPressureLevelUrgent`
+ when the app receives a memory warning.
+ */
+@interface YYSystemMemoryPressureSource : NSObject <YYMemoryPressureSource>
+@end
+
+
 /**
  YYMemoryCache is a fast in-memory cache that stores key-value pairs.
  In contrast to NSDictionary, keys are retained and not copied.
@@ -20,16 +83,45 @@ NS_ASSUME_NONNULL_BEGIN
  
  YYMemoryCache objects differ from NSCache in a few ways:
  
- * It uses LRU (least-recently-used) to remove objects; NSCache's eviction method
-   is non-deterministic.
+ * It uses LRU (least-recently-used) or TinyLFU to remove objects; NSCache's
+   eviction method is non-deterministic.
  * It can be controlled by cost, count and age; NSCache's limits are imprecise.
  * It can be configured to automatically evict objects when receive memory 
    warning or app enter background.
  
  The time of `Access Methods` in YYMemoryCache is typically in constant time (O(1)).
+
+ By default all objects are kept in one LRU list guarded by one lock. If the cache
+ is accessed by many threads at the same time, you may create it with
+ `initWithShardCount:` to split the objects into several independent shards.
  */
 @interface YYMemoryCache : NSObject
 
+#pragma mark - Initializer
+///=============================================================================
+/// @name Initializer
+///=============================================================================
+
+/**
+ Create a new cache with a single shard.
+ */
+- (instancetype)init;
+
+/**
+ The designated initializer.
+
+ @param shardCount The number of shards, it will be rounded up to a power of 2
+     (max 64). Each shard has its own linked map and lock, and an object is stored
+     in the shard selected by its key's hash, so accesses to different shards
+     can run in parallel. Pass 1 to get the default behavior.
+
+ @discussion In sharded mode, `countLimit` and `costLimit` are divided equally
+ among the shards, so the limits become approximate, and the eviction order is only
+ kept within a shard.
+ */
+- (instancetype)initWithShardCount:(NSUInteger)shardCount NS_DESIGNATED_INITIALIZER;
+
+
 #pragma mark - Attribute
 ///=============================================================================
 /// @name Attribute
@@ -38,6 +130,9 @@ NS_ASSUME_NONNULL_BEGIN
 /** The name of the cache. Default is nil. */
 @property (nullable, copy) NSString *name;
 
+/** The number of shards in the cache (read-only). Default is 1. */
+@property (readonly) NSUInteger shardCount;
+
 /** The number of objects in the cache (read-only) */
 @property (readonly) NSUInteger totalCount;
 
@@ -54,8 +149,9 @@ NS_ASSUME_NONNULL_BEGIN
  The maximum number of objects the cache should hold.
  
  @discussion The default value is NSUIntegerMax, which means no limit.
- This is not a strict limit—if the cache goes over the limit, some objects in the
- cache could be evicted later in backgound thread.
+ This is not a strict limit—if the cache goes over the limit, a few objects are
+ evicted when a new object is added, and the others could be evicted later in
+ backgound thread.
  */
 @property NSUInteger countLimit;
 
@@ -63,8 +159,9 @@ NS_ASSUME_NONNULL_BEGIN
  The maximum total cost that the cache can hold before it starts evicting objects.
  
  @discussion The default value is NSUIntegerMax, which means no limit.
- This is not a strict limit—if the cache goes over the limit, some objects in the
- cache could be evicted later in backgound thread.
+ This is not a strict limit—if the cache goes over the limit, a few objects are
+ evicted when a new object is added, and the others could be evicted later in
+ backgound thread.
  */
 @property NSUInteger costLimit;
 
@@ -77,23 +174,60 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property NSTimeInterval ageLimit;
 
+/**
+ The policy used to choose the objects to evict when the cache goes over its
+ `countLimit` or `costLimit`. Default is YYMemoryCacheEvictionPolicyLRU.
+ 
+ @discussion Changing this value keeps the objects in cache. Objects are still
+ removed by age with `ageLimit` and `trimToAge:`.
+ */
+@property YYMemoryCacheEvictionPolicy evictionPolicy;
+
+/**
+ If `YES`, cache hits don't take the exclusive lock. Default is NO.
+
+ @discussion In this mode, `objectForKey:` and `containsObjectForKey:` look up
+ the object with a shared read lock, so reads don't block each other. A hit is
+ only recorded to a small buffer, and the eviction order is updated later in
+ batch, when the buffer is full and the lock is free, or before the next write.
+ The buffer is lossy: under heavy contention some hits may not be recorded.
+ You may enable it for read-heavy caches, such as image memory cache.
+ */
+@property BOOL concurrentReadEnabled;
+
 /**
  The auto trim check time interval in seconds. Default is 5.0.
  
- @discussion The cache holds an internal timer to check whether the cache reaches 
- its limits, and if the limit is reached, it begins to evict objects.
+ @discussion When `ageLimit` is set and the cache is not empty, the cache checks
+ the expired objects with this interval, and evicts them in background thread.
+ An empty cache, or a cache without `ageLimit`, never wakes up for checking.
  */
 @property NSTimeInterval autoTrimInterval;
 
 /**
- If `YES`, the cache will remove all objects when the app receives a memory warning.
+ If `YES`, the cache will trim objects when `memoryPressureSource` reports memory
+ pressure (see `YYMemoryPressureLevel`), the pinned objects are kept.
  The default value is `YES`.
  */
-@property BOOL shouldRemoveAllObjectsOnMemoryWarning;
+@property BOOL shouldTrimOnMemoryPressure;
 
 /**
- If `YES`, The cache will remove all objects when the app enter background.
- The default value is `YES`.
+ The same as `shouldTrimOnMemoryPressure`. The objects are trimmed by the pressure
+ level instead of being all removed, use `trimForMemoryPressure:` with
+ YYMemoryPressureLevelCritical in `didReceiveMemoryWarningBlock` to remove them all.
+ */
+@property BOOL shouldRemoveAllObjectsOnMemoryWarning DEPRECATED_MSG_ATTRIBUTE("Use shouldTrimOnMemoryPressure instead.");
+
+/**
+ The source which reports the memory pressure to the cache.
+ The default value is an instance of `YYSystemMemoryPressureSource`. 
+ Set it to nil to ignore the memory pressure.
+ */
+@property (nullable, strong) id<YYMemoryPressureSource> memoryPressureSource;
+
+/**
+ If `YES`, The cache will remove all objects except the pinned ones when the app
+ enter background. The default value is `YES`.
  */
 @property BOOL shouldRemoveAllObjectsWhenEnteringBackground;
 
@@ -169,6 +303,66 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)setObject:(nullable id)object forKey:(id)key withCost:(NSUInteger)cost;
 
+/**
+ Returns the keys which are in cache, each shard is locked only once.
+ 
+ @param keys An array of keys.
+ @return A set of the keys which are in cache.
+ */
+- (NSSet *)containsObjectsForKeys:(NSArray *)keys;
+
+/**
+ Returns the values associated with the given keys, each shard is locked only once.
+ 
+ @param keys An array of keys.
+ @return A dictionary of the keys and values which are in cache.
+ */
+- (NSDictionary *)objectsForKeys:(NSArray *)keys;
+
+/**
+ Sets the keys and values of the dictionary in the cache (0 cost), each shard is
+ locked only once.
+ 
+ @param dictionary A dictionary of the keys and values to be stored in the cache.
+ */
+- (void)setObjectsWithDictionary:(NSDictionary *)dictionary;
+
+/**
+ Removes the values of the specified keys in the cache, each shard is locked only once.
+ 
+ @param keys An array of keys identifying the values to be removed.
+ */
+- (void)removeObjectsForKeys:(NSArray *)keys;
+
+/**
+ Pins the value of the specified key in the cache.
+ 
+ @discussion A pinned object is never evicted by limits, trims or memory pressure
+ (such as the image which is on screen), but it can still be removed by
+ `removeObjectForKey:` and `removeAllObjects`. Each pin should be balanced with
+ an `unpinObjectForKey:`. Pinned objects are counted in `totalCount` and `totalCost`.
+ 
+ @param key The key identifying the value. If nil, this method has no effect.
+ @return Whether the key is in cache and pinned.
+ */
+- (BOOL)pinObjectForKey:(id)key;
+
+/**
+ Unpins the value of the specified key in the cache, the value can be evicted
+ again when all its pins are balanced.
+ 
+ @param key The key identifying the value. If nil, this method has no effect.
+ */
+- (void)unpinObjectForKey:(id)key;
+
+/**
+ Trims the cache for the specified memory pressure level, the pinned objects
+ are kept. It's called by `memoryPressureSource`, you may also call it directly.
+ 
+ @param level The memory pressure level.
+ */
+- (void)trimForMemoryPressure:(YYMemoryPressureLevel)level;
+
 /**
  Removes the value of the specified key in the cache.
  
@@ -188,14 +382,14 @@ NS_ASSUME_NONNULL_BEGIN
 ///=============================================================================
 
 /**
- Removes objects from the cache with LRU, until the `totalCount` is below or equal to
+ Removes objects from the cache with `evictionPolicy`, until the `totalCount` is below or equal to
  the specified value.
  @param count  The total count allowed to remain after the cache has been trimmed.
  */
 - (void)trimToCount:(NSUInteger)count;
 
 /**
- Removes objects from the cache with LRU, until the `totalCost` is or equal to
+ Removes objects from the cache with `evictionPolicy`, until the `totalCost` is or equal to
  the specified value.
  @param cost The total cost allowed to remain after the cache has been trimmed.
  */
@@ -14,298 +14,1052 @@
 #import <CoreFoundation/CoreFoundation.h>
 #import <QuartzCore/QuartzCore.h>
 #import <pthread.h>
+#import <libkern/OSAtomic.h>
 
 
 static inline dispatch_queue_t YYMemoryCacheGetReleaseQueue() {
     return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
 }
 
+
+#pragma mark - Frequency Sketch
+
 /**
- A node in linked map.
- Typically, you should not use this class directly.
+ A count-min sketch with 4-bit counters, used by TinyLFU to estimate how often
+ a key was accessed recently. When the number of additions reaches the sample
+ size, all counters are halved, so old popularity fades out.
  */
-@interface _YYLinkedMapNode : NSObject {
-    @package
-    __unsafe_unretained _YYLinkedMapNode *_prev; // retained by dic
-    __unsafe_unretained _YYLinkedMapNode *_next; // retained by dic
-    id _key;
-    id _value;
-    NSUInteger _cost;
-    NSTimeInterval _time;
+typedef struct {
+    uint64_t *table;       ///< each word holds 16 4-bit counters
+    NSUInteger tableMask;  ///< table length - 1
+    NSUInteger capacity;   ///< the number of keys the table is sized for
+    NSUInteger sampleSize; ///< additions before the counters are halved
+    NSUInteger size;       ///< additions since the last reset
+} _YYFrequencySketch;
+
+static const uint64_t kYYFrequencySketchSeeds[4] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+};
+
+/**
+ Grow the table for more keys. The index of a key in the larger table has the same
+ low bits, so each old word is copied to the words it maps to, and the counters are
+ halved as an aging step. The popularity is kept while the cache is warming up.
+ */
+static void _YYFrequencySketchEnsureCapacity(_YYFrequencySketch *sketch, NSUInteger capacity) {
+    if (capacity < 64) capacity = 64;
+    if (capacity <= sketch->capacity) return;
+    NSUInteger length = 1;
+    while (length < capacity) length <<= 1;
+    uint64_t *table = length == sketch->tableMask + 1 ? sketch->table : calloc(length, sizeof(uint64_t));
+    if (!table) return;
+    sketch->capacity = capacity;
+    sketch->sampleSize = capacity * 10;
+    if (table == sketch->table) return;
+    if (sketch->table) {
+        NSUInteger oldMask = sketch->tableMask;
+        for (NSUInteger i = 0; i < length; i++) {
+            table[i] = (sketch->table[i & oldMask] >> 1) & 0x7777777777777777ULL;
+        }
+        free(sketch->table);
+    }
+    sketch->table = table;
+    sketch->tableMask = length - 1;
+    sketch->size >>= 1;
 }
-@end
 
-@implementation _YYLinkedMapNode
-@end
+static void _YYFrequencySketchFree(_YYFrequencySketch *sketch) {
+    free(sketch->table);
+    memset(sketch, 0, sizeof(_YYFrequencySketch));
+}
+
+static inline uint64_t _YYFrequencySketchSpread(NSUInteger hash) {
+    uint64_t h = (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+}
+
+static inline NSUInteger _YYFrequencySketchIndex(_YYFrequencySketch *sketch, uint64_t hash, int i) {
+    uint64_t h = (hash + kYYFrequencySketchSeeds[i]) * kYYFrequencySketchSeeds[i];
+    h += h >> 32;
+    return (NSUInteger)(h & sketch->tableMask);
+}
+
+static void _YYFrequencySketchReset(_YYFrequencySketch *sketch) {
+    NSUInteger odd = 0;
+    for (NSUInteger i = 0; i <= sketch->tableMask; i++) {
+        odd += __builtin_popcountll(sketch->table[i] & 0x1111111111111111ULL);
+        sketch->table[i] = (sketch->table[i] >> 1) & 0x7777777777777777ULL;
+    }
+    sketch->size = (sketch->size - (odd >> 2)) >> 1;
+}
+
+static void _YYFrequencySketchIncrement(_YYFrequencySketch *sketch, NSUInteger hash) {
+    if (!sketch->table) return;
+    uint64_t h = _YYFrequencySketchSpread(hash);
+    int start = (int)(h & 3) << 2;
+    BOOL added = NO;
+    for (int i = 0; i < 4; i++) {
+        NSUInteger index = _YYFrequencySketchIndex(sketch, h, i);
+        int offset = (start + i) << 2;
+        uint64_t mask = 0xfULL << offset;
+        if ((sketch->table[index] & mask) != mask) {
+            sketch->table[index] += 1ULL << offset;
+            added = YES;
+        }
+    }
+    if (added && ++sketch->size >= sketch->sampleSize) {
+        _YYFrequencySketchReset(sketch);
+    }
+}
+
+static int _YYFrequencySketchFrequency(_YYFrequencySketch *sketch, NSUInteger hash) {
+    if (!sketch->table) return 0;
+    uint64_t h = _YYFrequencySketchSpread(hash);
+    int start = (int)(h & 3) << 2;
+    int frequency = INT_MAX;
+    for (int i = 0; i < 4; i++) {
+        NSUInteger index = _YYFrequencySketchIndex(sketch, h, i);
+        int offset = (start + i) << 2;
+        int count = (int)((sketch->table[index] >> offset) & 0xf);
+        if (count < frequency) frequency = count;
+    }
+    return frequency;
+}
+
+
+#pragma mark - Linked Map
+
+#define kYYLinkedMapNil UINT32_MAX
+#define kYYLinkedMapListFree 0xff
+
+/// The list which an entry belongs to.
+typedef NS_ENUM(uint8_t, _YYLinkedMapListType) {
+    _YYLinkedMapListWindow    = 0, ///< The only list in LRU, the admission window in TinyLFU.
+    _YYLinkedMapListProbation = 1, ///< TinyLFU main area, objects accessed once.
+    _YYLinkedMapListProtected = 2, ///< TinyLFU main area, objects accessed more than once.
+    _YYLinkedMapListPinned    = 3, ///< Pinned objects, never evicted.
+};
+
+/**
+ An entry in linked map, stored in a contiguous array and linked by index.
+ The key and value are retained manually.
+ */
+typedef struct {
+    CFTypeRef key;          ///< retained, NULL if the entry is free
+    CFTypeRef value;        ///< retained
+    NSUInteger cost;
+    NSTimeInterval time;
+    NSUInteger hash;        ///< key's hash
+    uint32_t prev;          ///< index of previous entry in list
+    uint32_t next;          ///< index of next entry in list, or next free entry
+    uint32_t generation;    ///< increased when the entry is freed, never 0
+    uint32_t pinCount;      ///< pinned if larger than 0
+    uint8_t list;           ///< _YYLinkedMapListType, or kYYLinkedMapListFree
+    BOOL candidate;         ///< moved from window to probation, not admitted yet
+} _YYLinkedMapEntry;
+
+/**
+ A doubly linked list of entries, head is MRU and tail is LRU.
+ */
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    NSUInteger count;
+} _YYLinkedList;
+
+static inline void _YYLinkedListInit(_YYLinkedList *list) {
+    list->head = kYYLinkedMapNil;
+    list->tail = kYYLinkedMapNil;
+    list->count = 0;
+}
+
+static inline void _YYLinkedListInsertAtHead(_YYLinkedMapEntry *entries, _YYLinkedList *list, uint32_t index) {
+    _YYLinkedMapEntry *entry = entries + index;
+    entry->prev = kYYLinkedMapNil;
+    entry->next = list->head;
+    if (list->head != kYYLinkedMapNil) entries[list->head].prev = index;
+    else list->tail = index;
+    list->head = index;
+    list->count++;
+}
+
+static inline void _YYLinkedListRemove(_YYLinkedMapEntry *entries, _YYLinkedList *list, uint32_t index) {
+    _YYLinkedMapEntry *entry = entries + index;
+    if (entry->next != kYYLinkedMapNil) entries[entry->next].prev = entry->prev;
+    else list->tail = entry->prev;
+    if (entry->prev != kYYLinkedMapNil) entries[entry->prev].next = entry->next;
+    else list->head = entry->next;
+    entry->prev = kYYLinkedMapNil;
+    entry->next = kYYLinkedMapNil;
+    list->count--;
+}
+
+static inline void _YYLinkedListBringToHead(_YYLinkedMapEntry *entries, _YYLinkedList *list, uint32_t index) {
+    if (list->head == index) return;
+    _YYLinkedListRemove(entries, list, index);
+    _YYLinkedListInsertAtHead(entries, list, index);
+}
+
+/// Append all entries of `other` after the tail of `list`, and empty `other`.
+static inline void _YYLinkedListAppend(_YYLinkedMapEntry *entries, _YYLinkedList *list, _YYLinkedList *other) {
+    if (other->head == kYYLinkedMapNil) return;
+    if (list->tail != kYYLinkedMapNil) {
+        entries[list->tail].next = other->head;
+        entries[other->head].prev = list->tail;
+        list->tail = other->tail;
+    } else {
+        list->head = other->head;
+        list->tail = other->tail;
+    }
+    list->count += other->count;
+    _YYLinkedListInit(other);
+}
+
+/// The first slot to probe in hash index.
+static inline NSUInteger _YYLinkedMapSlotIndex(NSUInteger hash, NSUInteger slotMask) {
+    uint64_t h = (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+    return (NSUInteger)(h >> 32) & slotMask;
+}
 
 
 /**
  A linked map used by YYMemoryCache.
  It's not thread-safe and does not validate the parameters.
  
+ Entries are stored in a contiguous array which grows by doubling, and freed
+ entries are reused, so there's no allocation per object. The hash index is an
+ open-addressing table (linear probing, backward shift deletion) of entry indexes.
+ The keys and values of removed entries are released in batch by
+ `releasePendingObjects`.
+ 
+ With LRU policy, all entries are kept in the window list. With TinyLFU policy,
+ new entries enter the window list (about 1% of entries), then move to the
+ probation list when the window is full. An entry in probation is promoted to the
+ protected list (about 80% of main area) when it is accessed again. To evict, the
+ newest candidate in probation competes with the probation tail, and the one with
+ the lower estimated frequency is removed, so a scan of one-hit objects can't
+ flush the frequently used objects.
+ 
+ Pinned entries are moved to a separate list, so they're never chosen to evict,
+ until they're unpinned.
+ 
  Typically, you should not use this class directly.
  */
 @interface _YYLinkedMap : NSObject {
     @package
-    CFMutableDictionaryRef _dic; // do not set object directly
+    _YYLinkedMapEntry *_entries; // do not change it directly
+    uint32_t _capacity;          // allocated entries
+    uint32_t _used;              // entries which have ever been used
+    uint32_t _freeHead;          // free entries, linked by `next`
+    uint32_t *_slots;            // hash index, kYYLinkedMapNil if empty
+    NSUInteger _slotMask;
     NSUInteger _totalCost;
     NSUInteger _totalCount;
-    _YYLinkedMapNode *_head; // MRU, do not change it directly
-    _YYLinkedMapNode *_tail; // LRU, do not change it directly
+    _YYLinkedList _window;    // do not change it directly
+    _YYLinkedList _probation; // do not change it directly
+    _YYLinkedList _protected; // do not change it directly
+    _YYLinkedList _pinned;    // do not change it directly
+    YYMemoryCacheEvictionPolicy _policy;
+    _YYFrequencySketch _sketch;
+    CFTypeRef *_pending;      // removed keys and values to be released
+    NSUInteger _pendingCount;
+    NSUInteger _pendingCapacity;
     BOOL _releaseOnMainThread;
     BOOL _releaseAsynchronously;
 }
 
-/// Insert a node at head and update the total cost.
-/// Node and node.key should not be nil.
-- (void)insertNodeAtHead:(_YYLinkedMapNode *)node;
+/// Returns the entry index for key, or kYYLinkedMapNil.
+- (uint32_t)findKey:(id)key hash:(NSUInteger)hash;
 
-/// Bring a inner node to header.
-/// Node should already inside the dic.
-- (void)bringNodeToHead:(_YYLinkedMapNode *)node;
+/// Insert an entry at head and update the total cost, returns the entry index.
+/// Key should not be nil and not inside the map.
+- (uint32_t)insertKey:(id)key value:(id)value cost:(NSUInteger)cost time:(NSTimeInterval)time hash:(NSUInteger)hash;
 
-/// Remove a inner node and update the total cost.
-/// Node should already inside the dic.
-- (void)removeNode:(_YYLinkedMapNode *)node;
+/// Replace the value and cost of an inner entry and update the total cost.
+- (void)setValue:(id)value cost:(NSUInteger)cost forEntry:(uint32_t)index;
 
-/// Remove tail node if exist.
-- (_YYLinkedMapNode *)removeTailNode;
+/// Record an access to an inner entry, and bring it to the head of its list.
+- (void)bringEntryToHead:(uint32_t)index;
 
-/// Remove all node in background queue.
+/// Record an access to a key which is not in the map.
+- (void)recordMissWithHash:(NSUInteger)hash;
+
+/// Remove an inner entry and update the total cost.
+- (void)removeEntry:(uint32_t)index;
+
+/// Increase the pin count of an inner entry, a pinned entry is never evicted.
+- (void)pinEntry:(uint32_t)index;
+
+/// Decrease the pin count of an inner entry.
+- (void)unpinEntry:(uint32_t)index;
+
+/// Remove the entry chosen by eviction policy (the tail entry for LRU).
+/// Returns NO if there's no unpinned entry.
+- (BOOL)removeTailEntry;
+
+/// Remove at most `limit` unpinned entries which are accessed before `time`.
+/// Returns the number of removed entries.
+- (NSUInteger)removeEntriesEarlierThanTime:(NSTimeInterval)time limit:(NSUInteger)limit;
+
+/// Change the eviction policy, existing entries are kept.
+- (void)setPolicy:(YYMemoryCacheEvictionPolicy)policy;
+
+/// Remove all entries, they're released in background queue.
 - (void)removeAll;
 
+/// Release the keys and values of removed entries in specified queue.
+- (void)releasePendingObjects;
+
 @end
 
 @implementation _YYLinkedMap
 
 - (instancetype)init {
     self = [super init];
-    _dic = CFDictionaryCreateMutable(CFAllocatorGetDefault(), 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    _freeHead = kYYLinkedMapNil;
+    _YYLinkedListInit(&_window);
+    _YYLinkedListInit(&_probation);
+    _YYLinkedListInit(&_protected);
+    _YYLinkedListInit(&_pinned);
+    _policy = YYMemoryCacheEvictionPolicyLRU;
     _releaseOnMainThread = NO;
     _releaseAsynchronously = YES;
     return self;
 }
 
 - (void)dealloc {
-    CFRelease(_dic);
+    _releaseAsynchronously = NO;
+    _releaseOnMainThread = NO;
+    [self removeAll];
+    [self releasePendingObjects];
+    free(_pending);
+    _YYFrequencySketchFree(&_sketch);
 }
 
-- (void)insertNodeAtHead:(_YYLinkedMapNode *)node {
-    CFDictionarySetValue(_dic, (__bridge const void *)(node->_key), (__bridge const void *)(node));
-    _totalCost += node->_cost;
-    _totalCount++;
-    if (_head) {
-        node->_next = _head;
-        _head->_prev = node;
-        _head = node;
-    } else {
-        _head = _tail = node;
+- (_YYLinkedList *)_listOfEntry:(uint32_t)index {
+    switch (_entries[index].list) {
+        case _YYLinkedMapListProbation: return &_probation;
+        case _YYLinkedMapListProtected: return &_protected;
+        case _YYLinkedMapListPinned: return &_pinned;
+        default: return &_window;
     }
 }
 
-- (void)bringNodeToHead:(_YYLinkedMapNode *)node {
-    if (_head == node) return;
+- (void)_addPendingObject:(CFTypeRef)object {
+    if (_pendingCount == _pendingCapacity) {
+        NSUInteger capacity = _pendingCapacity ? _pendingCapacity * 2 : 16;
+        CFTypeRef *pending = realloc(_pending, capacity * sizeof(CFTypeRef));
+        if (!pending) {
+            CFRelease(object);
+            return;
+        }
+        _pending = pending;
+        _pendingCapacity = capacity;
+    }
+    _pending[_pendingCount++] = object;
+}
+
+- (void)_insertSlotForEntry:(uint32_t)index {
+    NSUInteger i = _YYLinkedMapSlotIndex(_entries[index].hash, _slotMask);
+    while (_slots[i] != kYYLinkedMapNil) i = (i + 1) & _slotMask;
+    _slots[i] = index;
+}
+
+- (void)_removeSlotForEntry:(uint32_t)index {
+    NSUInteger i = _YYLinkedMapSlotIndex(_entries[index].hash, _slotMask);
+    while (_slots[i] != index) i = (i + 1) & _slotMask;
+    // backward shift, so no tombstone is needed
+    NSUInteger j = i;
+    while (1) {
+        j = (j + 1) & _slotMask;
+        uint32_t moving = _slots[j];
+        if (moving == kYYLinkedMapNil) break;
+        NSUInteger k = _YYLinkedMapSlotIndex(_entries[moving].hash, _slotMask);
+        BOOL stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            _slots[i] = moving;
+            i = j;
+        }
+    }
+    _slots[i] = kYYLinkedMapNil;
+}
+
+- (BOOL)_growIfNeeded {
+    if (_freeHead != kYYLinkedMapNil || _used < _capacity) return YES;
+    if (_capacity >= kYYLinkedMapNil / 2) return NO;
+    uint32_t capacity = _capacity ? _capacity * 2 : 16;
+    // keep the load factor of hash index below 0.5
+    NSUInteger slotCount = (NSUInteger)capacity * 2;
+    uint32_t *slots = malloc(slotCount * sizeof(uint32_t));
+    if (!slots) return NO;
+    _YYLinkedMapEntry *entries = realloc(_entries, capacity * sizeof(_YYLinkedMapEntry));
+    if (!entries) {
+        free(slots);
+        return NO;
+    }
+    _entries = entries;
+    _capacity = capacity;
     
-    if (_tail == node) {
-        _tail = node->_prev;
-        _tail->_next = nil;
+    memset(slots, 0xff, slotCount * sizeof(uint32_t));
+    free(_slots);
+    _slots = slots;
+    _slotMask = slotCount - 1;
+    for (uint32_t i = 0; i < _used; i++) {
+        if (_entries[i].list != kYYLinkedMapListFree) [self _insertSlotForEntry:i];
+    }
+    return YES;
+}
+
+/// Move the overflowed entries from window to probation, they will be admitted
+/// or evicted when the map needs to evict an entry.
+- (void)_drainWindow {
+    NSUInteger windowLimit = MAX(_totalCount / 100, 1);
+    while (_window.count > windowLimit) {
+        uint32_t index = _window.tail;
+        _YYLinkedListRemove(_entries, &_window, index);
+        _entries[index].list = _YYLinkedMapListProbation;
+        _entries[index].candidate = YES;
+        _YYLinkedListInsertAtHead(_entries, &_probation, index);
+    }
+}
+
+/// Demote the overflowed entries from protected to probation.
+- (void)_balanceProtected {
+    NSUInteger mainCount = _probation.count + _protected.count;
+    NSUInteger protectedLimit = mainCount - mainCount / 5;
+    while (_protected.count > protectedLimit) {
+        uint32_t index = _protected.tail;
+        _YYLinkedListRemove(_entries, &_protected, index);
+        _entries[index].list = _YYLinkedMapListProbation;
+        _YYLinkedListInsertAtHead(_entries, &_probation, index);
+    }
+}
+
+- (uint32_t)findKey:(id)key hash:(NSUInteger)hash {
+    if (!_slots) return kYYLinkedMapNil;
+    CFTypeRef cfKey = (__bridge CFTypeRef)(key);
+    NSUInteger i = _YYLinkedMapSlotIndex(hash, _slotMask);
+    while (1) {
+        uint32_t index = _slots[i];
+        if (index == kYYLinkedMapNil) return kYYLinkedMapNil;
+        _YYLinkedMapEntry *entry = _entries + index;
+        if (entry->hash == hash && (entry->key == cfKey || CFEqual(entry->key, cfKey))) return index;
+        i = (i + 1) & _slotMask;
+    }
+}
+
+- (uint32_t)insertKey:(id)key value:(id)value cost:(NSUInteger)cost time:(NSTimeInterval)time hash:(NSUInteger)hash {
+    if (![self _growIfNeeded]) return kYYLinkedMapNil;
+    uint32_t index;
+    if (_freeHead != kYYLinkedMapNil) {
+        index = _freeHead;
+        _freeHead = _entries[index].next;
     } else {
-        node->_next->_prev = node->_prev;
-        node->_prev->_next = node->_next;
+        index = _used++;
+        _entries[index].generation = 1;
+    }
+    _YYLinkedMapEntry *entry = _entries + index;
+    entry->key = CFBridgingRetain(key);
+    entry->value = CFBridgingRetain(value);
+    entry->cost = cost;
+    entry->time = time;
+    entry->hash = hash;
+    entry->pinCount = 0;
+    entry->list = _YYLinkedMapListWindow;
+    entry->candidate = NO;
+    [self _insertSlotForEntry:index];
+    _totalCost += cost;
+    _totalCount++;
+    _YYLinkedListInsertAtHead(_entries, &_window, index);
+    if (_policy == YYMemoryCacheEvictionPolicyTinyLFU) {
+        if (_totalCount > _sketch.capacity) {
+            _YYFrequencySketchEnsureCapacity(&_sketch, _totalCount * 2);
+        }
+        _YYFrequencySketchIncrement(&_sketch, hash);
+        [self _drainWindow];
     }
-    node->_next = _head;
-    node->_prev = nil;
-    _head->_prev = node;
-    _head = node;
+    return index;
 }
 
-- (void)removeNode:(_YYLinkedMapNode *)node {
-    CFDictionaryRemoveValue(_dic, (__bridge const void *)(node->_key));
-    _totalCost -= node->_cost;
-    _totalCount--;
-    if (node->_next) node->_next->_prev = node->_prev;
-    if (node->_prev) node->_prev->_next = node->_next;
-    if (_head == node) _head = node->_next;
-    if (_tail == node) _tail = node->_prev;
+- (void)setValue:(id)value cost:(NSUInteger)cost forEntry:(uint32_t)index {
+    _YYLinkedMapEntry *entry = _entries + index;
+    _totalCost -= entry->cost;
+    _totalCost += cost;
+    entry->cost = cost;
+    if (entry->value != (__bridge CFTypeRef)(value)) {
+        [self _addPendingObject:entry->value];
+        entry->value = CFBridgingRetain(value);
+    }
+}
+
+- (void)bringEntryToHead:(uint32_t)index {
+    if (_policy == YYMemoryCacheEvictionPolicyLRU) {
+        _YYLinkedListBringToHead(_entries, [self _listOfEntry:index], index);
+        return;
+    }
+    
+    _YYLinkedMapEntry *entry = _entries + index;
+    _YYFrequencySketchIncrement(&_sketch, entry->hash);
+    switch (entry->list) {
+        case _YYLinkedMapListWindow: {
+            _YYLinkedListBringToHead(_entries, &_window, index);
+        } break;
+        case _YYLinkedMapListProbation: {
+            _YYLinkedListRemove(_entries, &_probation, index);
+            entry->list = _YYLinkedMapListProtected;
+            entry->candidate = NO;
+            _YYLinkedListInsertAtHead(_entries, &_protected, index);
+            [self _balanceProtected];
+        } break;
+        case _YYLinkedMapListProtected: {
+            _YYLinkedListBringToHead(_entries, &_protected, index);
+        } break;
+        case _YYLinkedMapListPinned: {
+            _YYLinkedListBringToHead(_entries, &_pinned, index);
+        } break;
+    }
+}
+
+- (void)pinEntry:(uint32_t)index {
+    _YYLinkedMapEntry *entry = _entries + index;
+    if (entry->pinCount++ > 0) return;
+    _YYLinkedListRemove(_entries, [self _listOfEntry:index], index);
+    entry->list = _YYLinkedMapListPinned;
+    entry->candidate = NO;
+    _YYLinkedListInsertAtHead(_entries, &_pinned, index);
 }
 
-- (_YYLinkedMapNode *)removeTailNode {
-    if (!_tail) return nil;
-    _YYLinkedMapNode *tail = _tail;
-    CFDictionaryRemoveValue(_dic, (__bridge const void *)(_tail->_key));
-    _totalCost -= _tail->_cost;
+- (void)unpinEntry:(uint32_t)index {
+    _YYLinkedMapEntry *entry = _entries + index;
+    if (entry->pinCount == 0 || --entry->pinCount > 0) return;
+    _YYLinkedListRemove(_entries, &_pinned, index);
+    entry->list = _YYLinkedMapListWindow;
+    _YYLinkedListInsertAtHead(_entries, &_window, index);
+    if (_policy == YYMemoryCacheEvictionPolicyTinyLFU) [self _drainWindow];
+}
+
+- (void)recordMissWithHash:(NSUInteger)hash {
+    if (_policy == YYMemoryCacheEvictionPolicyLRU) return;
+    _YYFrequencySketchIncrement(&_sketch, hash);
+}
+
+- (void)removeEntry:(uint32_t)index {
+    _YYLinkedMapEntry *entry = _entries + index;
+    [self _removeSlotForEntry:index];
+    _YYLinkedListRemove(_entries, [self _listOfEntry:index], index);
+    _totalCost -= entry->cost;
     _totalCount--;
-    if (_head == _tail) {
-        _head = _tail = nil;
+    [self _addPendingObject:entry->key];
+    [self _addPendingObject:entry->value];
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->list = kYYLinkedMapListFree;
+    entry->candidate = NO;
+    entry->pinCount = 0;
+    if (++entry->generation == 0) entry->generation = 1;
+    entry->next = _freeHead;
+    _freeHead = index;
+}
+
+- (uint32_t)_victimEntry {
+    if (_policy == YYMemoryCacheEvictionPolicyLRU) return _window.tail;
+    
+    uint32_t victim, candidate;
+    if (_probation.tail != kYYLinkedMapNil) {
+        victim = _probation.tail;
+        candidate = _probation.head;
+        if (candidate == victim || !_entries[candidate].candidate) candidate = kYYLinkedMapNil;
+    } else {
+        victim = _protected.tail;
+        candidate = _window.tail;
+    }
+    if (victim == kYYLinkedMapNil) return candidate;
+    if (candidate == kYYLinkedMapNil) return victim;
+    
+    // TinyLFU admission: keep the one which is used more frequently.
+    if (_YYFrequencySketchFrequency(&_sketch, _entries[candidate].hash) >
+        _YYFrequencySketchFrequency(&_sketch, _entries[victim].hash)) {
+        _entries[candidate].candidate = NO;
+        return victim;
+    }
+    return candidate;
+}
+
+- (BOOL)removeTailEntry {
+    uint32_t index = [self _victimEntry];
+    if (index == kYYLinkedMapNil) return NO;
+    [self removeEntry:index];
+    return YES;
+}
+
+- (NSUInteger)removeEntriesEarlierThanTime:(NSTimeInterval)time limit:(NSUInteger)limit {
+    NSUInteger removed = 0;
+    
+    // entries enter the window and protected lists at head when they're accessed,
+    // so these lists are ordered by access time
+    _YYLinkedList *lists[2] = {&_window, &_protected};
+    for (int i = 0; i < 2; i++) {
+        while (removed < limit && lists[i]->tail != kYYLinkedMapNil && _entries[lists[i]->tail].time < time) {
+            [self removeEntry:lists[i]->tail];
+            removed++;
+        }
+    }
+    
+    // entries enter the probation list with their old access time (from the window
+    // and protected lists), so the whole list is checked
+    uint32_t index = _probation.tail;
+    while (removed < limit && index != kYYLinkedMapNil) {
+        uint32_t prev = _entries[index].prev;
+        if (_entries[index].time < time) {
+            [self removeEntry:index];
+            removed++;
+        }
+        index = prev;
+    }
+    return removed;
+}
+
+- (void)setPolicy:(YYMemoryCacheEvictionPolicy)policy {
+    if (_policy == policy) return;
+    if (policy == YYMemoryCacheEvictionPolicyTinyLFU) {
+        // existing entries are treated as admitted objects
+        for (uint32_t index = _window.head; index != kYYLinkedMapNil; index = _entries[index].next) {
+            _entries[index].list = _YYLinkedMapListProbation;
+            _entries[index].candidate = NO;
+        }
+        _YYLinkedListAppend(_entries, &_probation, &_window);
+        _YYFrequencySketchEnsureCapacity(&_sketch, _totalCount * 2);
     } else {
-        _tail = _tail->_prev;
-        _tail->_next = nil;
+        _YYLinkedListAppend(_entries, &_window, &_protected);
+        _YYLinkedListAppend(_entries, &_window, &_probation);
+        for (uint32_t index = _window.head; index != kYYLinkedMapNil; index = _entries[index].next) {
+            _entries[index].list = _YYLinkedMapListWindow;
+            _entries[index].candidate = NO;
+        }
+        _YYFrequencySketchFree(&_sketch);
     }
-    return tail;
+    _policy = policy;
 }
 
 - (void)removeAll {
     _totalCost = 0;
     _totalCount = 0;
-    _head = nil;
-    _tail = nil;
-    if (CFDictionaryGetCount(_dic) > 0) {
-        CFMutableDictionaryRef holder = _dic;
-        _dic = CFDictionaryCreateMutable(CFAllocatorGetDefault(), 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-        
-        if (_releaseAsynchronously) {
-            dispatch_queue_t queue = _releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-            dispatch_async(queue, ^{
-                CFRelease(holder); // hold and release in specified queue
-            });
-        } else if (_releaseOnMainThread && !pthread_main_np()) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                CFRelease(holder); // hold and release in specified queue
-            });
-        } else {
-            CFRelease(holder);
+    _YYLinkedListInit(&_window);
+    _YYLinkedListInit(&_probation);
+    _YYLinkedListInit(&_protected);
+    _YYLinkedListInit(&_pinned);
+    
+    _YYLinkedMapEntry *entries = _entries;
+    uint32_t used = _used;
+    free(_slots);
+    _entries = NULL;
+    _slots = NULL;
+    _slotMask = 0;
+    _capacity = 0;
+    _used = 0;
+    _freeHead = kYYLinkedMapNil;
+    if (!entries) return;
+    
+    void (^release)(void) = ^{
+        for (uint32_t i = 0; i < used; i++) {
+            if (entries[i].list == kYYLinkedMapListFree) continue;
+            CFRelease(entries[i].key);
+            CFRelease(entries[i].value);
         }
+        free(entries);
+    };
+    if (_releaseAsynchronously) {
+        dispatch_queue_t queue = _releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
+        dispatch_async(queue, release); // hold and release in specified queue
+    } else if (_releaseOnMainThread && !pthread_main_np()) {
+        dispatch_async(dispatch_get_main_queue(), release); // hold and release in specified queue
+    } else {
+        release();
     }
 }
 
+- (void)releasePendingObjects {
+    if (_pendingCount == 0) return;
+    CFTypeRef *objects = _pending;
+    NSUInteger count = _pendingCount;
+    if (!_releaseAsynchronously && !(_releaseOnMainThread && !pthread_main_np())) {
+        for (NSUInteger i = 0; i < count; i++) CFRelease(objects[i]);
+        _pendingCount = 0;
+        return;
+    }
+    
+    _pending = NULL;
+    _pendingCount = 0;
+    _pendingCapacity = 0;
+    dispatch_queue_t queue = _releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
+    dispatch_async(queue, ^{
+        for (NSUInteger i = 0; i < count; i++) CFRelease(objects[i]); // release in queue
+        free(objects);
+    });
+}
+
 @end
 
 
 
-@implementation YYMemoryCache {
+#pragma mark - Shard
+
+#define kYYMemoryCacheReadBufferSize 64
+static const int32_t kYYMemoryCacheReadBufferDrainThreshold = 16;
+
+/// A recorded read: entry generation in high 32 bits and entry index in low 32 bits.
+static inline int64_t _YYMemoryCacheReadMake(uint32_t index, uint32_t generation) {
+    return (int64_t)(((uint64_t)generation << 32) | index);
+}
+
+/**
+ A shard of YYMemoryCache, a linked map and the lock guards it.
+ 
+ When `_concurrentRead` is YES, the hash index and entries of the map are also
+ guarded by `_mapLock`: readers take the shared lock to look up an entry, and
+ record the hit in the read buffer instead of reordering the list; writers hold
+ `_lock` and take the exclusive `_mapLock` around the changes of entries. The
+ read buffer is drained with `_lock` held.
+ 
+ Typically, you should not use this class directly.
+ */
+@interface _YYMemoryCacheShard : NSObject {
+    @package
     pthread_mutex_t _lock;
     _YYLinkedMap *_lru;
-    dispatch_queue_t _queue;
+    pthread_rwlock_t _mapLock;
+    BOOL _concurrentRead; // change it with both `_lock` and `_mapLock` held
+    volatile int64_t _readBuffer[kYYMemoryCacheReadBufferSize]; // 0 if empty, lossy
+    volatile int32_t _readBufferCount;
 }
 
-- (void)_trimRecursively {
-    __weak typeof(self) _self = self;
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_autoTrimInterval * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
-        __strong typeof(_self) self = _self;
-        if (!self) return;
-        [self _trimInBackground];
-        [self _trimRecursively];
-    });
+/// Apply the buffered reads to the map, `_lock` should be held.
+- (void)drainReadBuffer;
+
+@end
+
+@implementation _YYMemoryCacheShard
+
+- (instancetype)init {
+    self = [super init];
+    pthread_mutex_init(&_lock, NULL);
+    pthread_rwlock_init(&_mapLock, NULL);
+    _lru = [_YYLinkedMap new];
+    return self;
 }
 
-- (void)_trimInBackground {
-    dispatch_async(_queue, ^{
-        [self _trimToCost:self->_costLimit];
-        [self _trimToCount:self->_countLimit];
-        [self _trimToAge:self->_ageLimit];
-    });
+- (void)dealloc {
+    pthread_rwlock_destroy(&_mapLock);
+    pthread_mutex_destroy(&_lock);
 }
 
-- (void)_trimToCost:(NSUInteger)costLimit {
-    BOOL finish = NO;
-    pthread_mutex_lock(&_lock);
-    if (costLimit == 0) {
-        [_lru removeAll];
-        finish = YES;
-    } else if (_lru->_totalCost <= costLimit) {
-        finish = YES;
-    }
-    pthread_mutex_unlock(&_lock);
-    if (finish) return;
-    
-    NSMutableArray *holder = [NSMutableArray new];
-    while (!finish) {
-        if (pthread_mutex_trylock(&_lock) == 0) {
-            if (_lru->_totalCost > costLimit) {
-                _YYLinkedMapNode *node = [_lru removeTailNode];
-                if (node) [holder addObject:node];
-            } else {
-                finish = YES;
-            }
-            pthread_mutex_unlock(&_lock);
-        } else {
-            usleep(10 * 1000); //10 ms
+- (void)drainReadBuffer {
+    if (_readBufferCount == 0) return;
+    for (int i = 0; i < kYYMemoryCacheReadBufferSize; i++) {
+        int64_t read = _readBuffer[i];
+        if (!read || !OSAtomicCompareAndSwap64Barrier(read, 0, &_readBuffer[i])) continue;
+        uint32_t index = (uint32_t)read;
+        uint32_t generation = (uint32_t)((uint64_t)read >> 32);
+        // the entry may be removed or reused after it was recorded
+        if (index < _lru->_used && _lru->_entries[index].generation == generation &&
+            _lru->_entries[index].list != kYYLinkedMapListFree) {
+            [_lru bringEntryToHead:index];
         }
     }
-    if (holder.count) {
-        dispatch_queue_t queue = _lru->_releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-        dispatch_async(queue, ^{
-            [holder count]; // release in queue
-        });
+    OSAtomicAnd32Barrier(0, (volatile uint32_t *)&_readBufferCount);
+}
+
+@end
+
+/// Record a hit to the read buffer, returns YES if the buffer should be drained.
+static inline BOOL _YYMemoryCacheShardRecordRead(_YYMemoryCacheShard *shard, uint32_t index) {
+    int32_t slot = OSAtomicIncrement32Barrier(&shard->_readBufferCount) - 1;
+    if (slot < 0 || slot >= kYYMemoryCacheReadBufferSize) return YES; // full, drop it
+    int64_t read = _YYMemoryCacheReadMake(index, shard->_lru->_entries[index].generation);
+    OSAtomicCompareAndSwap64Barrier(0, read, &shard->_readBuffer[slot]); // dropped if not drained yet
+    return slot + 1 >= kYYMemoryCacheReadBufferDrainThreshold;
+}
+
+/// Lock the map for writing, `_lock` should be held.
+static inline void _YYMemoryCacheShardBeginWrite(_YYMemoryCacheShard *shard) {
+    if (shard->_concurrentRead) pthread_rwlock_wrlock(&shard->_mapLock);
+}
+
+static inline void _YYMemoryCacheShardEndWrite(_YYMemoryCacheShard *shard) {
+    if (shard->_concurrentRead) pthread_rwlock_unlock(&shard->_mapLock);
+}
+
+
+static const NSUInteger kYYMemoryCacheMaxShardCount = 64;
+
+/// Mix the bits of key's hash, so that the low bits can be used to select a shard.
+static inline NSUInteger _YYMemoryCacheShardIndex(NSUInteger hash, NSUInteger shardMask) {
+    if (shardMask == 0) return 0;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash & shardMask;
+}
+
+/// The limit of a single shard, rounded up.
+static inline NSUInteger _YYMemoryCacheShardLimit(NSUInteger limit, NSUInteger shardCount) {
+    if (limit == NSUIntegerMax || shardCount <= 1) return limit;
+    return limit / shardCount + (limit % shardCount ? 1 : 0);
+}
+
+/// Max entries evicted inline by `setObject:forKey:withCost:`.
+static const NSUInteger kYYMemoryCacheInlineEvictCount = 4;
+
+/// Max entries evicted from a shard in one trim slice.
+static const NSUInteger kYYMemoryCacheTrimSliceCount = 64;
+
+/// Max time (in seconds) spent on a shard in one trim slice.
+static const NSTimeInterval kYYMemoryCacheTrimSliceDuration = 0.0005;
+
+
+
+@implementation YYSystemMemoryPressureSource {
+    dispatch_source_t _source;
+    void (^_handler)(YYMemoryPressureLevel level);
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+- (void)_appDidReceiveMemoryWarningNotification {
+    void (^handler)(YYMemoryPressureLevel level) = nil;
+    @synchronized (self) {
+        handler = _handler;
     }
+    if (handler) handler(YYMemoryPressureLevelUrgent);
 }
 
-- (void)_trimToCount:(NSUInteger)countLimit {
-    BOOL finish = NO;
-    pthread_mutex_lock(&_lock);
-    if (countLimit == 0) {
-        [_lru removeAll];
-        finish = YES;
-    } else if (_lru->_totalCount <= countLimit) {
-        finish = YES;
-    }
-    pthread_mutex_unlock(&_lock);
-    if (finish) return;
-    
-    NSMutableArray *holder = [NSMutableArray new];
-    while (!finish) {
-        if (pthread_mutex_trylock(&_lock) == 0) {
-            if (_lru->_totalCount > countLimit) {
-                _YYLinkedMapNode *node = [_lru removeTailNode];
-                if (node) [holder addObject:node];
-            } else {
-                finish = YES;
-            }
-            pthread_mutex_unlock(&_lock);
-        } else {
-            usleep(10 * 1000); //10 ms
+- (void)startWithHandler:(void (^)(YYMemoryPressureLevel))handler {
+    @synchronized (self) {
+        if (_source) return;
+        _handler = [handler copy];
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+                                         DISPATCH_MEMORYPRESSURE_NORMAL | DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                         dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+        if (_source) {
+            dispatch_source_t source = _source;
+            dispatch_source_set_event_handler(source, ^{
+                unsigned long flags = dispatch_source_get_data(source);
+                YYMemoryPressureLevel level = YYMemoryPressureLevelNormal;
+                if (flags & DISPATCH_MEMORYPRESSURE_CRITICAL) level = YYMemoryPressureLevelCritical;
+                else if (flags & DISPATCH_MEMORYPRESSURE_WARN) level = YYMemoryPressureLevelWarning;
+                handler(level);
+            });
+            dispatch_resume(source);
         }
     }
-    if (holder.count) {
-        dispatch_queue_t queue = _lru->_releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-        dispatch_async(queue, ^{
-            [holder count]; // release in queue
-        });
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appDidReceiveMemoryWarningNotification) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+}
+
+- (void)stop {
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    @synchronized (self) {
+        if (_source) dispatch_source_cancel(_source);
+        _source = nil;
+        _handler = nil;
     }
 }
 
-- (void)_trimToAge:(NSTimeInterval)ageLimit {
+@end
+
+
+
+@implementation YYMemoryCache {
+    NSArray *_shards;
+    __unsafe_unretained _YYMemoryCacheShard **_shardList; // retained by _shards
+    NSUInteger _shardMask;
+    dispatch_queue_t _queue;
+    volatile int32_t _trimScheduled;    // a trim slice is pending in _queue
+    volatile int32_t _ageTrimScheduled; // an age check is pending
+    NSUInteger _countLimit;
+    NSUInteger _costLimit;
+    NSTimeInterval _ageLimit;
+    id<YYMemoryPressureSource> _memoryPressureSource;
+}
+
+/**
+ Evict entries from a shard until it fits the limits, but at most `maxCount`
+ entries and `maxDuration` seconds, so readers won't wait for a long trim.
+ The lock is released before return.
+ @return YES if the shard fits the limits.
+ */
+- (BOOL)_trimShard:(_YYMemoryCacheShard *)shard
+            toCost:(NSUInteger)costLimit
+             count:(NSUInteger)countLimit
+               age:(NSTimeInterval)ageLimit
+          maxCount:(NSUInteger)maxCount
+       maxDuration:(NSTimeInterval)maxDuration {
+    _YYLinkedMap *lru = shard->_lru;
     BOOL finish = NO;
-    NSTimeInterval now = CACurrentMediaTime();
-    pthread_mutex_lock(&_lock);
-    if (ageLimit <= 0) {
-        [_lru removeAll];
-        finish = YES;
-    } else if (!_lru->_tail || (now - _lru->_tail->_time) <= ageLimit) {
-        finish = YES;
-    }
-    pthread_mutex_unlock(&_lock);
-    if (finish) return;
+    pthread_mutex_lock(&shard->_lock);
+    [shard drainReadBuffer];
+    if ((costLimit == 0 || countLimit == 0 || ageLimit <= 0) && lru->_pinned.count == 0) {
+        _YYMemoryCacheShardBeginWrite(shard);
+        [lru removeAll];
+        _YYMemoryCacheShardEndWrite(shard);
+        pthread_mutex_unlock(&shard->_lock);
+        return YES;
+    }
     
-    NSMutableArray *holder = [NSMutableArray new];
-    while (!finish) {
-        if (pthread_mutex_trylock(&_lock) == 0) {
-            if (_lru->_tail && (now - _lru->_tail->_time) > ageLimit) {
-                _YYLinkedMapNode *node = [_lru removeTailNode];
-                if (node) [holder addObject:node];
-            } else {
+    NSTimeInterval begin = CACurrentMediaTime();
+    NSUInteger removed = 0;
+    _YYMemoryCacheShardBeginWrite(shard);
+    while (1) {
+        if (lru->_totalCost > costLimit || lru->_totalCount > countLimit) {
+            if (![lru removeTailEntry]) {
                 finish = YES;
+                break;
             }
-            pthread_mutex_unlock(&_lock);
         } else {
-            usleep(10 * 1000); //10 ms
+            NSUInteger limit = maxCount - removed;
+            NSUInteger count = ageLimit < DBL_MAX ? [lru removeEntriesEarlierThanTime:begin - ageLimit limit:limit] : 0;
+            if (count < limit) finish = YES;
+            break;
+        }
+        removed++;
+        if (removed >= maxCount || CACurrentMediaTime() - begin >= maxDuration) break;
+    }
+    _YYMemoryCacheShardEndWrite(shard);
+    [lru releasePendingObjects];
+    pthread_mutex_unlock(&shard->_lock);
+    return finish;
+}
+
+/// Trim all shards in slices, the locks are released between slices.
+- (void)_trimToCost:(NSUInteger)costLimit count:(NSUInteger)countLimit age:(NSTimeInterval)ageLimit {
+    NSUInteger shardCount = _shardMask + 1;
+    NSUInteger shardCostLimit = _YYMemoryCacheShardLimit(costLimit, shardCount);
+    NSUInteger shardCountLimit = _YYMemoryCacheShardLimit(countLimit, shardCount);
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        while (![self _trimShard:_shardList[i] toCost:shardCostLimit count:shardCountLimit age:ageLimit
+                        maxCount:kYYMemoryCacheTrimSliceCount maxDuration:kYYMemoryCacheTrimSliceDuration]);
+    }
+}
+
+/// Schedule a background trim to the limits, if there's no pending one.
+- (void)_scheduleTrim {
+    if (_trimScheduled || !OSAtomicCompareAndSwap32Barrier(0, 1, &_trimScheduled)) return;
+    dispatch_async(_queue, ^{
+        [self _trimSlice];
+    });
+}
+
+/// Trim each shard by one slice, and schedule the next slice if some shards are
+/// still over the limits, so other blocks can run between the slices.
+- (void)_trimSlice {
+    NSUInteger shardCount = _shardMask + 1;
+    NSUInteger shardCostLimit = _YYMemoryCacheShardLimit(self.costLimit, shardCount);
+    NSUInteger shardCountLimit = _YYMemoryCacheShardLimit(self.countLimit, shardCount);
+    NSTimeInterval ageLimit = self.ageLimit;
+    BOOL finish = YES;
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        if (![self _trimShard:_shardList[i] toCost:shardCostLimit count:shardCountLimit age:ageLimit
+                     maxCount:kYYMemoryCacheTrimSliceCount maxDuration:kYYMemoryCacheTrimSliceDuration]) {
+            finish = NO;
         }
     }
-    if (holder.count) {
-        dispatch_queue_t queue = _lru->_releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-        dispatch_async(queue, ^{
-            [holder count]; // release in queue
+    if (!finish) {
+        dispatch_async(_queue, ^{
+            [self _trimSlice];
         });
+        return;
+    }
+    OSAtomicAnd32Barrier(0, (volatile uint32_t *)&_trimScheduled);
+    if (ageLimit < DBL_MAX && self.totalCount > 0) [self _scheduleAgeTrim];
+}
+
+/// Schedule an age check after `autoTrimInterval`. It's only needed when the
+/// `ageLimit` is set and the cache is not empty, so an idle cache never wakes up.
+- (void)_scheduleAgeTrim {
+    if (_ageTrimScheduled || !OSAtomicCompareAndSwap32Barrier(0, 1, &_ageTrimScheduled)) return;
+    __weak typeof(self) _self = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.autoTrimInterval * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        __strong typeof(_self) self = _self;
+        if (!self) return;
+        OSAtomicAnd32Barrier(0, (volatile uint32_t *)&self->_ageTrimScheduled);
+        [self _scheduleTrim];
+    });
+}
+
+/// Evict at most `maxCount` entries from a shard if it's over the limits, the lock
+/// should be held. Returns YES if the shard is still over the limits.
+- (BOOL)_evictShardInline:(_YYMemoryCacheShard *)shard maxCount:(NSUInteger)maxCount {
+    _YYLinkedMap *lru = shard->_lru;
+    NSUInteger shardCount = _shardMask + 1;
+    NSUInteger shardCostLimit = _YYMemoryCacheShardLimit(_costLimit, shardCount);
+    NSUInteger shardCountLimit = _YYMemoryCacheShardLimit(_countLimit, shardCount);
+    if (lru->_totalCost <= shardCostLimit && lru->_totalCount <= shardCountLimit) return NO;
+    _YYMemoryCacheShardBeginWrite(shard);
+    for (NSUInteger i = 0; i < maxCount; i++) {
+        if (![lru removeTailEntry]) break;
+        if (lru->_totalCost <= shardCostLimit && lru->_totalCount <= shardCountLimit) break;
+    }
+    _YYMemoryCacheShardEndWrite(shard);
+    return lru->_totalCost > shardCostLimit || lru->_totalCount > shardCountLimit;
+}
+
+/**
+ Group the keys by shard, and invoke the block for each key with the shard's lock
+ held, so each shard is locked only once.
+ @param write If YES, the map is also locked for writing.
+ @param completion Invoked for each shard after its keys, before it's unlocked.
+ */
+- (void)_accessShardsForKeys:(NSArray *)keys
+                       write:(BOOL)write
+                       block:(void (^)(_YYMemoryCacheShard *shard, id key, NSUInteger hash))block
+                  completion:(void (^)(_YYMemoryCacheShard *shard, NSUInteger count))completion {
+    NSUInteger count = keys.count;
+    if (count == 0) return;
+    NSUInteger *hashes = malloc(count * sizeof(NSUInteger));
+    NSUInteger *order = malloc(count * sizeof(NSUInteger));
+    if (!hashes || !order) {
+        free(hashes);
+        free(order);
+        return;
     }
+    
+    // counting sort by shard
+    NSUInteger starts[kYYMemoryCacheMaxShardCount + 1] = {0};
+    for (NSUInteger i = 0; i < count; i++) {
+        hashes[i] = CFHash((__bridge CFTypeRef)(keys[i]));
+        starts[_YYMemoryCacheShardIndex(hashes[i], _shardMask) + 1]++;
+    }
+    for (NSUInteger s = 0; s <= _shardMask; s++) starts[s + 1] += starts[s];
+    NSUInteger fills[kYYMemoryCacheMaxShardCount];
+    memcpy(fills, starts, sizeof(fills));
+    for (NSUInteger i = 0; i < count; i++) {
+        order[fills[_YYMemoryCacheShardIndex(hashes[i], _shardMask)]++] = i;
+    }
+    
+    for (NSUInteger s = 0; s <= _shardMask; s++) {
+        if (starts[s] == starts[s + 1]) continue;
+        _YYMemoryCacheShard *shard = _shardList[s];
+        pthread_mutex_lock(&shard->_lock);
+        [shard drainReadBuffer];
+        if (write) _YYMemoryCacheShardBeginWrite(shard);
+        for (NSUInteger j = starts[s]; j < starts[s + 1]; j++) {
+            NSUInteger i = order[j];
+            block(shard, keys[i], hashes[i]);
+        }
+        if (write) _YYMemoryCacheShardEndWrite(shard);
+        if (completion) completion(shard, starts[s + 1] - starts[s]);
+        [shard->_lru releasePendingObjects];
+        pthread_mutex_unlock(&shard->_lock);
+    }
+    free(hashes);
+    free(order);
 }
 
 - (void)_appDidReceiveMemoryWarningNotification {
     if (self.didReceiveMemoryWarningBlock) {
         self.didReceiveMemoryWarningBlock(self);
     }
-    if (self.shouldRemoveAllObjectsOnMemoryWarning) {
-        [self removeAllObjects];
-    }
 }
 
 - (void)_appDidEnterBackgroundNotification {
@@ -313,97 +1067,302 @@ static inline dispatch_queue_t YYMemoryCacheGetReleaseQueue() {
         self.didEnterBackgroundBlock(self);
     }
     if (self.shouldRemoveAllObjectsWhenEnteringBackground) {
-        [self removeAllObjects];
+        [self trimForMemoryPressure:YYMemoryPressureLevelCritical];
     }
 }
 
+- (void)_didReceiveMemoryPressure:(YYMemoryPressureLevel)level {
+    if (self.shouldTrimOnMemoryPressure) {
+        [self trimForMemoryPressure:level];
+    }
+}
+
+- (void)_startMemoryPressureSource:(id<YYMemoryPressureSource>)source {
+    __weak typeof(self) _self = self;
+    [source startWithHandler:^(YYMemoryPressureLevel level) {
+        __strong typeof(_self) self = _self;
+        [self _didReceiveMemoryPressure:level];
+    }];
+}
+
 #pragma mark - public
 
 - (instancetype)init {
+    return [self initWithShardCount:1];
+}
+
+- (instancetype)initWithShardCount:(NSUInteger)shardCount {
     self = super.init;
-    pthread_mutex_init(&_lock, NULL);
-    _lru = [_YYLinkedMap new];
+    NSUInteger count = 1;
+    while (count < shardCount && count < kYYMemoryCacheMaxShardCount) count <<= 1;
+    NSMutableArray *shards = [NSMutableArray arrayWithCapacity:count];
+    _shardList = (__unsafe_unretained _YYMemoryCacheShard **)calloc(count, sizeof(_YYMemoryCacheShard *));
+    for (NSUInteger i = 0; i < count; i++) {
+        _YYMemoryCacheShard *shard = [_YYMemoryCacheShard new];
+        [shards addObject:shard];
+        _shardList[i] = shard;
+    }
+    _shards = shards;
+    _shardMask = count - 1;
     _queue = dispatch_queue_create("com.ibireme.cache.memory", DISPATCH_QUEUE_SERIAL);
     
     _countLimit = NSUIntegerMax;
     _costLimit = NSUIntegerMax;
     _ageLimit = DBL_MAX;
     _autoTrimInterval = 5.0;
-    _shouldRemoveAllObjectsOnMemoryWarning = YES;
+    _shouldTrimOnMemoryPressure = YES;
     _shouldRemoveAllObjectsWhenEnteringBackground = YES;
+    _memoryPressureSource = [YYSystemMemoryPressureSource new];
+    [self _startMemoryPressureSource:_memoryPressureSource];
     
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appDidReceiveMemoryWarningNotification) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_appDidEnterBackgroundNotification) name:UIApplicationDidEnterBackgroundNotification object:nil];
     
-    [self _trimRecursively];
     return self;
 }
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
     [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidEnterBackgroundNotification object:nil];
-    [_lru removeAll];
-    pthread_mutex_destroy(&_lock);
+    [_memoryPressureSource stop];
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        [_shardList[i]->_lru removeAll];
+    }
+    free(_shardList);
+}
+
+- (NSUInteger)shardCount {
+    return _shardMask + 1;
+}
+
+- (NSUInteger)countLimit {
+    return _countLimit;
+}
+
+- (void)setCountLimit:(NSUInteger)countLimit {
+    _countLimit = countLimit;
+    [self _scheduleTrim];
+}
+
+- (NSUInteger)costLimit {
+    return _costLimit;
+}
+
+- (void)setCostLimit:(NSUInteger)costLimit {
+    _costLimit = costLimit;
+    [self _scheduleTrim];
+}
+
+- (id<YYMemoryPressureSource>)memoryPressureSource {
+    @synchronized (self) {
+        return _memoryPressureSource;
+    }
+}
+
+- (void)setMemoryPressureSource:(id<YYMemoryPressureSource>)memoryPressureSource {
+    @synchronized (self) {
+        if (_memoryPressureSource == memoryPressureSource) return;
+        [_memoryPressureSource stop];
+        _memoryPressureSource = memoryPressureSource;
+        [self _startMemoryPressureSource:memoryPressureSource];
+    }
+}
+
+- (NSTimeInterval)ageLimit {
+    return _ageLimit;
+}
+
+- (void)setAgeLimit:(NSTimeInterval)ageLimit {
+    _ageLimit = ageLimit;
+    [self _scheduleTrim];
 }
 
 - (NSUInteger)totalCount {
-    pthread_mutex_lock(&_lock);
-    NSUInteger count = _lru->_totalCount;
-    pthread_mutex_unlock(&_lock);
+    NSUInteger count = 0;
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        count += shard->_lru->_totalCount;
+        pthread_mutex_unlock(&shard->_lock);
+    }
     return count;
 }
 
 - (NSUInteger)totalCost {
-    pthread_mutex_lock(&_lock);
-    NSUInteger totalCost = _lru->_totalCost;
-    pthread_mutex_unlock(&_lock);
+    NSUInteger totalCost = 0;
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        totalCost += shard->_lru->_totalCost;
+        pthread_mutex_unlock(&shard->_lock);
+    }
     return totalCost;
 }
 
 - (BOOL)releaseOnMainThread {
-    pthread_mutex_lock(&_lock);
-    BOOL releaseOnMainThread = _lru->_releaseOnMainThread;
-    pthread_mutex_unlock(&_lock);
+    _YYMemoryCacheShard *shard = _shardList[0];
+    pthread_mutex_lock(&shard->_lock);
+    BOOL releaseOnMainThread = shard->_lru->_releaseOnMainThread;
+    pthread_mutex_unlock(&shard->_lock);
     return releaseOnMainThread;
 }
 
 - (void)setReleaseOnMainThread:(BOOL)releaseOnMainThread {
-    pthread_mutex_lock(&_lock);
-    _lru->_releaseOnMainThread = releaseOnMainThread;
-    pthread_mutex_unlock(&_lock);
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        shard->_lru->_releaseOnMainThread = releaseOnMainThread;
+        pthread_mutex_unlock(&shard->_lock);
+    }
 }
 
 - (BOOL)releaseAsynchronously {
-    pthread_mutex_lock(&_lock);
-    BOOL releaseAsynchronously = _lru->_releaseAsynchronously;
-    pthread_mutex_unlock(&_lock);
+    _YYMemoryCacheShard *shard = _shardList[0];
+    pthread_mutex_lock(&shard->_lock);
+    BOOL releaseAsynchronously = shard->_lru->_releaseAsynchronously;
+    pthread_mutex_unlock(&shard->_lock);
     return releaseAsynchronously;
 }
 
 - (void)setReleaseAsynchronously:(BOOL)releaseAsynchronously {
-    pthread_mutex_lock(&_lock);
-    _lru->_releaseAsynchronously = releaseAsynchronously;
-    pthread_mutex_unlock(&_lock);
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        shard->_lru->_releaseAsynchronously = releaseAsynchronously;
+        pthread_mutex_unlock(&shard->_lock);
+    }
+}
+
+- (YYMemoryCacheEvictionPolicy)evictionPolicy {
+    _YYMemoryCacheShard *shard = _shardList[0];
+    pthread_mutex_lock(&shard->_lock);
+    YYMemoryCacheEvictionPolicy policy = shard->_lru->_policy;
+    pthread_mutex_unlock(&shard->_lock);
+    return policy;
+}
+
+- (void)setEvictionPolicy:(YYMemoryCacheEvictionPolicy)evictionPolicy {
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        [shard drainReadBuffer];
+        [shard->_lru setPolicy:evictionPolicy];
+        pthread_mutex_unlock(&shard->_lock);
+    }
+}
+
+- (BOOL)concurrentReadEnabled {
+    _YYMemoryCacheShard *shard = _shardList[0];
+    pthread_mutex_lock(&shard->_lock);
+    BOOL enabled = shard->_concurrentRead;
+    pthread_mutex_unlock(&shard->_lock);
+    return enabled;
+}
+
+- (void)setConcurrentReadEnabled:(BOOL)concurrentReadEnabled {
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        pthread_rwlock_wrlock(&shard->_mapLock);
+        shard->_concurrentRead = concurrentReadEnabled;
+        pthread_rwlock_unlock(&shard->_mapLock);
+        [shard drainReadBuffer];
+        pthread_mutex_unlock(&shard->_lock);
+    }
+}
+
+- (BOOL)shouldRemoveAllObjectsOnMemoryWarning {
+    return self.shouldTrimOnMemoryPressure;
+}
+
+- (void)setShouldRemoveAllObjectsOnMemoryWarning:(BOOL)shouldRemoveAllObjectsOnMemoryWarning {
+    self.shouldTrimOnMemoryPressure = shouldRemoveAllObjectsOnMemoryWarning;
 }
 
 - (BOOL)containsObjectForKey:(id)key {
     if (!key) return NO;
-    pthread_mutex_lock(&_lock);
-    BOOL contains = CFDictionaryContainsKey(_lru->_dic, (__bridge const void *)(key));
-    pthread_mutex_unlock(&_lock);
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    if (shard->_concurrentRead) {
+        pthread_rwlock_rdlock(&shard->_mapLock);
+        if (shard->_concurrentRead) { // checked again with lock held
+            BOOL contains = [shard->_lru findKey:key hash:hash] != kYYLinkedMapNil;
+            pthread_rwlock_unlock(&shard->_mapLock);
+            return contains;
+        }
+        pthread_rwlock_unlock(&shard->_mapLock);
+    }
+    pthread_mutex_lock(&shard->_lock);
+    BOOL contains = [shard->_lru findKey:key hash:hash] != kYYLinkedMapNil;
+    pthread_mutex_unlock(&shard->_lock);
     return contains;
 }
 
+- (NSSet *)containsObjectsForKeys:(NSArray *)keys {
+    NSMutableSet *contained = [NSMutableSet new];
+    [self _accessShardsForKeys:keys write:NO block:^(_YYMemoryCacheShard *shard, id key, NSUInteger hash) {
+        if ([shard->_lru findKey:key hash:hash] != kYYLinkedMapNil) [contained addObject:key];
+    } completion:nil];
+    return contained;
+}
+
+- (NSDictionary *)objectsForKeys:(NSArray *)keys {
+    NSMutableDictionary *objects = [NSMutableDictionary new];
+    NSTimeInterval now = CACurrentMediaTime();
+    [self _accessShardsForKeys:keys write:NO block:^(_YYMemoryCacheShard *shard, id key, NSUInteger hash) {
+        _YYLinkedMap *lru = shard->_lru;
+        uint32_t index = [lru findKey:key hash:hash];
+        if (index != kYYLinkedMapNil) {
+            lru->_entries[index].time = now;
+            objects[key] = (__bridge id)(lru->_entries[index].value);
+            [lru bringEntryToHead:index];
+        } else {
+            [lru recordMissWithHash:hash];
+        }
+    } completion:nil];
+    return objects;
+}
+
 - (id)objectForKey:(id)key {
     if (!key) return nil;
-    pthread_mutex_lock(&_lock);
-    _YYLinkedMapNode *node = CFDictionaryGetValue(_lru->_dic, (__bridge const void *)(key));
-    if (node) {
-        node->_time = CACurrentMediaTime();
-        [_lru bringNodeToHead:node];
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    _YYLinkedMap *lru = shard->_lru;
+    if (shard->_concurrentRead) {
+        pthread_rwlock_rdlock(&shard->_mapLock);
+        if (shard->_concurrentRead) { // checked again with lock held
+            uint32_t index = [lru findKey:key hash:hash];
+            id value = nil;
+            BOOL needsDrain = NO;
+            if (index != kYYLinkedMapNil) {
+                lru->_entries[index].time = CACurrentMediaTime();
+                value = (__bridge id)(lru->_entries[index].value);
+                needsDrain = _YYMemoryCacheShardRecordRead(shard, index);
+            }
+            pthread_rwlock_unlock(&shard->_mapLock);
+            BOOL miss = !value;
+            if ((needsDrain || (miss && lru->_policy != YYMemoryCacheEvictionPolicyLRU)) &&
+                pthread_mutex_trylock(&shard->_lock) == 0) {
+                if (needsDrain) [shard drainReadBuffer];
+                if (miss) [lru recordMissWithHash:hash];
+                pthread_mutex_unlock(&shard->_lock);
+            }
+            return value;
+        }
+        pthread_rwlock_unlock(&shard->_mapLock);
     }
-    pthread_mutex_unlock(&_lock);
-    return node ? node->_value : nil;
+    pthread_mutex_lock(&shard->_lock);
+    id value = nil;
+    uint32_t index = [lru findKey:key hash:hash];
+    if (index != kYYLinkedMapNil) {
+        lru->_entries[index].time = CACurrentMediaTime();
+        value = (__bridge id)(lru->_entries[index].value);
+        [lru bringEntryToHead:index];
+    } else {
+        [lru recordMissWithHash:hash];
+    }
+    pthread_mutex_unlock(&shard->_lock);
+    return value;
 }
 
 - (void)setObject:(id)object forKey:(id)key {
@@ -416,85 +1375,146 @@ static inline dispatch_queue_t YYMemoryCacheGetReleaseQueue() {
         [self removeObjectForKey:key];
         return;
     }
-    pthread_mutex_lock(&_lock);
-    _YYLinkedMapNode *node = CFDictionaryGetValue(_lru->_dic, (__bridge const void *)(key));
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    _YYLinkedMap *lru = shard->_lru;
+    pthread_mutex_lock(&shard->_lock);
+    [shard drainReadBuffer];
+    uint32_t index = [lru findKey:key hash:hash];
     NSTimeInterval now = CACurrentMediaTime();
-    if (node) {
-        _lru->_totalCost -= node->_cost;
-        _lru->_totalCost += cost;
-        node->_cost = cost;
-        node->_time = now;
-        node->_value = object;
-        [_lru bringNodeToHead:node];
+    _YYMemoryCacheShardBeginWrite(shard);
+    if (index != kYYLinkedMapNil) {
+        [lru setValue:object cost:cost forEntry:index];
+        lru->_entries[index].time = now;
+        [lru bringEntryToHead:index];
     } else {
-        node = [_YYLinkedMapNode new];
-        node->_cost = cost;
-        node->_time = now;
-        node->_key = key;
-        node->_value = object;
-        [_lru insertNodeAtHead:node];
-    }
-    if (_lru->_totalCost > _costLimit) {
-        dispatch_async(_queue, ^{
-            [self trimToCost:_costLimit];
-        });
+        [lru insertKey:key value:object cost:cost time:now hash:hash];
     }
-    if (_lru->_totalCount > _countLimit) {
-        _YYLinkedMapNode *node = [_lru removeTailNode];
-        if (_lru->_releaseAsynchronously) {
-            dispatch_queue_t queue = _lru->_releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-            dispatch_async(queue, ^{
-                [node class]; //hold and release in queue
-            });
-        } else if (_lru->_releaseOnMainThread && !pthread_main_np()) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [node class]; //hold and release in queue
-            });
+    _YYMemoryCacheShardEndWrite(shard);
+    BOOL overLimit = [self _evictShardInline:shard maxCount:kYYMemoryCacheInlineEvictCount];
+    [lru releasePendingObjects];
+    pthread_mutex_unlock(&shard->_lock);
+    if (overLimit) [self _scheduleTrim];
+    if (_ageLimit < DBL_MAX && !_ageTrimScheduled) [self _scheduleAgeTrim];
+}
+
+- (void)setObjectsWithDictionary:(NSDictionary *)dictionary {
+    if (dictionary.count == 0) return;
+    NSArray *keys = dictionary.allKeys;
+    NSTimeInterval now = CACurrentMediaTime();
+    __block BOOL overLimit = NO;
+    [self _accessShardsForKeys:keys write:YES block:^(_YYMemoryCacheShard *shard, id key, NSUInteger hash) {
+        _YYLinkedMap *lru = shard->_lru;
+        id object = dictionary[key];
+        uint32_t index = [lru findKey:key hash:hash];
+        if (index != kYYLinkedMapNil) {
+            [lru setValue:object cost:0 forEntry:index];
+            lru->_entries[index].time = now;
+            [lru bringEntryToHead:index];
+        } else {
+            [lru insertKey:key value:object cost:0 time:now hash:hash];
         }
+    } completion:^(_YYMemoryCacheShard *shard, NSUInteger count) {
+        if ([self _evictShardInline:shard maxCount:kYYMemoryCacheInlineEvictCount * count]) overLimit = YES;
+    }];
+    if (overLimit) [self _scheduleTrim];
+    if (_ageLimit < DBL_MAX && !_ageTrimScheduled) [self _scheduleAgeTrim];
+}
+
+- (BOOL)pinObjectForKey:(id)key {
+    if (!key) return NO;
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    pthread_mutex_lock(&shard->_lock);
+    [shard drainReadBuffer];
+    uint32_t index = [shard->_lru findKey:key hash:hash];
+    if (index != kYYLinkedMapNil) [shard->_lru pinEntry:index];
+    pthread_mutex_unlock(&shard->_lock);
+    return index != kYYLinkedMapNil;
+}
+
+- (void)unpinObjectForKey:(id)key {
+    if (!key) return;
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    BOOL overLimit = NO;
+    pthread_mutex_lock(&shard->_lock);
+    [shard drainReadBuffer];
+    _YYLinkedMap *lru = shard->_lru;
+    uint32_t index = [lru findKey:key hash:hash];
+    if (index != kYYLinkedMapNil) {
+        // it's used until unpinned, and it goes back to the head of the window list
+        lru->_entries[index].time = CACurrentMediaTime();
+        [lru unpinEntry:index];
+        NSUInteger shardCount = _shardMask + 1;
+        overLimit = lru->_totalCost > _YYMemoryCacheShardLimit(_costLimit, shardCount) ||
+                    lru->_totalCount > _YYMemoryCacheShardLimit(_countLimit, shardCount);
+    }
+    pthread_mutex_unlock(&shard->_lock);
+    if (overLimit) [self _scheduleTrim];
+}
+
+- (void)trimForMemoryPressure:(YYMemoryPressureLevel)level {
+    switch (level) {
+        case YYMemoryPressureLevelWarning: {
+            [self _trimToCost:self.totalCost / 2 count:self.totalCount / 2 age:DBL_MAX];
+        } break;
+        case YYMemoryPressureLevelUrgent: {
+            [self _trimToCost:self.totalCost / 4 count:self.totalCount / 4 age:DBL_MAX];
+        } break;
+        case YYMemoryPressureLevelCritical: {
+            [self _trimToCost:0 count:0 age:DBL_MAX];
+        } break;
+        default: break;
     }
-    pthread_mutex_unlock(&_lock);
 }
 
 - (void)removeObjectForKey:(id)key {
     if (!key) return;
-    pthread_mutex_lock(&_lock);
-    _YYLinkedMapNode *node = CFDictionaryGetValue(_lru->_dic, (__bridge const void *)(key));
-    if (node) {
-        [_lru removeNode:node];
-        if (_lru->_releaseAsynchronously) {
-            dispatch_queue_t queue = _lru->_releaseOnMainThread ? dispatch_get_main_queue() : YYMemoryCacheGetReleaseQueue();
-            dispatch_async(queue, ^{
-                [node class]; //hold and release in queue
-            });
-        } else if (_lru->_releaseOnMainThread && !pthread_main_np()) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [node class]; //hold and release in queue
-            });
-        }
+    NSUInteger hash = CFHash((__bridge CFTypeRef)(key));
+    _YYMemoryCacheShard *shard = _shardList[_YYMemoryCacheShardIndex(hash, _shardMask)];
+    _YYLinkedMap *lru = shard->_lru;
+    pthread_mutex_lock(&shard->_lock);
+    uint32_t index = [lru findKey:key hash:hash];
+    if (index != kYYLinkedMapNil) {
+        _YYMemoryCacheShardBeginWrite(shard);
+        [lru removeEntry:index];
+        _YYMemoryCacheShardEndWrite(shard);
+        [lru releasePendingObjects];
     }
-    pthread_mutex_unlock(&_lock);
+    pthread_mutex_unlock(&shard->_lock);
+}
+
+- (void)removeObjectsForKeys:(NSArray *)keys {
+    if (keys.count == 0) return;
+    [self _accessShardsForKeys:keys write:YES block:^(_YYMemoryCacheShard *shard, id key, NSUInteger hash) {
+        uint32_t index = [shard->_lru findKey:key hash:hash];
+        if (index != kYYLinkedMapNil) [shard->_lru removeEntry:index];
+    } completion:nil];
 }
 
 - (void)removeAllObjects {
-    pthread_mutex_lock(&_lock);
-    [_lru removeAll];
-    pthread_mutex_unlock(&_lock);
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        _YYMemoryCacheShard *shard = _shardList[i];
+        pthread_mutex_lock(&shard->_lock);
+        [shard drainReadBuffer];
+        _YYMemoryCacheShardBeginWrite(shard);
+        [shard->_lru removeAll];
+        _YYMemoryCacheShardEndWrite(shard);
+        pthread_mutex_unlock(&shard->_lock);
+    }
 }
 
 - (void)trimToCount:(NSUInteger)count {
-    if (count == 0) {
-        [self removeAllObjects];
-        return;
-    }
-    [self _trimToCount:count];
+    [self _trimToCost:NSUIntegerMax count:count age:DBL_MAX];
 }
 
 - (void)trimToCost:(NSUInteger)cost {
-    [self _trimToCost:cost];
+    [self _trimToCost:cost count:NSUIntegerMax age:DBL_MAX];
 }
 
 - (void)trimToAge:(NSTimeInterval)age {
-    [self _trimToAge:age];
+    [self _trimToCost:NSUIntegerMax count:NSUIntegerMax age:age];
 }
 
 - (NSString *)description {
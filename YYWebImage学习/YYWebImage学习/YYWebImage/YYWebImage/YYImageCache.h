@@ -11,6 +11,12 @@
 
 #import <UIKit/UIKit.h>
 
+#if __has_include(<YYCache/YYDiskCache.h>)
+#import <YYCache/YYDiskCache.h>
+#else
+#import "YYDiskCache.h"
+#endif
+
 @class YYMemoryCache, YYDiskCache;
 
 NS_ASSUME_NONNULL_BEGIN
@@ -145,6 +151,14 @@ typedef NS_OPTIONS(NSUInteger, YYImageCacheType) {
               withType:(YYImageCacheType)type
              withBlock:(void(^)(UIImage * _Nullable image, YYImageCacheType type))block;
 
+// 按优先级从磁盘读取并解码图片，block 在主线程回调
+// 返回的 task 可以取消（例如 cell 滑出屏幕），取消后未开始的读取不会执行，block 也不会回调
+// 如果图片在内存中，返回 nil
+- (nullable YYDiskCacheTask *)getImageForKey:(NSString *)key
+                                     withType:(YYImageCacheType)type
+                                     priority:(YYDiskCachePriority)priority
+                                    withBlock:(void(^)(UIImage * _Nullable image, YYImageCacheType type))block;
+
 
 - (nullable NSData *)getImageDataForKey:(NSString *)key;
 
@@ -104,7 +104,7 @@ static inline dispatch_queue_t YYImageCacheDecodeQueue() {
 - (instancetype)initWithPath:(NSString *)path {
     // 初始化内存中缓存
     YYMemoryCache *memoryCache = [YYMemoryCache new];
-    memoryCache.shouldRemoveAllObjectsOnMemoryWarning = YES;
+    memoryCache.shouldTrimOnMemoryPressure = YES;
     memoryCache.shouldRemoveAllObjectsWhenEnteringBackground = YES;
     // 没有限制缓存数量
     memoryCache.countLimit = NSUIntegerMax;
@@ -112,9 +112,13 @@ static inline dispatch_queue_t YYImageCacheDecodeQueue() {
     memoryCache.ageLimit = 12 * 60 * 60;
     
     // 初始化磁盘缓存
-    YYDiskCache *diskCache = [[YYDiskCache alloc] initWithPath:path];
+    // 磁盘缓存在后台打开，内存缓存可以立即使用
+    YYDiskCache *diskCache = [[YYDiskCache alloc] initWithPath:path inlineThreshold:1024 * 20 useSegmentFiles:NO openAsynchronously:YES];
     diskCache.customArchiveBlock = ^(id object) { return (NSData *)object; };
     diskCache.customUnarchiveBlock = ^(NSData *data) { return (id)data; };
+    diskCache.mappedReadEnabled = YES;
+    // 相同的图片数据（不同的 URL）只保存一个文件
+    diskCache.contentDedupEnabled = YES;
     if (!memoryCache || !diskCache) return nil;
     
     self = [super init];
@@ -241,37 +245,43 @@ static inline dispatch_queue_t YYImageCacheDecodeQueue() {
 }
 
 - (void)getImageForKey:(NSString *)key withType:(YYImageCacheType)type withBlock:(void (^)(UIImage *image, YYImageCacheType type))block {
-    if (!block) return;
+    [self getImageForKey:key withType:type priority:YYDiskCachePriorityNormal withBlock:block];
+}
 
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        UIImage *image = nil;
-        // 内存中获取
-        if (type & YYImageCacheTypeMemory) {
-            image = [_memoryCache objectForKey:key];
-            if (image) {
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    block(image, YYImageCacheTypeMemory);
-                });
-                return;
-            }
+- (YYDiskCacheTask *)getImageForKey:(NSString *)key withType:(YYImageCacheType)type priority:(YYDiskCachePriority)priority withBlock:(void (^)(UIImage *image, YYImageCacheType type))block {
+    if (!block) return nil;
+    
+    // 内存中获取，内存缓存很快，不需要切换线程
+    if (type & YYImageCacheTypeMemory) {
+        UIImage *image = [_memoryCache objectForKey:key];
+        if (image) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                block(image, YYImageCacheTypeMemory);
+            });
+            return nil;
         }
-        // 在磁盘中获取
-        if (type & YYImageCacheTypeDisk) {
-            NSData *data = (id)[_diskCache objectForKey:key];
-            image = [self imageFromData:data];
-            if (image) {
-                [_memoryCache setObject:image forKey:key];
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    block(image, YYImageCacheTypeDisk);
-                });
-                return;
-            }
+    }
+    if (!(type & YYImageCacheTypeDisk)) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            block(nil, YYImageCacheTypeNone);
+        });
+        return nil;
+    }
+    
+    // 在磁盘中获取，读取和解码在磁盘缓存的后台线程中按优先级执行，线程数量有限
+    return [_diskCache objectForKey:key priority:priority withBlock:^(NSString *key, id<NSCoding> object) {
+        UIImage *image = [self imageFromData:(NSData *)object];
+        if (image) {
+            [_memoryCache setObject:image forKey:key];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                block(image, YYImageCacheTypeDisk);
+            });
+            return;
         }
-        
         dispatch_async(dispatch_get_main_queue(), ^{
             block(nil, YYImageCacheTypeNone);
         });
-    });
+    }];
 }
 
 - (NSData *)getImageDataForKey:(NSString *)key {